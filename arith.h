@@ -0,0 +1,392 @@
+/* arith.h - context-adaptive binary arithmetic coding of quantized 8x8 blocks
+
+   Do this:
+      #define ARITH_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+   Needs rle.h (with RLE_IMPLEMENTATION defined in the same program).
+
+   The slowest and smallest of the entropy coders. Every coefficient is
+   binarized into yes/no decisions and each decision is coded with its own
+   adaptive probability (arith_context), so the coder learns the image
+   instead of using a fixed table:
+
+      DC     block[0] as it is, so run dc_predict.h first and this is the
+             prediction residual: zero?, sign, magnitude. Contexts depend
+             on the previous block's residual (zero, small or large, and
+             its sign), as in JPEG arithmetic coding.
+      AC     in zigzag order: end of block? at the start and after every
+             nonzero, zero? at each position, then sign and magnitude of
+             the nonzero values. End-of-block and zero contexts are per
+             zigzag position and per neighbourhood class, the number of
+             nonzero AC coefficients of the left and upper blocks.
+      levels magnitude - 1 as a unary size category (one context per
+             step) and the bits below its top bit (one context per
+             category).
+
+   The coder is a carry-propagating range coder with 32-bit range and
+   16-bit probabilities. A context adapts fast while it is new (shift 2)
+   and slows down as it sees more decisions (shift 7), so rarely used
+   contexts still learn quickly.
+*/
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stddef.h>
+
+// Probability that the next decision is 0, in 1/65536, and the number of
+// decisions seen so far (saturating), which sets the adaptation rate
+typedef struct {
+    unsigned short prob;
+    unsigned char count;
+} arith_context;
+
+typedef struct {
+    unsigned long long low;   // 33 bits: the carry sits in bit 32
+    unsigned int range;
+    unsigned char cache;      // last byte not yet written, a carry may still reach it
+    size_t pending;           // cache plus the 0xFF bytes after it
+    unsigned char *buffer;
+    size_t size;
+    size_t capacity;
+} arith_encoder;
+
+typedef struct {
+    unsigned int range;
+    unsigned int code;
+    const unsigned char *p;
+    const unsigned char *end;
+} arith_decoder;
+
+void arith_context_init(arith_context *contexts, size_t count);
+
+void arith_encoder_init(arith_encoder *e);
+void arith_encode_bit(arith_encoder *e, arith_context *c, int bit);
+// Write out everything pending; the bytes are in e->buffer, e->size
+void arith_encoder_finish(arith_encoder *e);
+void arith_encoder_free(arith_encoder *e);
+
+// Reads past the end of data as zero bytes, so a corrupt stream stays in bounds
+void arith_decoder_init(arith_decoder *d, const unsigned char *data, size_t size);
+int arith_decode_bit(arith_decoder *d, arith_context *c);
+
+// Whole block-major channel of blocks_x * blocks_y 8x8 blocks (raster order)
+// to a scan (allocated, caller frees). Returns the scan size, 0 on failure.
+size_t arith_encode_blocks(const short *coefficients, int blocks_x, int blocks_y, unsigned char **scan);
+
+// Scan back to blocks; 1 on success, 0 on a corrupt scan
+int arith_decode_blocks(const unsigned char *scan, size_t size, int blocks_x, int blocks_y, short *coefficients);
+
+#endif // ARITH_H
+
+#ifdef ARITH_IMPLEMENTATION
+#ifndef ARITH_IMPLEMENTATION_DONE
+#define ARITH_IMPLEMENTATION_DONE
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARITH_TOP (1u << 24)
+#define ARITH_COUNT_LIMIT 62
+
+// Largest magnitude category; int16 levels and residuals need at most 15
+#define ARITH_MAX_CATEGORY 16
+
+// Neighbourhood classes for AC contexts, DC classes for the DC contexts and
+// zigzag bands for the level contexts
+#define ARITH_NZ_CLASSES 4
+#define ARITH_DC_CLASSES 5
+#define ARITH_AC_BANDS 3
+
+// Adaptation shift for a context that has seen count decisions
+static int arith_shift(int count) {
+    return count < 2 ? 2 : count < 6 ? 3 : count < 14 ? 4 : count < 30 ? 5 : count < ARITH_COUNT_LIMIT ? 6 : 7;
+}
+
+void arith_context_init(arith_context *contexts, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        contexts[i].prob = 32768;
+        contexts[i].count = 0;
+    }
+}
+
+void arith_encoder_init(arith_encoder *e) {
+    e->low = 0;
+    e->range = 0xFFFFFFFFu;
+    e->cache = 0;
+    e->pending = 1;
+    e->capacity = 1 << 16;
+    e->size = 0;
+    e->buffer = (unsigned char *)malloc(e->capacity);
+}
+
+static void arith_put_byte(arith_encoder *e, unsigned char byte) {
+    if (e->size == e->capacity) {
+        unsigned char *grown = (unsigned char *)realloc(e->buffer, e->capacity * 2);
+        if (grown == NULL) {
+            free(e->buffer);
+            e->buffer = NULL;
+            e->capacity = 0;
+            return;
+        }
+        e->buffer = grown;
+        e->capacity *= 2;
+    }
+    if (e->buffer != NULL) e->buffer[e->size++] = byte;
+}
+
+// Move the top byte of low out. While it is 0xFF a later carry could still
+// change it, so such bytes are only counted until the next byte settles them.
+static void arith_shift_low(arith_encoder *e) {
+    if ((unsigned int)e->low < 0xFF000000u || (e->low >> 32) != 0) {
+        unsigned char carry = (unsigned char)(e->low >> 32);
+        unsigned char byte = e->cache;
+        do {
+            arith_put_byte(e, (unsigned char)(byte + carry));
+            byte = 0xFF;
+        } while (--e->pending != 0);
+        e->cache = (unsigned char)(e->low >> 24);
+    }
+    e->pending++;
+    e->low = (e->low & 0x00FFFFFFu) << 8;
+}
+
+void arith_encode_bit(arith_encoder *e, arith_context *c, int bit) {
+    unsigned int bound = (e->range >> 16) * c->prob;
+    int shift = arith_shift(c->count);
+    c->count += c->count < ARITH_COUNT_LIMIT;
+    if (!bit) {
+        e->range = bound;
+        c->prob += (unsigned short)((65536 - c->prob) >> shift);
+    } else {
+        e->low += bound;
+        e->range -= bound;
+        c->prob -= (unsigned short)(c->prob >> shift);
+    }
+    while (e->range < ARITH_TOP) {
+        e->range <<= 8;
+        arith_shift_low(e);
+    }
+}
+
+void arith_encoder_finish(arith_encoder *e) {
+    for (int i = 0; i < 5; i++) arith_shift_low(e);
+}
+
+void arith_encoder_free(arith_encoder *e) {
+    free(e->buffer);
+    e->buffer = NULL;
+    e->size = e->capacity = 0;
+}
+
+static unsigned int arith_next_byte(arith_decoder *d) {
+    return d->p < d->end ? *d->p++ : 0;
+}
+
+void arith_decoder_init(arith_decoder *d, const unsigned char *data, size_t size) {
+    d->p = data;
+    d->end = data + size;
+    d->range = 0xFFFFFFFFu;
+    d->code = 0;
+    // The first byte is the encoder's initial cache, always 0
+    for (int i = 0; i < 5; i++) d->code = (d->code << 8) | arith_next_byte(d);
+}
+
+int arith_decode_bit(arith_decoder *d, arith_context *c) {
+    unsigned int bound = (d->range >> 16) * c->prob;
+    int shift = arith_shift(c->count);
+    int bit;
+    c->count += c->count < ARITH_COUNT_LIMIT;
+    if (d->code < bound) {
+        d->range = bound;
+        c->prob += (unsigned short)((65536 - c->prob) >> shift);
+        bit = 0;
+    } else {
+        d->code -= bound;
+        d->range -= bound;
+        c->prob -= (unsigned short)(c->prob >> shift);
+        bit = 1;
+    }
+    while (d->range < ARITH_TOP) {
+        d->range <<= 8;
+        d->code = (d->code << 8) | arith_next_byte(d);
+    }
+    return bit;
+}
+
+// Every context of one channel
+typedef struct {
+    arith_context dc_zero[ARITH_DC_CLASSES];
+    arith_context dc_sign[ARITH_DC_CLASSES];
+    arith_context dc_category[2][ARITH_MAX_CATEGORY + 1];   // small/large previous residual
+    arith_context dc_mantissa[2][ARITH_MAX_CATEGORY + 1];
+    arith_context ac_eob[ARITH_NZ_CLASSES][RLE_BLOCK];
+    arith_context ac_zero[ARITH_NZ_CLASSES][RLE_BLOCK];
+    arith_context ac_sign;
+    arith_context ac_category[ARITH_NZ_CLASSES][ARITH_AC_BANDS][ARITH_MAX_CATEGORY + 1];
+    arith_context ac_mantissa[ARITH_AC_BANDS][ARITH_MAX_CATEGORY + 1];
+} arith_model;
+
+static void arith_model_init(arith_model *m) {
+    arith_context_init((arith_context *)m, sizeof(*m) / sizeof(arith_context));
+}
+
+// Context class of the previous DC residual: zero, small +/-, large +/-
+static int arith_dc_class(int diff) {
+    if (diff == 0) return 0;
+    if (diff >= -2 && diff <= 2) return diff > 0 ? 1 : 2;
+    return diff > 0 ? 3 : 4;
+}
+
+// Neighbourhood class from the nonzero AC counts of the left and upper blocks
+static int arith_nz_class(int count) {
+    return count == 0 ? 0 : count <= 2 ? 1 : count <= 6 ? 2 : 3;
+}
+
+static int arith_band(int k) {
+    return k < 3 ? 0 : k < 10 ? 1 : 2;
+}
+
+static int arith_neighbour_count(const unsigned char *row_counts, int bx, int by) {
+    if (bx > 0 && by > 0) return (row_counts[bx - 1] + row_counts[bx] + 1) >> 1;
+    if (bx > 0) return row_counts[bx - 1];
+    if (by > 0) return row_counts[bx];
+    return 0;
+}
+
+// value >= 0 as a unary size category and the bits below its top bit
+static void arith_encode_magnitude(arith_encoder *e, arith_context *category, arith_context *mantissa, unsigned int value) {
+    int size = 0;
+    while ((value >> size) != 0) size++;
+    for (int i = 0; i < size; i++) arith_encode_bit(e, &category[i], 1);
+    if (size < ARITH_MAX_CATEGORY) arith_encode_bit(e, &category[size], 0);
+    for (int i = size - 2; i >= 0; i--) arith_encode_bit(e, &mantissa[size], (value >> i) & 1);
+}
+
+static unsigned int arith_decode_magnitude(arith_decoder *d, arith_context *category, arith_context *mantissa) {
+    int size = 0;
+    while (size < ARITH_MAX_CATEGORY && arith_decode_bit(d, &category[size])) size++;
+    if (size == 0) return 0;
+    unsigned int value = 1;
+    for (int i = size - 2; i >= 0; i--) value = (value << 1) | (unsigned int)arith_decode_bit(d, &mantissa[size]);
+    return value;
+}
+
+size_t arith_encode_blocks(const short *coefficients, int blocks_x, int blocks_y, unsigned char **scan) {
+    arith_model *m = (arith_model *)malloc(sizeof(arith_model));
+    unsigned char *row_counts = (unsigned char *)calloc((size_t)blocks_x + 1, 1);
+    *scan = NULL;
+    if (m == NULL || row_counts == NULL) {
+        free(m);
+        free(row_counts);
+        return 0;
+    }
+    arith_model_init(m);
+
+    arith_encoder e;
+    arith_encoder_init(&e);
+    int dc_class = 0;
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            const short *block = coefficients + ((size_t)by * blocks_x + bx) * RLE_BLOCK;
+
+            int diff = block[0];
+            arith_encode_bit(&e, &m->dc_zero[dc_class], diff != 0);
+            if (diff != 0) {
+                int large = dc_class > 2;
+                arith_encode_bit(&e, &m->dc_sign[dc_class], diff < 0);
+                arith_encode_magnitude(&e, m->dc_category[large], m->dc_mantissa[large],
+                                       (unsigned int)(diff < 0 ? -diff : diff) - 1);
+            }
+            dc_class = arith_dc_class(diff);
+
+            int last = 0, count = 0;
+            for (int k = RLE_BLOCK - 1; k > 0; k--) {
+                if (block[rle_zigzag[k]] != 0) {
+                    last = k;
+                    break;
+                }
+            }
+            int nz = arith_nz_class(arith_neighbour_count(row_counts, bx, by));
+            for (int k = 1; k < RLE_BLOCK; k++) {
+                arith_encode_bit(&e, &m->ac_eob[nz][k], k > last);
+                if (k > last) break;
+                while (block[rle_zigzag[k]] == 0) {
+                    arith_encode_bit(&e, &m->ac_zero[nz][k], 0);
+                    k++;
+                }
+                arith_encode_bit(&e, &m->ac_zero[nz][k], 1);
+
+                int level = block[rle_zigzag[k]];
+                int band = arith_band(k);
+                arith_encode_bit(&e, &m->ac_sign, level < 0);
+                arith_encode_magnitude(&e, m->ac_category[nz][band], m->ac_mantissa[band],
+                                       (unsigned int)(level < 0 ? -level : level) - 1);
+                count++;
+            }
+            row_counts[bx] = (unsigned char)count;
+        }
+    }
+    arith_encoder_finish(&e);
+    free(m);
+    free(row_counts);
+    if (e.buffer == NULL) return 0;
+    *scan = e.buffer;
+    return e.size;
+}
+
+int arith_decode_blocks(const unsigned char *scan, size_t size, int blocks_x, int blocks_y, short *coefficients) {
+    arith_model *m = (arith_model *)malloc(sizeof(arith_model));
+    unsigned char *row_counts = (unsigned char *)calloc((size_t)blocks_x + 1, 1);
+    if (m == NULL || row_counts == NULL) {
+        free(m);
+        free(row_counts);
+        return 0;
+    }
+    arith_model_init(m);
+
+    arith_decoder d;
+    arith_decoder_init(&d, scan, size);
+    int ok = 1;
+    int dc_class = 0;
+    for (int by = 0; ok && by < blocks_y; by++) {
+        for (int bx = 0; ok && bx < blocks_x; bx++) {
+            short *block = coefficients + ((size_t)by * blocks_x + bx) * RLE_BLOCK;
+            memset(block, 0, RLE_BLOCK * sizeof(short));
+
+            int diff = 0;
+            if (arith_decode_bit(&d, &m->dc_zero[dc_class])) {
+                int large = dc_class > 2;
+                int negative = arith_decode_bit(&d, &m->dc_sign[dc_class]);
+                diff = (int)arith_decode_magnitude(&d, m->dc_category[large], m->dc_mantissa[large]) + 1;
+                if (negative) diff = -diff;
+            }
+            block[0] = (short)diff;
+            dc_class = arith_dc_class(diff);
+
+            int count = 0;
+            int nz = arith_nz_class(arith_neighbour_count(row_counts, bx, by));
+            for (int k = 1; k < RLE_BLOCK; k++) {
+                if (arith_decode_bit(&d, &m->ac_eob[nz][k])) break;
+                while (k < RLE_BLOCK && !arith_decode_bit(&d, &m->ac_zero[nz][k])) k++;
+                if (k == RLE_BLOCK) {
+                    ok = 0;   // zero run past the end of the block
+                    break;
+                }
+
+                int band = arith_band(k);
+                int negative = arith_decode_bit(&d, &m->ac_sign);
+                int level = (int)arith_decode_magnitude(&d, m->ac_category[nz][band], m->ac_mantissa[band]) + 1;
+                block[rle_zigzag[k]] = (short)(negative ? -level : level);
+                count++;
+            }
+            row_counts[bx] = (unsigned char)count;
+        }
+    }
+    free(m);
+    free(row_counts);
+    // A valid scan ends exactly where the encoder's flush did
+    return ok && d.p == d.end;
+}
+
+#endif // ARITH_IMPLEMENTATION_DONE
+#endif // ARITH_IMPLEMENTATION
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define DCT_TRANSFORM_IMPLEMENTATION
+#include "dct_transform.h"
+#define COEFF_FILE_IMPLEMENTATION
+#include "coeff_file.h"
+#define RLE_IMPLEMENTATION
+#include "rle.h"
+#define HUFFMAN_IMPLEMENTATION
+#include "huffman.h"
+#define RANS_IMPLEMENTATION
+#include "rans.h"
+#define ARITH_IMPLEMENTATION
+#include "arith.h"
+#define DC_PREDICT_IMPLEMENTATION
+#include "dc_predict.h"
+#define COEFF_DECODER_IMPLEMENTATION
+#include "coeff_decoder.h"
+#define IMAGE_WRITER_IMPLEMENTATION
+#include "image_writer.h"
+
+// Decodes a .dctc file (default coded.dctc) with coeff_decoder.h and writes
+// the image 8 rows at a time. "-o name" picks the output, .ppm/.pgm, .bmp or
+// .png by extension (default decoded.ppm, decoded.pgm for one channel);
+// "-z store|rle" the PNG deflate mode (default rle). "-c x,y,w,h" decodes
+// only that rectangle with coeff_decoder_read_region(), "-s 2|4|8" at
+// 1/2, 1/4 or 1/8 of the size (the crop is in the scaled image)
+int main(int argc, char **argv) {
+    const char *filename = "coded.dctc";
+    const char *output_name = NULL;
+    int png_mode = IMAGE_PNG_RLE;
+    int crop = 0, crop_x = 0, crop_y = 0, crop_width = 0, crop_height = 0;
+    int scale = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_name = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            i++;
+            if (sscanf(argv[i], "%d,%d,%d,%d", &crop_x, &crop_y, &crop_width, &crop_height) != 4) {
+                printf("Crop rectangle must be x,y,width,height\n");
+                return 1;
+            }
+            crop = 1;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+            if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+                printf("Scale must be 1, 2, 4 or 8\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "store") == 0) {
+                png_mode = IMAGE_PNG_STORE;
+            } else if (strcmp(argv[i], "rle") == 0) {
+                png_mode = IMAGE_PNG_RLE;
+            } else {
+                printf("Unknown PNG mode %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("Error opening file %s!\n", filename);
+        return 1;
+    }
+
+    clock_t start = clock();
+    coeff_decoder decoder;
+    if (!coeff_decoder_open(&decoder, file)) {
+        printf("%s is not an 8x8 coefficient file this decoder supports\n", filename);
+        coeff_decoder_close(&decoder);
+        fclose(file);
+        return 1;
+    }
+    coeff_decoder_set_scale(&decoder, scale);
+    int width = decoder.width, height = decoder.height;
+    coeff_header header_copy = decoder.header;
+    const coeff_header *header = &header_copy;
+    if (header->channels != 1 && header->channels != 3) {
+        printf("%s has %d channels, only 1 (grey) or 3 (RGB) can be written\n", filename, header->channels);
+        coeff_decoder_close(&decoder);
+        fclose(file);
+        return 1;
+    }
+    if (!crop) {
+        crop_width = width;
+        crop_height = height;
+    } else if (crop_x < 0 || crop_y < 0 || crop_width < 1 || crop_height < 1 ||
+               crop_x > width - crop_width || crop_y > height - crop_height) {
+        printf("Crop rectangle %d,%d,%d,%d is outside the %dx%d image\n", crop_x, crop_y, crop_width, crop_height,
+               width, height);
+        coeff_decoder_close(&decoder);
+        fclose(file);
+        return 1;
+    }
+
+    if (output_name == NULL) output_name = header->channels == 1 ? "decoded.pgm" : "decoded.ppm";
+    int format = image_writer_format(output_name);
+    if (format < 0) {
+        printf("Unknown image format for %s (use .ppm, .pgm, .bmp or .png)\n", output_name);
+        coeff_decoder_close(&decoder);
+        fclose(file);
+        return 1;
+    }
+    FILE *output = fopen(output_name, "wb");
+    if (output == NULL) {
+        printf("Error opening file %s!\n", output_name);
+        coeff_decoder_close(&decoder);
+        fclose(file);
+        return 1;
+    }
+    image_writer writer;
+    int written = image_writer_open(&writer, output, format, crop_width, crop_height, header->channels, png_mode);
+
+    // The decoder's strip goes to the writer as it is, no full-frame copy;
+    // a crop is decoded in one go
+    size_t row_bytes = (size_t)crop_width * header->channels;
+    unsigned char *strip = (unsigned char *)malloc(row_bytes * (crop ? crop_height : 8));
+    if (strip == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    int rows, total = 0;
+    if (crop) {
+        if (coeff_decoder_read_region(&decoder, crop_x, crop_y, crop_width, crop_height, strip, row_bytes)) {
+            total = crop_height;
+            written = written && image_writer_put_rows(&writer, strip, row_bytes, crop_height);
+        }
+    }
+    while (!crop && written && (rows = coeff_decoder_read_strip(&decoder, strip, row_bytes)) > 0) {
+        written = image_writer_put_rows(&writer, strip, row_bytes, rows);
+        total += rows;
+    }
+    written = image_writer_close(&writer) && written;
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    free(strip);
+    coeff_decoder_close(&decoder);
+    fclose(file);
+    long size = ftell(output);
+    fclose(output);
+    if (total != crop_height) {
+        printf("Error decoding %s at row %d\n", filename, total);
+        return 1;
+    }
+    if (!written) {
+        printf("Error writing %s\n", output_name);
+        return 1;
+    }
+    printf("%s: %dx%d, %d channel(s) decoded to %s (%ld bytes) in %.1f ms\n", filename, crop_width, crop_height,
+           header->channels, output_name, size, seconds * 1000.0);
+    return 0;
+}
@@ -0,0 +1,491 @@
+/* coeff_decoder.h - .dctc coefficient files back to pixels, 8 rows at a time
+
+   Do this:
+      #define COEFF_DECODER_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+   Needs coeff_file.h, rle.h, huffman.h, rans.h, arith.h, dc_predict.h and
+   dct_transform.h, with their implementations in the same program.
+
+   coeff_decoder_open() reads the header of any 8x8 .dctc file (raw,
+   sparse, Huffman, rANS or arithmetic coded); coeff_decoder_read_strip()
+   then produces the image one block row (8 pixel rows) per call: each
+   channel's row of blocks is decoded, its DC prediction undone, every
+   block dequantized and inverse transformed by idct_int_pixels() into an
+   8-row byte strip, and the channels interleaved into the caller's rows
+   (one channel is greyscale, three are RGB as the encoders store them).
+   Nothing the size of the frame is ever held as doubles or pixels.
+
+   coeff_decoder_open() itself reads only the header and the indexes and
+   notes where each channel's data is; the first strip loads what the
+   coding needs kept between strips:
+
+      raw       nothing: each strip seeks to and reads its block row
+      Huffman   the scan of each channel, decoded a block row per strip
+      sparse,   the whole channel as int16 coefficients, DC prediction
+      rANS,     undone (the coders work on the whole channel); the
+      arith     dequantization and transform still go strip by strip
+
+   coeff_decoder_read_region() decodes a rectangle of pixels instead, with
+   only the 8x8 blocks it overlaps dequantized and transformed. Raw files
+   seek straight to those blocks. A file with a segment index (coeff_file.h)
+   reads just the segments the rectangle's block rows fall in and entropy
+   decodes them from their start, so the cost follows the height of the
+   window (whole block rows) rather than the frame. Without an index the
+   channels are loaded as for the strips, and the blocks above the window
+   still have to be decoded.
+
+   Blocks with nothing but DC are a constant fill and skip the transform.
+
+   coeff_decoder_set_scale() picks a reduced size to decode at: 1/2, 1/4 or
+   1/8, each block becoming 4x4, 2x2 or 1x1 pixels through the scaled
+   kernels of dct_transform.h, which read and dequantize only the
+   low-frequency coefficients they use. Strips and regions then work in
+   the scaled image: strips are 8 / scale rows, and d->width and d->height
+   give its size.
+*/
+#ifndef COEFF_DECODER_H
+#define COEFF_DECODER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+typedef struct {
+    coeff_header header;
+    FILE *file;
+    int blocks_x, blocks_y;
+    int scale;                          // 1, 2, 4 or 8: blocks decode to 8 / scale pixels a side
+    int width, height;                  // image size at that scale
+    int next_row;                       // block row the next strip decodes
+    int segment_rows;                   // block rows per index segment, blocks_y without an index
+    int loaded;                         // channel data read for the strips
+    long offset[COEFF_MAX_CODED_CHANNELS];              // where each channel's data starts
+    size_t size[COEFF_MAX_CODED_CHANNELS];              // its byte count (not raw)
+    unsigned long *index[COEFF_MAX_CODED_CHANNELS];     // its segment offsets, NULL without an index
+    // Per channel: whole-channel coefficients (sparse, rANS, arith) or two
+    // block rows, the previous and the current one (raw, Huffman)
+    short *coefficients[COEFF_MAX_CODED_CHANNELS];
+    unsigned char *scan[COEFF_MAX_CODED_CHANNELS];        // Huffman only
+    huff_decoder *dc[COEFF_MAX_CODED_CHANNELS];
+    huff_decoder *ac[COEFF_MAX_CODED_CHANNELS];
+    huff_reader reader[COEFF_MAX_CODED_CHANNELS];
+    unsigned char *strip;               // 8 rows of blocks_x * 8 samples per channel
+} coeff_decoder;
+
+// 1 on success; 0 on a malformed or unsupported file (block size other than
+// 8, more than COEFF_MAX_CODED_CHANNELS channels). Corrupt data shows up
+// when it is decoded. The decoder reads from file until coeff_decoder_close(),
+// which does not close it. A failed open frees what it allocated, and close
+// is then not needed (though harmless).
+int coeff_decoder_open(coeff_decoder *d, FILE *file);
+
+// Decode at 1/scale of the size, scale 1, 2, 4 or 8 (rounding up). Before
+// the first strip only; 0 for any other scale or once strips have started.
+int coeff_decoder_set_scale(coeff_decoder *d, int scale);
+
+// Next 8 / scale pixel rows (fewer for the last strip) to pixels, d->width *
+// header.channels bytes per row, rows stride bytes apart. Returns the number
+// of rows written, 0 once the image is done, -1 on corrupt data.
+int coeff_decoder_read_strip(coeff_decoder *d, unsigned char *pixels, size_t stride);
+
+// The width x height pixels at (x, y) of the image at the current scale
+// to pixels, width * header.channels
+// bytes per row, rows stride bytes apart. Independent of the strips: it can
+// be called any number of times, before or between them. 1 on success, 0
+// for a rectangle outside the image or corrupt data.
+int coeff_decoder_read_region(coeff_decoder *d, int x, int y, int width, int height, unsigned char *pixels,
+                              size_t stride);
+
+void coeff_decoder_close(coeff_decoder *d);
+
+// One quantized block (natural order) dequantized by table and inverse
+// transformed to 8x8 samples at out; dc_only skips the transform
+void coeff_decoder_block_pixels(const short *block, const int *table, int dc_only, unsigned char *out, size_t stride);
+
+#endif // COEFF_DECODER_H
+
+#ifdef COEFF_DECODER_IMPLEMENTATION
+#ifndef COEFF_DECODER_IMPLEMENTATION_DONE
+#define COEFF_DECODER_IMPLEMENTATION_DONE
+
+#include <stdlib.h>
+#include <string.h>
+
+#define COEFF_DECODER_BLOCK 8
+
+void coeff_decoder_block_pixels(const short *block, const int *table, int dc_only, unsigned char *out, size_t stride) {
+    if (dc_only) {
+        // What idct_int() gives for a DC-only block
+        int value = (block[0] * table[0] + 4) >> 3;
+        unsigned char fill = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+        for (int u = 0; u < COEFF_DECODER_BLOCK; u++) memset(out + u * stride, fill, COEFF_DECODER_BLOCK);
+        return;
+    }
+    short dequantized[64];
+    for (int k = 0; k < 64; k++) {
+        int value = block[k] * table[k];
+        dequantized[k] = (short)(value < -32768 ? -32768 : value > 32767 ? 32767 : value);
+    }
+    idct_int_pixels(dequantized, out, (int)stride);
+}
+
+static int coeff_decoder_ac_zero(const short *block) {
+    int any = 0;
+    for (int k = 1; k < 64; k++) any |= block[k];
+    return any == 0;
+}
+
+static int coeff_decoder_whole_channel(int coding) {
+    return coding == COEFF_CODING_SPARSE || coding == COEFF_CODING_RANS || coding == COEFF_CODING_ARITH;
+}
+
+// Bytes of channel c's data that segments first..last take
+static void coeff_decoder_segments(const coeff_decoder *d, int c, int first, int last, size_t *start, size_t *end) {
+    int segments = coeff_index_segments(&d->header);
+    *start = d->index[c] != NULL ? d->index[c][first] : 0;
+    *end = d->index[c] != NULL && last + 1 < segments ? d->index[c][last + 1] : d->size[c];
+}
+
+// size bytes of channel c's data from offset, in a buffer the caller frees; NULL on a read error
+static unsigned char *coeff_decoder_fetch(coeff_decoder *d, int c, size_t offset, size_t size) {
+    unsigned char *data = (unsigned char *)malloc(size ? size : 1);
+    if (data == NULL) return NULL;
+    if (fseek(d->file, d->offset[c] + (long)offset, SEEK_SET) != 0 || fread(data, 1, size, d->file) != size) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+// count raw blocks of channel c from block (bx, by)
+static int coeff_decoder_read_raw(coeff_decoder *d, int c, int bx, int by, int count, short *blocks) {
+    unsigned char buffer[2 * 64];
+    long offset = d->offset[c] + (long)(((size_t)by * d->blocks_x + bx) * 64 * 2);
+    if (fseek(d->file, offset, SEEK_SET) != 0) return 0;
+    for (int b = 0; b < count; b++) {
+        if (fread(buffer, 2, 64, d->file) != 64) return 0;
+        for (int k = 0; k < 64; k++) {
+            blocks[b * 64 + k] = (short)(buffer[2 * k] | (buffer[2 * k + 1] << 8));
+        }
+    }
+    return 1;
+}
+
+// coeff_decoder_open() without the cleanup: on 0, d may hold allocations
+static int coeff_decoder_setup(coeff_decoder *d, FILE *file) {
+    memset(d, 0, sizeof(*d));
+    d->file = file;
+    coeff_header *h = &d->header;
+    if (!coeff_read_header(file, h)) return 0;
+    if (h->block_size != COEFF_DECODER_BLOCK || h->channels > COEFF_MAX_CODED_CHANNELS) return 0;
+    d->blocks_x = (h->width + COEFF_DECODER_BLOCK - 1) / COEFF_DECODER_BLOCK;
+    d->blocks_y = (h->height + COEFF_DECODER_BLOCK - 1) / COEFF_DECODER_BLOCK;
+    d->scale = 1;
+    d->width = h->width;
+    d->height = h->height;
+    d->segment_rows = h->index_interval > 0 ? h->index_interval : d->blocks_y;
+    int segments = coeff_index_segments(h);
+
+    size_t blocks = (size_t)d->blocks_x * d->blocks_y;
+    size_t row_coefficients = (size_t)d->blocks_x * 64;
+    d->strip = (unsigned char *)malloc(row_coefficients * h->channels);
+    if (d->strip == NULL) return 0;
+
+    long start = ftell(file);
+    for (int c = 0; c < h->channels; c++) {
+        if (h->coding == COEFF_CODING_RAW || h->coding == COEFF_CODING_HUFFMAN) {
+            d->coefficients[c] = (short *)calloc(2 * row_coefficients, sizeof(short));
+            if (d->coefficients[c] == NULL) return 0;
+        }
+        if (h->coding == COEFF_CODING_RAW) {
+            d->offset[c] = start + (long)((size_t)c * blocks * 64 * 2);
+            continue;
+        }
+
+        if (segments > 0) {
+            d->index[c] = (unsigned long *)malloc((size_t)segments * sizeof(unsigned long));
+            if (d->index[c] == NULL || !coeff_read_index(file, d->index[c], segments)) return 0;
+        }
+        if (!coeff_read_scan_size(file, &d->size[c])) return 0;
+        if (segments > 0 && d->index[c][segments - 1] > d->size[c]) return 0;
+        d->offset[c] = ftell(file);
+        if (fseek(file, (long)d->size[c], SEEK_CUR) != 0) return 0;
+
+        if (h->coding == COEFF_CODING_HUFFMAN) {
+            d->dc[c] = (huff_decoder *)malloc(sizeof(huff_decoder));
+            d->ac[c] = (huff_decoder *)malloc(sizeof(huff_decoder));
+            if (d->dc[c] == NULL || d->ac[c] == NULL) return 0;
+            if (!huff_build_decoder(&h->dc_table[c], d->dc[c]) || !huff_build_decoder(&h->ac_table[c], d->ac[c])) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+int coeff_decoder_open(coeff_decoder *d, FILE *file) {
+    if (coeff_decoder_setup(d, file)) return 1;
+    coeff_decoder_close(d);
+    return 0;
+}
+
+// What the strips keep: the Huffman scans, or every other coding decoded whole
+static int coeff_decoder_load(coeff_decoder *d) {
+    const coeff_header *h = &d->header;
+    size_t blocks = (size_t)d->blocks_x * d->blocks_y;
+    if (d->loaded || h->coding == COEFF_CODING_RAW) {
+        d->loaded = 1;
+        return 1;
+    }
+    for (int c = 0; c < h->channels; c++) {
+        unsigned char *data = coeff_decoder_fetch(d, c, 0, d->size[c]);
+        if (data == NULL) return 0;
+        if (h->coding == COEFF_CODING_HUFFMAN) {
+            // Kept until close: the reader works through it a block row per strip
+            d->scan[c] = data;
+            continue;
+        }
+
+        int ok = 0;
+        d->coefficients[c] = (short *)malloc(blocks * 64 * sizeof(short));
+        if (d->coefficients[c] == NULL) {
+            ok = 0;
+        } else if (h->coding == COEFF_CODING_SPARSE) {
+            ok = coeff_unpack_sparse(h, data, d->size[c], d->coefficients[c]);
+        } else if (h->coding == COEFF_CODING_RANS) {
+            ok = rans_decode_blocks(data, d->size[c], h->rans_dc_freq[c], h->rans_ac_freq[c], h->rans_lanes, blocks,
+                                    d->coefficients[c]);
+        } else {
+            ok = arith_decode_blocks(data, d->size[c], d->blocks_x, d->blocks_y, d->coefficients[c]);
+        }
+        if (ok && h->coding != COEFF_CODING_SPARSE) {
+            dc_predict_inverse(d->coefficients[c], d->blocks_x, d->blocks_y, h->dc_predictor[c]);
+        }
+        free(data);
+        if (!ok) return 0;
+    }
+    d->loaded = 1;
+    return 1;
+}
+
+int coeff_decoder_set_scale(coeff_decoder *d, int scale) {
+    if ((scale != 1 && scale != 2 && scale != 4 && scale != 8) || d->next_row > 0) return 0;
+    d->scale = scale;
+    d->width = (d->header.width + scale - 1) / scale;
+    d->height = (d->header.height + scale - 1) / scale;
+    return 1;
+}
+
+// Dequantize and transform count blocks to the 8 / scale rows at out
+static void coeff_decoder_blocks_pixels(const coeff_decoder *d, const short *blocks, int count, unsigned char *out,
+                                        size_t stride) {
+    const int *table = d->header.table;
+    int size = COEFF_DECODER_BLOCK / d->scale;
+    for (int b = 0; b < count; b++) {
+        const short *block = blocks + b * 64;
+        if (d->scale == 1) {
+            coeff_decoder_block_pixels(block, table, coeff_decoder_ac_zero(block), out + b * size, stride);
+            continue;
+        }
+        // Only the size x size corner the scaled kernel reads
+        short dequantized[64];
+        for (int u = 0; u < size; u++) {
+            for (int v = 0; v < size; v++) {
+                int k = u * COEFF_DECODER_BLOCK + v, value = block[k] * table[k];
+                dequantized[k] = (short)(value < -32768 ? -32768 : value > 32767 ? 32767 : value);
+            }
+        }
+        if (size == 4) {
+            idct_int_pixels_4x4(dequantized, out + b * size, (int)stride);
+        } else if (size == 2) {
+            idct_int_pixels_2x2(dequantized, out + b * size, (int)stride);
+        } else {
+            idct_int_pixels_1x1(dequantized, out + b * size, (int)stride);
+        }
+    }
+}
+
+int coeff_decoder_read_strip(coeff_decoder *d, unsigned char *pixels, size_t stride) {
+    const coeff_header *h = &d->header;
+    int by = d->next_row;
+    if (by >= d->blocks_y) return 0;
+    if (!coeff_decoder_load(d)) return -1;
+    size_t row_coefficients = (size_t)d->blocks_x * 64;
+    int size = COEFF_DECODER_BLOCK / d->scale;
+    size_t strip_stride = (size_t)d->blocks_x * size;
+    int whole = coeff_decoder_whole_channel(h->coding);
+
+    for (int c = 0; c < h->channels; c++) {
+        // Row by of the channel as dc_predict.h sees it: for the two-row
+        // buffers the previous block row of the segment sits right before
+        // the current one, and the first row of a segment has none
+        short *base = d->coefficients[c];
+        int row = whole ? by : by % d->segment_rows > 0;
+        short *blocks = base + (size_t)row * row_coefficients;
+
+        if (h->coding == COEFF_CODING_RAW) {
+            if (!coeff_decoder_read_raw(d, c, 0, by, d->blocks_x, blocks)) return -1;
+        } else if (h->coding == COEFF_CODING_HUFFMAN) {
+            if (by % d->segment_rows == 0) {
+                size_t start, end;
+                int segment = by / d->segment_rows;
+                coeff_decoder_segments(d, c, segment, segment, &start, &end);
+                huff_reader_init(&d->reader[c], d->scan[c] + start, end - start);
+            }
+            for (int bx = 0; bx < d->blocks_x; bx++) {
+                if (!huff_decode_block(&d->reader[c], d->dc[c], d->ac[c], NULL, blocks + bx * 64)) return -1;
+            }
+            // The last row of a segment must use up exactly its bytes
+            int segment_end = by % d->segment_rows == d->segment_rows - 1 || by == d->blocks_y - 1;
+            if (segment_end && !huff_reader_finished(&d->reader[c])) return -1;
+            dc_predict_inverse_row(base, d->blocks_x, row, h->dc_predictor[c]);
+        }
+
+        coeff_decoder_blocks_pixels(d, blocks, d->blocks_x, d->strip + c * strip_stride * size, strip_stride);
+
+        // The next row predicts from this one: move it into the previous slot
+        if (!whole && row > 0) memcpy(base, blocks, row_coefficients * sizeof(short));
+    }
+
+    int rows = d->height - by * size;
+    if (rows > size) rows = size;
+    for (int y = 0; y < rows; y++) {
+        unsigned char *out = pixels + (size_t)y * stride;
+        if (h->channels == 1) {
+            memcpy(out, d->strip + y * strip_stride, (size_t)d->width);
+            continue;
+        }
+        for (int c = 0; c < h->channels; c++) {
+            const unsigned char *in = d->strip + (c * size + y) * strip_stride;
+            for (int x = 0; x < d->width; x++) out[x * h->channels + c] = in[x];
+        }
+    }
+    d->next_row++;
+    return rows;
+}
+
+// Block rows first_row..last_row of an indexed sparse or any Huffman
+// channel, decoded from the start of the segment first_row is in
+static int coeff_decoder_region_rows(coeff_decoder *d, int c, int first_row, int last_row, short *coefficients) {
+    const coeff_header *h = &d->header;
+    int first_segment = first_row / d->segment_rows, last_segment = last_row / d->segment_rows;
+    size_t row_coefficients = (size_t)d->blocks_x * 64;
+    size_t start, end;
+    coeff_decoder_segments(d, c, first_segment, last_segment, &start, &end);
+    if (start > end || end > d->size[c]) return 0;
+
+    if (h->coding == COEFF_CODING_SPARSE) {
+        size_t first = (size_t)first_row * d->blocks_x;
+        size_t count = (size_t)(last_row - first_row + 1) * d->blocks_x;
+        size_t class_start = first / 4, class_end = (first + count - 1) / 4 + 1;
+        if (class_end > start) return 0;
+        unsigned char *classes = coeff_decoder_fetch(d, c, class_start, class_end - class_start);
+        unsigned char *body = coeff_decoder_fetch(d, c, start, end - start);
+        const unsigned char *p = body;
+        int ok = classes != NULL && body != NULL &&
+                 coeff_unpack_sparse_blocks(classes, first, count, &p, body + (end - start), coefficients);
+        free(classes);
+        free(body);
+        return ok;
+    }
+
+    // Huffman: the scan if the strips have loaded it, otherwise just these segments
+    unsigned char *fetched = NULL;
+    const unsigned char *scan = d->scan[c] != NULL ? d->scan[c] + start : NULL;
+    if (scan == NULL) scan = fetched = coeff_decoder_fetch(d, c, start, end - start);
+    if (scan == NULL) return 0;
+    huff_reader reader;
+    int ok = 1;
+    for (int by = first_row; ok && by <= last_row; by++) {
+        int row = by % d->segment_rows;
+        if (row == 0) {
+            size_t segment_start, segment_end;
+            coeff_decoder_segments(d, c, by / d->segment_rows, by / d->segment_rows, &segment_start, &segment_end);
+            huff_reader_init(&reader, scan + (segment_start - start), segment_end - segment_start);
+        }
+        short *blocks = coefficients + (size_t)(by - first_row) * row_coefficients;
+        for (int bx = 0; ok && bx < d->blocks_x; bx++) {
+            ok = huff_decode_block(&reader, d->dc[c], d->ac[c], NULL, blocks + bx * 64) != 0;
+        }
+        if (ok && (row == d->segment_rows - 1 || by == d->blocks_y - 1)) ok = huff_reader_finished(&reader);
+        if (ok) dc_predict_inverse_row(blocks - (size_t)row * row_coefficients, d->blocks_x, row, h->dc_predictor[c]);
+    }
+    free(fetched);
+    return ok;
+}
+
+int coeff_decoder_read_region(coeff_decoder *d, int x, int y, int width, int height, unsigned char *pixels,
+                              size_t stride) {
+    const coeff_header *h = &d->header;
+    if (x < 0 || y < 0 || width < 1 || height < 1 || x > d->width - width || y > d->height - height) return 0;
+    int size = COEFF_DECODER_BLOCK / d->scale;
+    int bx0 = x / size, bx1 = (x + width - 1) / size;
+    int by0 = y / size, by1 = (y + height - 1) / size;
+    int count = bx1 - bx0 + 1;
+    size_t row_coefficients = (size_t)d->blocks_x * 64;
+    size_t tile_stride = (size_t)count * size;
+
+    // Without an index every coding but raw decodes from the top of the
+    // channel anyway, so it might as well be loaded once for all calls
+    if (h->coding != COEFF_CODING_RAW && h->index_interval == 0 && !coeff_decoder_load(d)) return 0;
+
+    unsigned char *tile = (unsigned char *)malloc(tile_stride * size);
+    int ok = tile != NULL;
+    for (int c = 0; ok && c < h->channels; c++) {
+        // coefficients holds block rows first_row.. of the channel (only
+        // blocks bx0.. of the current row for raw)
+        short *coefficients, *owned = NULL;
+        int first_row = 0;
+        if (coeff_decoder_whole_channel(h->coding) && d->loaded) {
+            coefficients = d->coefficients[c];
+        } else if (h->coding == COEFF_CODING_RAW) {
+            coefficients = owned = (short *)malloc((size_t)count * 64 * sizeof(short));
+        } else {
+            first_row = by0 - by0 % d->segment_rows;
+            coefficients = owned = (short *)malloc((size_t)(by1 - first_row + 1) * row_coefficients * sizeof(short));
+            ok = owned != NULL && coeff_decoder_region_rows(d, c, first_row, by1, owned);
+        }
+        ok = ok && coefficients != NULL;
+
+        for (int by = by0; ok && by <= by1; by++) {
+            const short *blocks;
+            if (h->coding == COEFF_CODING_RAW) {
+                ok = coeff_decoder_read_raw(d, c, bx0, by, count, owned);
+                blocks = owned;
+            } else {
+                blocks = coefficients + (size_t)(by - first_row) * row_coefficients + (size_t)bx0 * 64;
+            }
+            if (!ok) break;
+            coeff_decoder_blocks_pixels(d, blocks, count, tile, tile_stride);
+
+            int top = by * size > y ? by * size : y;
+            int bottom = (by + 1) * size < y + height ? (by + 1) * size : y + height;
+            for (int row = top; row < bottom; row++) {
+                const unsigned char *in = tile + (size_t)(row - by * size) * tile_stride + (x - bx0 * size);
+                unsigned char *out = pixels + (size_t)(row - y) * stride;
+                if (h->channels == 1) {
+                    memcpy(out, in, (size_t)width);
+                    continue;
+                }
+                for (int i = 0; i < width; i++) out[i * h->channels + c] = in[i];
+            }
+        }
+        free(owned);
+    }
+    free(tile);
+    return ok;
+}
+
+void coeff_decoder_close(coeff_decoder *d) {
+    for (int c = 0; c < COEFF_MAX_CODED_CHANNELS; c++) {
+        free(d->coefficients[c]);
+        free(d->scan[c]);
+        free(d->dc[c]);
+        free(d->ac[c]);
+        free(d->index[c]);
+    }
+    free(d->strip);
+    memset(d, 0, sizeof(*d));
+}
+
+#endif // COEFF_DECODER_IMPLEMENTATION_DONE
+#endif // COEFF_DECODER_IMPLEMENTATION
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#define COEFF_FILE_IMPLEMENTATION
+#include "coeff_file.h"
+
+// Reads a raw or sparse .dctc coefficient file (default quantized.dctc) and writes each
+// channel as the quantized_<channel>.txt text dump
+int main(int argc, char **argv) {
+    const char *filename = argc > 1 ? argv[1] : "quantized.dctc";
+    const char *channel_names[3] = {"red", "green", "blue"};
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("Error opening file %s!\n", filename);
+        return 1;
+    }
+
+    coeff_header header;
+    if (!coeff_read_header(file, &header)) {
+        printf("%s is not a version %d coefficient file\n", filename, COEFF_FILE_VERSION);
+        fclose(file);
+        return 1;
+    }
+    printf("%dx%d, %d channel(s), %dx%d blocks\n", header.width, header.height,
+           header.channels, header.block_size, header.block_size);
+    if (header.coding != COEFF_CODING_RAW && header.coding != COEFF_CODING_SPARSE) {
+        printf("%s is entropy coded, only raw and sparse coefficient files can be dumped\n", filename);
+        fclose(file);
+        return 1;
+    }
+
+    short *coefficients = (short *)malloc(coeff_channel_size(&header) * sizeof(short));
+    if (coefficients == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (int c = 0; c < header.channels; c++) {
+        if (!coeff_read_channel(file, &header, coefficients)) {
+            printf("Error reading channel %d\n", c);
+            free(coefficients);
+            fclose(file);
+            return 1;
+        }
+
+        char text_name[64];
+        if (c < 3) {
+            snprintf(text_name, sizeof(text_name), "quantized_%s.txt", channel_names[c]);
+        } else {
+            snprintf(text_name, sizeof(text_name), "quantized_%d.txt", c);
+        }
+        FILE *text = fopen(text_name, "w");
+        if (text == NULL) {
+            printf("Error opening file %s!\n", text_name);
+            free(coefficients);
+            fclose(file);
+            return 1;
+        }
+        coeff_write_text(text, &header, coefficients);
+        fclose(text);
+    }
+
+    free(coefficients);
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,608 @@
+/* coeff_file.h - binary container for quantized DCT coefficients
+
+   Do this:
+      #define COEFF_FILE_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   Layout, every field little-endian:
+
+      offset  size
+        0      4   "DCTC"
+        4      2   version (COEFF_FILE_VERSION; version 1 files are raw)
+        6      2   block size n (4, 8, 16, 32)
+        8      4   width
+       12      4   height
+       16      2   channels
+       18      2   coding, COEFF_CODING_RAW, _HUFFMAN, _RANS, _ARITH or _SPARSE
+       20   2n*n   quantization table, entry (u, v) at u * n + v
+      ...      2   version 4: index interval R in block rows, 0 for no
+                   index (Huffman and sparse only, see below)
+      ...          entropy coded only (version 3): per channel the
+                   dc_predict.h DC predictor, 1 byte; older files used
+                   the previous block (DC_PREDICT_PREVIOUS, 0)
+      ...          Huffman only: per channel the DC table then the AC table,
+                   each as 16 code-length counts and the symbol values
+                   (JPEG DHT layout)
+                   rANS only: number of states (2 bytes), then per channel
+                   the DC model then the AC model, each as a 32-byte bitmap
+                   of the tokens present and their 16-bit frequencies
+      ...          raw: per channel blocks_x * blocks_y blocks of n * n
+                   int16, block-major, blocks in raster order, partial edge
+                   blocks stored whole
+                   entropy coded: per channel a 4-byte byte count and the
+                   huffman.h, rans.h or arith.h scan (8x8 blocks only;
+                   arithmetic coding adapts as it goes and has no tables)
+                   sparse: per channel a 4-byte byte count and the packed
+                   blocks described below (8x8 blocks only)
+                   with an index, each channel's byte count is preceded by
+                   ceil(blocks_y / R) 4-byte offsets into its data, one per
+                   segment of R block rows
+
+   The index is what lets a reader decode a window without the rest of
+   the frame. A Huffman segment starts byte-aligned (the scan before it
+   padded with 1 bits) and its DC prediction restarts, as if its R block
+   rows were an image of their own, so decoding can start at any offset.
+   A sparse segment's offset is where the body of its first block starts;
+   the classes are at fixed positions anyway. Raw files need no index
+   (every block row is at a computable position) and the rANS and
+   arithmetic coders work on the whole channel, so they have none.
+
+   A sparse channel starts with a 2-bit class per block, four blocks to a
+   byte (block b in bits 2 * (b % 4) of byte b / 4), and then the bodies
+   of the blocks in order:
+
+      0  all zero                 nothing
+      1  DC only, fits int8       the DC as one byte
+      2  values fit int8          mask, int8 values
+      3  any other block          mask, int16 values
+
+   A mask is its length m in bytes (1..8) and the m low bytes of a 64-bit
+   occupancy mask, little-endian; bit k is set when the k-th coefficient
+   in zigzag order is nonzero. The values follow in zigzag order, one per
+   set bit. At normal qualities most blocks are DC only, 1.25 bytes each.
+   Readers expand a block by walking the set bits of the mask (count
+   trailing zeros, clear the lowest bit) and writing each value straight to
+   its raster position.
+
+   The raw payload is exactly what forward_dct_quantize_plane() and
+   quantize_blocks() produce, so writing a channel is one pass with no
+   formatting. coeff_write_text() turns a channel back into the old
+   "%5.1f\t" raster dump for debugging.
+*/
+#ifndef COEFF_FILE_H
+#define COEFF_FILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "huffman.h"
+
+#define COEFF_FILE_VERSION 4
+#define COEFF_FILE_HEADER_SIZE 20
+#define COEFF_MAX_BLOCK 32
+
+// Largest width or height, the same limit jpeg_writer.h has; keeps a
+// channel's coefficient count well inside size_t on every platform
+#define COEFF_MAX_DIMENSION 65535
+
+#define COEFF_CODING_RAW 0
+#define COEFF_CODING_HUFFMAN 1
+#define COEFF_CODING_RANS 2
+#define COEFF_CODING_ARITH 3
+#define COEFF_CODING_SPARSE 4
+
+// Entropy-coded files carry tables per channel, at most this many
+#define COEFF_MAX_CODED_CHANNELS 4
+
+// Highest DC predictor number (dc_predict.h modes)
+#define COEFF_MAX_DC_PREDICTOR 3
+
+typedef struct {
+    int version;
+    int width;
+    int height;
+    int channels;
+    int block_size;
+    int coding;
+    int index_interval;                              // block rows per indexed segment, 0 for none
+    int table[COEFF_MAX_BLOCK * COEFF_MAX_BLOCK];
+    int dc_predictor[COEFF_MAX_CODED_CHANNELS];     // entropy coded only
+    huff_spec dc_table[COEFF_MAX_CODED_CHANNELS];   // COEFF_CODING_HUFFMAN only
+    huff_spec ac_table[COEFF_MAX_CODED_CHANNELS];
+    int rans_lanes;                                  // COEFF_CODING_RANS only
+    unsigned short rans_dc_freq[COEFF_MAX_CODED_CHANNELS][256];
+    unsigned short rans_ac_freq[COEFF_MAX_CODED_CHANNELS][256];
+} coeff_header;
+
+// Number of int16 coefficients stored per channel
+size_t coeff_channel_size(const coeff_header *h);
+// Number of index offsets per channel, 0 when the file has no index
+int coeff_index_segments(const coeff_header *h);
+
+// All return 1 on success, 0 on a write error or a malformed/unsupported file
+int coeff_write_header(FILE *file, const coeff_header *h);
+int coeff_write_channel(FILE *file, const coeff_header *h, const short *coefficients);
+int coeff_read_header(FILE *file, coeff_header *h);
+int coeff_read_channel(FILE *file, const coeff_header *h, short *coefficients);
+// Raw and sparse files both go through coeff_write_channel() / coeff_read_channel();
+// these are the sparse packing on its own, a channel of 8x8 blocks to and from
+// memory. coeff_pack_sparse() allocates *data, which the caller frees.
+size_t coeff_pack_sparse(const coeff_header *h, const short *coefficients, unsigned char **data);
+int coeff_unpack_sparse(const coeff_header *h, const unsigned char *data, size_t size, short *coefficients);
+// count blocks of a packed sparse channel starting with block first.
+// classes points at the class byte of block first, *body at its body,
+// which is advanced past the last block; end bounds the body.
+int coeff_unpack_sparse_blocks(const unsigned char *classes, size_t first, size_t count, const unsigned char **body,
+                               const unsigned char *end, short *coefficients);
+// Index of a packed sparse channel: where the body of each segment starts
+int coeff_sparse_index(const coeff_header *h, const unsigned char *data, size_t size, unsigned long *offsets);
+
+// Entropy-coded channel: byte count then the scan. coeff_read_scan()
+// allocates *data, which the caller frees.
+int coeff_write_scan(FILE *file, const unsigned char *data, size_t size);
+int coeff_read_scan(FILE *file, unsigned char **data, size_t *size);
+// Just the byte count, leaving the file at the start of the scan
+int coeff_read_scan_size(FILE *file, size_t *size);
+
+// Segment offsets of an indexed channel, coeff_index_segments() of them,
+// written before its byte count
+int coeff_write_index(FILE *file, const unsigned long *offsets, int count);
+int coeff_read_index(FILE *file, unsigned long *offsets, int count);
+
+// Raster dump of one channel, one "%5.1f\t" per sample and a newline per row
+void coeff_write_text(FILE *file, const coeff_header *h, const short *coefficients);
+
+#endif // COEFF_FILE_H
+
+#ifdef COEFF_FILE_IMPLEMENTATION
+#ifndef COEFF_FILE_IMPLEMENTATION_DONE
+#define COEFF_FILE_IMPLEMENTATION_DONE
+
+#include <stdlib.h>
+#include <string.h>
+
+// Coefficients go through this many at a time for the byte-order conversion
+#define COEFF_CHUNK 4096
+
+static void coeff_put16(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void coeff_put32(unsigned char *p, unsigned long v) {
+    coeff_put16(p, (unsigned int)(v & 0xffff));
+    coeff_put16(p + 2, (unsigned int)(v >> 16));
+}
+
+static unsigned int coeff_get16(const unsigned char *p) {
+    return p[0] | ((unsigned int)p[1] << 8);
+}
+
+static unsigned long coeff_get32(const unsigned char *p) {
+    return coeff_get16(p) | ((unsigned long)coeff_get16(p + 2) << 16);
+}
+
+size_t coeff_channel_size(const coeff_header *h) {
+    size_t blocks_x = (size_t)(h->width + h->block_size - 1) / h->block_size;
+    size_t blocks_y = (size_t)(h->height + h->block_size - 1) / h->block_size;
+    return blocks_x * blocks_y * h->block_size * h->block_size;
+}
+
+int coeff_index_segments(const coeff_header *h) {
+    if (h->index_interval <= 0) return 0;
+    int blocks_y = (h->height + h->block_size - 1) / h->block_size;
+    return (blocks_y + h->index_interval - 1) / h->index_interval;
+}
+
+static int coeff_block_size_valid(int n) {
+    return n == 4 || n == 8 || n == 16 || n == 32;
+}
+
+// DC predicted with dc_predict.h and entropy coded; raw and sparse store the coefficients as they are
+static int coeff_entropy_coded(int coding) {
+    return coding == COEFF_CODING_HUFFMAN || coding == COEFF_CODING_RANS || coding == COEFF_CODING_ARITH;
+}
+
+static int coeff_index_valid(const coeff_header *h) {
+    if (h->index_interval == 0) return 1;
+    return (h->coding == COEFF_CODING_HUFFMAN || h->coding == COEFF_CODING_SPARSE) && h->index_interval > 0 &&
+           h->index_interval <= 0xffff;
+}
+
+static int coeff_write_huffman(FILE *file, const huff_spec *spec) {
+    int count = 0;
+    for (int l = 1; l <= 16; l++) count += spec->bits[l];
+    return fwrite(spec->bits + 1, 1, 16, file) == 16 &&
+           fwrite(spec->values, 1, (size_t)count, file) == (size_t)count;
+}
+
+// dc: the table codes DC size categories, which stop at 16
+static int coeff_read_huffman(FILE *file, huff_spec *spec, int dc) {
+    int count = 0;
+    memset(spec, 0, sizeof(*spec));
+    if (fread(spec->bits + 1, 1, 16, file) != 16) return 0;
+    for (int l = 1; l <= 16; l++) count += spec->bits[l];
+    if (count > 256) return 0;
+    return fread(spec->values, 1, (size_t)count, file) == (size_t)count && huff_spec_valid(spec, dc);
+}
+
+// Only the tokens a channel uses are stored; most of the 256 are absent
+static int coeff_write_rans(FILE *file, const unsigned short *freq) {
+    unsigned char buffer[32 + 2 * 256];
+    size_t size = 32;
+    memset(buffer, 0, 32);
+    for (int k = 0; k < 256; k++) {
+        if (freq[k] == 0) continue;
+        buffer[k >> 3] |= (unsigned char)(1 << (k & 7));
+        coeff_put16(buffer + size, freq[k]);
+        size += 2;
+    }
+    return fwrite(buffer, 1, size, file) == size;
+}
+
+static int coeff_read_rans(FILE *file, unsigned short *freq) {
+    unsigned char bitmap[32], value[2];
+    if (fread(bitmap, 1, 32, file) != 32) return 0;
+    for (int k = 0; k < 256; k++) {
+        freq[k] = 0;
+        if (!((bitmap[k >> 3] >> (k & 7)) & 1)) continue;
+        if (fread(value, 1, 2, file) != 2) return 0;
+        freq[k] = (unsigned short)coeff_get16(value);
+    }
+    return 1;
+}
+
+int coeff_write_header(FILE *file, const coeff_header *h) {
+    unsigned char buffer[COEFF_FILE_HEADER_SIZE + 2 * COEFF_MAX_BLOCK * COEFF_MAX_BLOCK + 2];
+    int n = h->block_size;
+    if (!coeff_block_size_valid(n)) return 0;
+    if (h->width > COEFF_MAX_DIMENSION || h->height > COEFF_MAX_DIMENSION) return 0;
+    if (h->coding != COEFF_CODING_RAW && (n != 8 || h->channels > COEFF_MAX_CODED_CHANNELS)) return 0;
+    if (!coeff_index_valid(h)) return 0;
+
+    memcpy(buffer, "DCTC", 4);
+    coeff_put16(buffer + 4, COEFF_FILE_VERSION);
+    coeff_put16(buffer + 6, (unsigned int)n);
+    coeff_put32(buffer + 8, (unsigned long)h->width);
+    coeff_put32(buffer + 12, (unsigned long)h->height);
+    coeff_put16(buffer + 16, (unsigned int)h->channels);
+    coeff_put16(buffer + 18, (unsigned int)h->coding);
+    for (int k = 0; k < n * n; k++) {
+        coeff_put16(buffer + COEFF_FILE_HEADER_SIZE + 2 * k, (unsigned int)h->table[k]);
+    }
+    size_t size = COEFF_FILE_HEADER_SIZE + 2 * (size_t)n * n;
+    coeff_put16(buffer + size, (unsigned int)h->index_interval);
+    size += 2;
+    if (fwrite(buffer, 1, size, file) != size) return 0;
+
+    if (coeff_entropy_coded(h->coding)) {
+        for (int c = 0; c < h->channels; c++) buffer[c] = (unsigned char)h->dc_predictor[c];
+        if (fwrite(buffer, 1, (size_t)h->channels, file) != (size_t)h->channels) return 0;
+    }
+    if (h->coding == COEFF_CODING_HUFFMAN) {
+        for (int c = 0; c < h->channels; c++) {
+            if (!coeff_write_huffman(file, &h->dc_table[c]) || !coeff_write_huffman(file, &h->ac_table[c])) return 0;
+        }
+    } else if (h->coding == COEFF_CODING_RANS) {
+        coeff_put16(buffer, (unsigned int)h->rans_lanes);
+        if (fwrite(buffer, 1, 2, file) != 2) return 0;
+        for (int c = 0; c < h->channels; c++) {
+            if (!coeff_write_rans(file, h->rans_dc_freq[c]) || !coeff_write_rans(file, h->rans_ac_freq[c])) return 0;
+        }
+    }
+    return 1;
+}
+
+int coeff_read_header(FILE *file, coeff_header *h) {
+    unsigned char buffer[COEFF_FILE_HEADER_SIZE + 2 * COEFF_MAX_BLOCK * COEFF_MAX_BLOCK];
+    if (fread(buffer, 1, COEFF_FILE_HEADER_SIZE, file) != COEFF_FILE_HEADER_SIZE) return 0;
+    if (memcmp(buffer, "DCTC", 4) != 0) return 0;
+
+    h->version = (int)coeff_get16(buffer + 4);
+    h->block_size = (int)coeff_get16(buffer + 6);
+    h->width = (int)coeff_get32(buffer + 8);
+    h->height = (int)coeff_get32(buffer + 12);
+    h->channels = (int)coeff_get16(buffer + 16);
+    h->coding = (int)coeff_get16(buffer + 18);
+    if (h->version < 1 || h->version > COEFF_FILE_VERSION || !coeff_block_size_valid(h->block_size)) return 0;
+    if (h->width <= 0 || h->height <= 0 || h->channels <= 0) return 0;
+    if (h->width > COEFF_MAX_DIMENSION || h->height > COEFF_MAX_DIMENSION) return 0;
+    if (h->version == 1) h->coding = COEFF_CODING_RAW;   // the field was reserved, always 0
+    if (h->coding < COEFF_CODING_RAW || h->coding > COEFF_CODING_SPARSE) return 0;
+    if (h->coding != COEFF_CODING_RAW && (h->block_size != 8 || h->channels > COEFF_MAX_CODED_CHANNELS)) return 0;
+
+    int n = h->block_size;
+    size_t size = 2 * (size_t)n * n;
+    if (fread(buffer, 1, size, file) != size) return 0;
+    for (int k = 0; k < n * n; k++) {
+        h->table[k] = (int)coeff_get16(buffer + 2 * k);
+    }
+    h->index_interval = 0;
+    if (h->version >= 4) {
+        if (fread(buffer, 1, 2, file) != 2) return 0;
+        h->index_interval = (int)coeff_get16(buffer);
+        if (!coeff_index_valid(h)) return 0;
+    }
+
+    for (int c = 0; c < COEFF_MAX_CODED_CHANNELS; c++) h->dc_predictor[c] = 0;
+    if (coeff_entropy_coded(h->coding) && h->version >= 3) {
+        if (fread(buffer, 1, (size_t)h->channels, file) != (size_t)h->channels) return 0;
+        for (int c = 0; c < h->channels; c++) {
+            if (buffer[c] > COEFF_MAX_DC_PREDICTOR) return 0;
+            h->dc_predictor[c] = buffer[c];
+        }
+    }
+    if (h->coding == COEFF_CODING_HUFFMAN) {
+        for (int c = 0; c < h->channels; c++) {
+            if (!coeff_read_huffman(file, &h->dc_table[c], 1) || !coeff_read_huffman(file, &h->ac_table[c], 0)) return 0;
+        }
+    } else if (h->coding == COEFF_CODING_RANS) {
+        if (fread(buffer, 1, 2, file) != 2) return 0;
+        h->rans_lanes = (int)coeff_get16(buffer);
+        for (int c = 0; c < h->channels; c++) {
+            if (!coeff_read_rans(file, h->rans_dc_freq[c]) || !coeff_read_rans(file, h->rans_ac_freq[c])) return 0;
+        }
+    }
+    return 1;
+}
+
+int coeff_write_channel(FILE *file, const coeff_header *h, const short *coefficients) {
+    if (h->coding == COEFF_CODING_SPARSE) {
+        unsigned char *data;
+        size_t size = coeff_pack_sparse(h, coefficients, &data);
+        int written = size > 0;
+        int segments = coeff_index_segments(h);
+        if (written && segments > 0) {
+            unsigned long *offsets = (unsigned long *)malloc((size_t)segments * sizeof(unsigned long));
+            written = offsets != NULL && coeff_sparse_index(h, data, size, offsets) &&
+                      coeff_write_index(file, offsets, segments);
+            free(offsets);
+        }
+        written = written && coeff_write_scan(file, data, size);
+        free(data);
+        return written;
+    }
+    unsigned char buffer[2 * COEFF_CHUNK];
+    size_t total = coeff_channel_size(h);
+    for (size_t done = 0; done < total; ) {
+        size_t count = total - done < COEFF_CHUNK ? total - done : COEFF_CHUNK;
+        for (size_t k = 0; k < count; k++) {
+            coeff_put16(buffer + 2 * k, (unsigned short)coefficients[done + k]);
+        }
+        if (fwrite(buffer, 2, count, file) != count) return 0;
+        done += count;
+    }
+    return 1;
+}
+
+int coeff_read_channel(FILE *file, const coeff_header *h, short *coefficients) {
+    if (h->coding == COEFF_CODING_SPARSE) {
+        unsigned char *data;
+        size_t size;
+        // The index only matters to readers that skip around
+        long skip = 4L * coeff_index_segments(h);
+        if (skip > 0 && fseek(file, skip, SEEK_CUR) != 0) return 0;
+        if (!coeff_read_scan(file, &data, &size)) return 0;
+        int ok = coeff_unpack_sparse(h, data, size, coefficients);
+        free(data);
+        return ok;
+    }
+    unsigned char buffer[2 * COEFF_CHUNK];
+    size_t total = coeff_channel_size(h);
+    for (size_t done = 0; done < total; ) {
+        size_t count = total - done < COEFF_CHUNK ? total - done : COEFF_CHUNK;
+        if (fread(buffer, 2, count, file) != count) return 0;
+        for (size_t k = 0; k < count; k++) {
+            coefficients[done + k] = (short)coeff_get16(buffer + 2 * k);
+        }
+        done += count;
+    }
+    return 1;
+}
+
+int coeff_write_scan(FILE *file, const unsigned char *data, size_t size) {
+    unsigned char length[4];
+    if (size > 0xffffffffUL) return 0;
+    coeff_put32(length, (unsigned long)size);
+    return fwrite(length, 1, 4, file) == 4 && fwrite(data, 1, size, file) == size;
+}
+
+int coeff_read_scan_size(FILE *file, size_t *size) {
+    unsigned char length[4];
+    if (fread(length, 1, 4, file) != 4) return 0;
+    *size = (size_t)coeff_get32(length);
+    return 1;
+}
+
+int coeff_read_scan(FILE *file, unsigned char **data, size_t *size) {
+    if (!coeff_read_scan_size(file, size)) return 0;
+    *data = (unsigned char *)malloc(*size ? *size : 1);
+    if (*data == NULL) return 0;
+    if (fread(*data, 1, *size, file) != *size) {
+        free(*data);
+        *data = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+int coeff_write_index(FILE *file, const unsigned long *offsets, int count) {
+    unsigned char buffer[4];
+    for (int s = 0; s < count; s++) {
+        coeff_put32(buffer, offsets[s]);
+        if (fwrite(buffer, 1, 4, file) != 4) return 0;
+    }
+    return 1;
+}
+
+int coeff_read_index(FILE *file, unsigned long *offsets, int count) {
+    unsigned char buffer[4];
+    for (int s = 0; s < count; s++) {
+        if (fread(buffer, 1, 4, file) != 4) return 0;
+        offsets[s] = coeff_get32(buffer);
+        if (s > 0 && offsets[s] < offsets[s - 1]) return 0;
+    }
+    return 1;
+}
+
+// Same order as rle_zigzag in rle.h, repeated so this file needs nothing else
+static const unsigned char coeff_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+#define COEFF_SPARSE_EMPTY 0
+#define COEFF_SPARSE_DC 1
+#define COEFF_SPARSE_NARROW 2
+#define COEFF_SPARSE_WIDE 3
+// Class bits, mask length, full mask and 64 int16 values
+#define COEFF_SPARSE_MAX_BLOCK (1 + 1 + 8 + 2 * 64)
+
+static int coeff_lowest_bit(unsigned long long mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#else
+    int k = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        k++;
+    }
+    return k;
+#endif
+}
+
+size_t coeff_pack_sparse(const coeff_header *h, const short *coefficients, unsigned char **data) {
+    *data = NULL;
+    if (h->block_size != 8) return 0;
+    size_t blocks = coeff_channel_size(h) / 64;
+    size_t class_bytes = (blocks + 3) / 4;
+    unsigned char *classes = (unsigned char *)calloc(blocks * COEFF_SPARSE_MAX_BLOCK, 1);
+    if (classes == NULL) return 0;
+    *data = classes;
+
+    unsigned char *p = classes + class_bytes;
+    for (size_t b = 0; b < blocks; b++) {
+        const short *block = coefficients + b * 64;
+        unsigned long long mask = 0;
+        int wide = 0;
+        for (int k = 0; k < 64; k++) {
+            int value = block[coeff_zigzag[k]];
+            mask |= (unsigned long long)(value != 0) << k;
+            wide |= value < -128 || value > 127;
+        }
+        int type = mask == 0 ? COEFF_SPARSE_EMPTY : wide ? COEFF_SPARSE_WIDE
+                 : mask == 1 ? COEFF_SPARSE_DC : COEFF_SPARSE_NARROW;
+        classes[b / 4] |= (unsigned char)(type << (2 * (b % 4)));
+        if (type == COEFF_SPARSE_DC) *p++ = (unsigned char)(signed char)block[0];
+        if (type < COEFF_SPARSE_NARROW) continue;
+
+        int bytes = 1;
+        while (bytes < 8 && (mask >> (8 * bytes)) != 0) bytes++;
+        *p++ = (unsigned char)bytes;
+        for (int i = 0; i < bytes; i++) *p++ = (unsigned char)(mask >> (8 * i));
+        for (; mask; mask &= mask - 1) {
+            int value = block[coeff_zigzag[coeff_lowest_bit(mask)]];
+            if (wide) {
+                coeff_put16(p, (unsigned short)value);
+                p += 2;
+            } else {
+                *p++ = (unsigned char)(signed char)value;
+            }
+        }
+    }
+    return (size_t)(p - classes);
+}
+
+int coeff_unpack_sparse_blocks(const unsigned char *classes, size_t first, size_t count, const unsigned char **body,
+                               const unsigned char *end, short *coefficients) {
+    const unsigned char *p = *body;
+    for (size_t b = 0; b < count; b++) {
+        short *block = coefficients + b * 64;
+        size_t k = first % 4 + b;
+        memset(block, 0, 64 * sizeof(short));
+        int type = (classes[k / 4] >> (2 * (k % 4))) & 3;
+        if (type == COEFF_SPARSE_EMPTY) continue;
+        if (p >= end) return 0;
+        if (type == COEFF_SPARSE_DC) {
+            block[0] = (signed char)*p++;
+            continue;
+        }
+
+        int bytes = *p++;
+        if (bytes < 1 || bytes > 8 || (size_t)(end - p) < (size_t)bytes) return 0;
+        unsigned long long mask = 0;
+        for (int i = 0; i < bytes; i++) mask |= (unsigned long long)*p++ << (8 * i);
+
+        // Every value of the block is in the buffer before any is read
+        int wide = type == COEFF_SPARSE_WIDE, values = 0;
+        for (unsigned long long m = mask; m; m &= m - 1) values++;
+        if ((size_t)(end - p) < (size_t)values << wide) return 0;
+        if (wide) {
+            for (; mask; mask &= mask - 1) {
+                block[coeff_zigzag[coeff_lowest_bit(mask)]] = (short)coeff_get16(p);
+                p += 2;
+            }
+        } else {
+            for (; mask; mask &= mask - 1) block[coeff_zigzag[coeff_lowest_bit(mask)]] = (signed char)*p++;
+        }
+    }
+    *body = p;
+    return 1;
+}
+
+int coeff_unpack_sparse(const coeff_header *h, const unsigned char *data, size_t size, short *coefficients) {
+    if (h->block_size != 8) return 0;
+    size_t blocks = coeff_channel_size(h) / 64;
+    size_t class_bytes = (blocks + 3) / 4;
+    if (size < class_bytes) return 0;
+    const unsigned char *p = data + class_bytes, *end = data + size;
+    return coeff_unpack_sparse_blocks(data, 0, blocks, &p, end, coefficients) && p == end;
+}
+
+// Walks the bodies by their sizes alone: a class, a mask length and a popcount each
+int coeff_sparse_index(const coeff_header *h, const unsigned char *data, size_t size, unsigned long *offsets) {
+    if (h->block_size != 8 || h->index_interval <= 0) return 0;
+    size_t blocks_x = (size_t)(h->width + 7) / 8;
+    size_t blocks = coeff_channel_size(h) / 64;
+    size_t class_bytes = (blocks + 3) / 4, offset = class_bytes;
+    size_t segment_blocks = blocks_x * (size_t)h->index_interval;
+    if (size < class_bytes) return 0;
+    for (size_t b = 0; b < blocks; b++) {
+        if (b % segment_blocks == 0) offsets[b / segment_blocks] = (unsigned long)offset;
+        int type = (data[b / 4] >> (2 * (b % 4))) & 3;
+        if (type == COEFF_SPARSE_EMPTY) continue;
+        if (offset >= size) return 0;
+        if (type == COEFF_SPARSE_DC) {
+            offset++;
+            continue;
+        }
+        int bytes = data[offset++];
+        if (bytes < 1 || bytes > 8 || size - offset < (size_t)bytes) return 0;
+        int count = 0;
+        for (int i = 0; i < bytes; i++) {
+            for (unsigned int m = data[offset + i]; m; m &= m - 1) count++;
+        }
+        offset += (size_t)bytes + ((size_t)count << (type == COEFF_SPARSE_WIDE));
+    }
+    return offset == size;
+}
+
+void coeff_write_text(FILE *file, const coeff_header *h, const short *coefficients) {
+    int n = h->block_size;
+    size_t blocks_x = (size_t)(h->width + n - 1) / n;
+    for (int i = 0; i < h->height; i++) {
+        const short *row = coefficients + ((size_t)(i / n) * blocks_x * n + (i % n)) * n;
+        for (int j = 0; j < h->width; j++) {
+            fprintf(file, "%5.1f\t", (double)row[(size_t)(j / n) * n * n + j % n]);
+        }
+        fprintf(file, "\n");
+    }
+}
+
+#endif // COEFF_FILE_IMPLEMENTATION_DONE
+#endif // COEFF_FILE_IMPLEMENTATION
@@ -0,0 +1,149 @@
+/* dc_predict.h - DC prediction across quantized 8x8 blocks
+
+   Do this:
+      #define DC_PREDICT_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   Neighbouring blocks of a natural image have close means, so the DC
+   coefficient (block[0]) is coded as the difference from a prediction
+   made from blocks already seen:
+
+      DC_PREDICT_PREVIOUS  previous block in raster order (what JPEG does)
+      DC_PREDICT_LEFT      left block
+      DC_PREDICT_TOP       upper block
+      DC_PREDICT_MEDIAN    median of left, top and left + top - top-left
+                           (the JPEG-LS edge detector: follows an edge in
+                           either direction, the gradient on smooth areas)
+
+   Outside the previous-block rule the first row predicts from the left
+   and the first column from the top; the first block predicts 0. The
+   residuals wrap in 16 bits, so the inverse is exact for any input.
+
+   dc_predict_forward() replaces every block[0] by its residual in place,
+   walking the blocks backwards so the neighbours it reads are still the
+   original values; dc_predict_inverse() walks forwards over the
+   reconstructed ones, and dc_predict_inverse_row() does one block row of
+   it for decoders that work a row at a time. All of them touch only the
+   DC of each block. The mode is picked per image with dc_predict_choose().
+*/
+#ifndef DC_PREDICT_H
+#define DC_PREDICT_H
+
+#define DC_PREDICT_PREVIOUS 0
+#define DC_PREDICT_LEFT 1
+#define DC_PREDICT_TOP 2
+#define DC_PREDICT_MEDIAN 3
+#define DC_PREDICT_MODES 4
+
+// Block-major channels of 8x8 blocks: 64 int16 per block, blocks in raster order
+#define DC_PREDICT_STRIDE 64
+
+extern const char *const dc_predict_names[DC_PREDICT_MODES];
+
+void dc_predict_forward(short *coefficients, int blocks_x, int blocks_y, int mode);
+void dc_predict_inverse(short *coefficients, int blocks_x, int blocks_y, int mode);
+// Block row by of the channel at coefficients; rows above it already reconstructed
+void dc_predict_inverse_row(short *coefficients, int blocks_x, int by, int mode);
+
+// Estimated DC cost in bits (magnitude categories of the residuals) of a
+// mode, and the cheapest mode for a channel
+long dc_predict_cost(const short *coefficients, int blocks_x, int blocks_y, int mode);
+int dc_predict_choose(const short *coefficients, int blocks_x, int blocks_y);
+
+#endif // DC_PREDICT_H
+
+#ifdef DC_PREDICT_IMPLEMENTATION
+#ifndef DC_PREDICT_IMPLEMENTATION_DONE
+#define DC_PREDICT_IMPLEMENTATION_DONE
+
+#include <stddef.h>
+
+const char *const dc_predict_names[DC_PREDICT_MODES] = {"previous", "left", "top", "median"};
+
+// Prediction for the block at (bx, by) from the DC values before it in raster order
+static int dc_predict_at(const short *coefficients, int blocks_x, int bx, int by, int mode) {
+    const short *dc = coefficients + ((size_t)by * blocks_x + bx) * DC_PREDICT_STRIDE;
+    const ptrdiff_t row = (ptrdiff_t)blocks_x * DC_PREDICT_STRIDE;
+
+    if (mode == DC_PREDICT_PREVIOUS || by == 0) return bx || by ? dc[-DC_PREDICT_STRIDE] : 0;
+    int top = dc[-row];
+    if (bx == 0 || mode == DC_PREDICT_TOP) return top;
+    int left = dc[-DC_PREDICT_STRIDE];
+    if (mode == DC_PREDICT_LEFT) return left;
+
+    int top_left = dc[-row - DC_PREDICT_STRIDE];
+    int low = left < top ? left : top;
+    int high = left < top ? top : left;
+    if (top_left >= high) return low;
+    if (top_left <= low) return high;
+    return left + top - top_left;
+}
+
+void dc_predict_forward(short *coefficients, int blocks_x, int blocks_y, int mode) {
+    for (int by = blocks_y - 1; by >= 0; by--) {
+        for (int bx = blocks_x - 1; bx >= 0; bx--) {
+            short *dc = coefficients + ((size_t)by * blocks_x + bx) * DC_PREDICT_STRIDE;
+            *dc = (short)(*dc - dc_predict_at(coefficients, blocks_x, bx, by, mode));
+        }
+    }
+}
+
+void dc_predict_inverse_row(short *coefficients, int blocks_x, int by, int mode) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+        short *dc = coefficients + ((size_t)by * blocks_x + bx) * DC_PREDICT_STRIDE;
+        *dc = (short)(*dc + dc_predict_at(coefficients, blocks_x, bx, by, mode));
+    }
+}
+
+void dc_predict_inverse(short *coefficients, int blocks_x, int blocks_y, int mode) {
+    for (int by = 0; by < blocks_y; by++) dc_predict_inverse_row(coefficients, blocks_x, by, mode);
+}
+
+// Magnitude category (bit length) of a residual, wrapped to 16 bits like the coded one
+static int dc_predict_bits(int residual) {
+    residual = (short)residual;
+    unsigned int magnitude = (unsigned int)(residual < 0 ? -residual : residual);
+#if defined(__GNUC__) || defined(__clang__)
+    return magnitude ? 32 - __builtin_clz(magnitude) : 0;
+#else
+    int bits = 0;
+    while (magnitude) {
+        bits++;
+        magnitude >>= 1;
+    }
+    return bits;
+#endif
+}
+
+long dc_predict_cost(const short *coefficients, int blocks_x, int blocks_y, int mode) {
+    long bits = 0;
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            int dc = coefficients[((size_t)by * blocks_x + bx) * DC_PREDICT_STRIDE];
+            bits += dc_predict_bits(dc - dc_predict_at(coefficients, blocks_x, bx, by, mode));
+        }
+    }
+    return bits;
+}
+
+// All modes in one walk over the blocks: the DC values are a cache line
+// apart, so the memory traffic, not the arithmetic, is what costs
+int dc_predict_choose(const short *coefficients, int blocks_x, int blocks_y) {
+    long bits[DC_PREDICT_MODES] = {0};
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            int dc = coefficients[((size_t)by * blocks_x + bx) * DC_PREDICT_STRIDE];
+            for (int mode = 0; mode < DC_PREDICT_MODES; mode++) {
+                bits[mode] += dc_predict_bits(dc - dc_predict_at(coefficients, blocks_x, bx, by, mode));
+            }
+        }
+    }
+    int best = DC_PREDICT_PREVIOUS;
+    for (int mode = 1; mode < DC_PREDICT_MODES; mode++) {
+        if (bits[mode] < bits[best]) best = mode;
+    }
+    return best;
+}
+
+#endif // DC_PREDICT_IMPLEMENTATION_DONE
+#endif // DC_PREDICT_IMPLEMENTATION
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+#define PLANE_IMPLEMENTATION
+#include "plane.h"
 
 #define ROWS 1920
 #define COLS 1080
@@ -18,48 +22,48 @@ int base_quantization_matrix[BLOCK_SIZE][BLOCK_SIZE] = {
     {72, 92, 95, 98, 112, 100, 103, 99}
 };
 
-// Dynamically generate the 1920x1080 quantization matrix
-void generate_quantization_matrix(int **quantization_matrix) {
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            quantization_matrix[i][j] = base_quantization_matrix[i % BLOCK_SIZE][j % BLOCK_SIZE];
-        }
-    }
-}
-
 // Generate a random matrix of size 1920x1080
-void generate_random_matrix(double **matrix) {
+void generate_random_matrix(plane *matrix) {
     for (int i = 0; i < ROWS; i++) {
+        double *row = plane_row(matrix, i);
         for (int j = 0; j < COLS; j++) {
             // Random integers between 0 and 255 (for image pixel-like values)
-            matrix[i][j] = rand() % 256;
+            row[j] = rand() % 256;
         }
     }
 }
 
-void quantize(double **dct_matrix, int **quantization_matrix, double **result) {
+void quantize(const plane *dct_matrix, const quant_table *quant, plane *result) {
     for (int i = 0; i < ROWS; i++) {
+        const double *recip = quant->reciprocal + (i % BLOCK_SIZE) * BLOCK_SIZE;
+        const double *in = plane_row(dct_matrix, i);
+        double *out = plane_row(result, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = round(dct_matrix[i][j] / quantization_matrix[i][j]);
+            out[j] = round(in[j] * recip[j % BLOCK_SIZE]);
         }
     }
 }
 
-void dequantize(double **quantized_matrix, int **quantization_matrix, double **result) {
+void dequantize(const plane *quantized_matrix, const quant_table *quant, plane *result) {
     for (int i = 0; i < ROWS; i++) {
+        const int *table = quant->table + (i % BLOCK_SIZE) * BLOCK_SIZE;
+        const double *in = plane_row(quantized_matrix, i);
+        double *out = plane_row(result, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = quantized_matrix[i][j] * quantization_matrix[i][j];
+            out[j] = in[j] * table[j % BLOCK_SIZE];
         }
     }
 }
 
 // Verify the compression and decompression process
-void verify(double **original_matrix, double **dequantized_matrix) {
+void verify(const plane *original_matrix, const plane *dequantized_matrix) {
     int differences = 0;
     double error_margin = 59.0; 
     for (int i = 0; i < ROWS; i++) {
+        const double *original = plane_row(original_matrix, i);
+        const double *dequantized = plane_row(dequantized_matrix, i);
         for (int j = 0; j < COLS; j++) {
-            if (fabs(original_matrix[i][j] - dequantized_matrix[i][j]) > error_margin) {
+            if (fabs(original[j] - dequantized[j]) > error_margin) {
                 differences++;
             }
         }
@@ -72,39 +76,28 @@ void verify(double **original_matrix, double **dequantized_matrix) {
 }
 
 int main() {
-    int **quantization_matrix = (int **)malloc(ROWS * sizeof(int *));
-    double **dct_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **quantized_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **dequantized_matrix = (double **)malloc(ROWS * sizeof(double *));
+    plane dct_matrix, quantized_matrix, dequantized_matrix;
     
-    for (int i = 0; i < ROWS; i++) {
-        quantization_matrix[i] = (int *)malloc(COLS * sizeof(int));
-        dct_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        quantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        dequantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
+    if (!plane_create(&dct_matrix, COLS, ROWS, BLOCK_SIZE) || !plane_create(&quantized_matrix, COLS, ROWS, BLOCK_SIZE) ||
+        !plane_create(&dequantized_matrix, COLS, ROWS, BLOCK_SIZE)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
 
-    generate_quantization_matrix(quantization_matrix);
+    quant_table quant;
+    quant_table_init(&quant, base_quantization_matrix);
 
-    generate_random_matrix(dct_matrix);
+    generate_random_matrix(&dct_matrix);
 
-    quantize(dct_matrix, quantization_matrix, quantized_matrix);
+    quantize(&dct_matrix, &quant, &quantized_matrix);
 
-    dequantize(quantized_matrix, quantization_matrix, dequantized_matrix);
+    dequantize(&quantized_matrix, &quant, &dequantized_matrix);
 
-    verify(dct_matrix, dequantized_matrix);
+    verify(&dct_matrix, &dequantized_matrix);
 
-    for (int i = 0; i < ROWS; i++) {
-        free(quantization_matrix[i]);
-        free(dct_matrix[i]);
-        free(quantized_matrix[i]);
-        free(dequantized_matrix[i]);
-    }
-    
-    free(quantization_matrix);
-    free(dct_matrix);
-    free(quantized_matrix);
-    free(dequantized_matrix);
+    plane_free(&dct_matrix);
+    plane_free(&quantized_matrix);
+    plane_free(&dequantized_matrix);
 
     return 0;
 }
@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#define DCT_TRANSFORM_IMPLEMENTATION
+#include "dct_transform.h"
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+#define PLANE_IMPLEMENTATION
+#include "plane.h"
 
 #define ROWS 1920
 #define COLS 1080
@@ -18,87 +24,50 @@ int base_quantization_matrix[BLOCK_SIZE][BLOCK_SIZE] = {
     {72, 92, 95, 98, 112, 100, 103, 99}
 };
 
-// Function to compute the DCT of an 8x8 block
-void dct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int u = 0; u < BLOCK_SIZE; u++) {
-        for (int v = 0; v < BLOCK_SIZE; v++) {
-            double sum = 0.0;
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    sum += input[x][y] * cos(((2 * x + 1) * u * M_PI) / (2.0 * BLOCK_SIZE)) *
-                                               cos(((2 * y + 1) * v * M_PI) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            output[u][v] = 0.25 * cu * cv * sum;
-        }
-    }
-}
-
-// Function to compute the IDCT of an 8x8 block
-void idct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int x = 0; x < BLOCK_SIZE; x++) {
-        for (int y = 0; y < BLOCK_SIZE; y++) {
-            double sum = 0.0;
-            for (int u = 0; u < BLOCK_SIZE; u++) {
-                for (int v = 0; v < BLOCK_SIZE; v++) {
-                    double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-                    double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-                    sum += cu * cv * input[u][v] * cos(((2 * x + 1) * u * M_PI) / (2.0 * BLOCK_SIZE)) *
-                                                         cos(((2 * y + 1) * v * M_PI) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            output[x][y] = 0.25 * sum;
-        }
-    }
-}
-
-// Dynamically generate the 1920x1080 quantization matrix
-void generate_quantization_matrix(int **quantization_matrix) {
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            // Tile the 8x8 matrix across 1920x1080
-            quantization_matrix[i][j] = base_quantization_matrix[i % BLOCK_SIZE][j % BLOCK_SIZE];
-        }
-    }
-}
-
 // Generate a random matrix of size 1920x1080
-void generate_random_matrix(double **matrix) {
+void generate_random_matrix(plane *matrix) {
     for (int i = 0; i < ROWS; i++) {
+        double *row = plane_row(matrix, i);
         for (int j = 0; j < COLS; j++) {
             // Random integers between 0 and 255 (for image pixel-like values)
-            matrix[i][j] = rand() % 256;
+            row[j] = rand() % 256;
         }
     }
 }
 
-// Quantize using the generated 1920x1080 quantization matrix
-void quantize(double **dct_matrix, int **quantization_matrix, double **result) {
+// Quantize against the 8x8 table, indexed by position inside the block
+void quantize(const plane *dct_matrix, const quant_table *quant, plane *result) {
     for (int i = 0; i < ROWS; i++) {
+        const double *recip = quant->reciprocal + (i % BLOCK_SIZE) * BLOCK_SIZE;
+        const double *in = plane_row(dct_matrix, i);
+        double *out = plane_row(result, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = round(dct_matrix[i][j] / quantization_matrix[i][j]);
+            out[j] = round(in[j] * recip[j % BLOCK_SIZE]);
         }
     }
 }
 
 // Dequantize the matrix
-void dequantize(double **quantized_matrix, int **quantization_matrix, double **result) {
+void dequantize(const plane *quantized_matrix, const quant_table *quant, plane *result) {
     for (int i = 0; i < ROWS; i++) {
+        const int *table = quant->table + (i % BLOCK_SIZE) * BLOCK_SIZE;
+        const double *in = plane_row(quantized_matrix, i);
+        double *out = plane_row(result, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = quantized_matrix[i][j] * quantization_matrix[i][j];
+            out[j] = in[j] * table[j % BLOCK_SIZE];
         }
     }
 }
 
 // Verify the compression and decompression process
-void verify(double **original_matrix, double **dequantized_matrix) {
+void verify(const plane *original_matrix, const plane *dequantized_matrix) {
     int differences = 0;
     double error_margin = 1.0;  // Set an acceptable error margin due to rounding
     for (int i = 0; i < ROWS; i++) {
+        const double *original = plane_row(original_matrix, i);
+        const double *dequantized = plane_row(dequantized_matrix, i);
         for (int j = 0; j < COLS; j++) {
-            if (fabs(original_matrix[i][j] - dequantized_matrix[i][j]) > error_margin) {
+            if (fabs(original[j] - dequantized[j]) > error_margin) {
                 differences++;
             }
         }
@@ -136,33 +105,30 @@ int verify_dct_idct(double original[BLOCK_SIZE][BLOCK_SIZE], double reconstructe
 // Main function
 int main() {
     // Step 1: Dynamically allocate memory for the matrices
-    int **quantization_matrix = (int **)malloc(ROWS * sizeof(int *));
-    double **dct_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **quantized_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **dequantized_matrix = (double **)malloc(ROWS * sizeof(double *));
+    plane dct_matrix, quantized_matrix, dequantized_matrix;
     double checker = 0;
     
-    for (int i = 0; i < ROWS; i++) {
-        quantization_matrix[i] = (int *)malloc(COLS * sizeof(int));
-        dct_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        quantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        dequantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
+    if (!plane_create(&dct_matrix, COLS, ROWS, BLOCK_SIZE) || !plane_create(&quantized_matrix, COLS, ROWS, BLOCK_SIZE) ||
+        !plane_create(&dequantized_matrix, COLS, ROWS, BLOCK_SIZE)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
 
-    // Step 2: Generate the 1920x1080 quantization matrix
-    generate_quantization_matrix(quantization_matrix);
+    // Step 2: Set up the 8x8 quantization table
+    quant_table quant;
+    quant_table_init(&quant, base_quantization_matrix);
 
     // Step 3: Generate a random 1920x1080 matrix (simulating DCT coefficients)
-    generate_random_matrix(dct_matrix);
+    generate_random_matrix(&dct_matrix);
 
     // Step 4: Quantize the random matrix
-    quantize(dct_matrix, quantization_matrix, quantized_matrix);
+    quantize(&dct_matrix, &quant, &quantized_matrix);
 
     // Step 5: Dequantize the quantized matrix
-    dequantize(quantized_matrix, quantization_matrix, dequantized_matrix);
+    dequantize(&quantized_matrix, &quant, &dequantized_matrix);
 
     // Step 6: Verify if the decompressed matrix matches the original matrix
-    verify(dct_matrix, dequantized_matrix);
+    verify(&dct_matrix, &dequantized_matrix);
 
     // Step 7: Perform DCT and IDCT verification on each 8x8 block
     double dct_block[BLOCK_SIZE][BLOCK_SIZE], idct_block[BLOCK_SIZE][BLOCK_SIZE];
@@ -170,11 +136,7 @@ int main() {
     for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
         for (int j = 0; j < COLS; j += BLOCK_SIZE) {
             // Extract the 8x8 block
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_block[x][y] = dct_matrix[i + x][j + y];
-                }
-            }
+            plane_get_block(&dct_matrix, j, i, dct_block);
 
             // Perform DCT on the block
             dct(dct_block, idct_block);
@@ -197,17 +159,9 @@ int main() {
     
 
     // Free allocated memory
-    for (int i = 0; i < ROWS; i++) {
-        free(quantization_matrix[i]);
-        free(dct_matrix[i]);
-        free(quantized_matrix[i]);
-        free(dequantized_matrix[i]);
-    }
-    
-    free(quantization_matrix);
-    free(dct_matrix);
-    free(quantized_matrix);
-    free(dequantized_matrix);
+    plane_free(&dct_matrix);
+    plane_free(&quantized_matrix);
+    plane_free(&dequantized_matrix);
 
     return 0;
 }
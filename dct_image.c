@@ -1,6 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#define DCT_TRANSFORM_IMPLEMENTATION
+#include "dct_transform.h"
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+#define COEFF_FILE_IMPLEMENTATION
+#include "coeff_file.h"
+#define RLE_IMPLEMENTATION
+#include "rle.h"
+#define HUFFMAN_IMPLEMENTATION
+#include "huffman.h"
+#define JPEG_WRITER_IMPLEMENTATION
+#include "jpeg_writer.h"
+#define PLANE_IMPLEMENTATION
+#include "plane.h"
 #include "stb_image.h"
 #define STB_IMAGE_IMPLEMENTATION
 #define ROWS 1920
@@ -8012,134 +8027,184 @@ int base_quantization_matrix[BLOCK_SIZE][BLOCK_SIZE] = {
     {72, 92, 95, 98, 112, 100, 103, 99}
 };
 
-// Function to compute the DCT of an 8x8 block
-void dct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int u = 0; u < BLOCK_SIZE; u++) {
-        for (int v = 0; v < BLOCK_SIZE; v++) {
-            double sum = 0.0;
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    sum += input[x][y] * cos(((2 * x + 1) * u * m_pi) / (2.0 * BLOCK_SIZE)) *
-                                               cos(((2 * y + 1) * v * m_pi) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            output[u][v] = 0.25 * cu * cv * sum;
-        }
+// Create a plane for the image channels, rows padded to whole blocks
+void create_matrix(plane_u8 *matrix, int height, int width, int channels) {
+    if (!plane_u8_create(matrix, width * channels, height, BLOCK_SIZE)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
 }
 
-// Dynamically generate the quantization matrix
-void generate_quantization_matrix(int **quantization_matrix) {
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            quantization_matrix[i][j] = base_quantization_matrix[i % BLOCK_SIZE][j % BLOCK_SIZE];
-        }
+// Populate the matrix from image data
+void populate_matrix(plane_u8 *matrix, unsigned char *image_data, int width, int height, int channels) {
+    for (int i = 0; i < height; i++) {
+        memcpy(plane_u8_row(matrix, i), image_data + (size_t)i * width * channels, (size_t)width * channels);
     }
 }
 
-// Quantize using the generated quantization matrix
-void quantize(double **dct_matrix, int **quantization_matrix, double **result) {
+// Dequantize and inverse transform a quantized channel back to samples and
+// return its PSNR against the samples it was coded from. This is the only
+// reconstruction for block sizes other than 8, which coeff_decoder.h
+// does not read.
+double reconstruct_channel(const plane *samples, int block_size, const int *block_table, const short *quantized,
+                           size_t blocks) {
+    double *dequantized = (double *)malloc(blocks * block_size * block_size * sizeof(double));
+    plane reconstructed;
+    if (dequantized == NULL || !plane_create(&reconstructed, COLS, ROWS, block_size)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    dequantize_blocks(block_size, quantized, blocks, block_table, dequantized);
+    inverse_dct_plane_n(block_size, dequantized, COLS, ROWS, reconstructed.data, reconstructed.stride);
+
+    double squared_error = 0.0;
     for (int i = 0; i < ROWS; i++) {
+        const double *original = plane_row(samples, i);
+        const double *decoded = plane_row(&reconstructed, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = round(dct_matrix[i][j] / quantization_matrix[i][j]);
+            double value = round(decoded[j]);
+            value = value < 0.0 ? 0.0 : value > 255.0 ? 255.0 : value;
+            squared_error += (value - original[j]) * (value - original[j]);
         }
     }
-}
-
-// Create a matrix for the image channels
-unsigned char** create_matrix(int height, int width, int channels) {
-    unsigned char **matrix = (unsigned char**)malloc(height * sizeof(unsigned char*));
-    if (matrix == NULL) {
+    free(dequantized);
+    plane_free(&reconstructed);
+    return 10.0 * log10(255.0 * 255.0 / (squared_error / ((double)ROWS * COLS) + 1e-12));
+}
+
+// DCT and quantization for each color channel, into block-major int16.
+// Returns the PSNR of the channel reconstructed from it.
+double process_channel(const plane_u8 *channel_matrix, int block_size, const int *block_table, short *quantized) {
+    int blocks_x = (COLS + block_size - 1) / block_size;
+    int blocks_y = (ROWS + block_size - 1) / block_size;
+    size_t blocks = (size_t)blocks_x * blocks_y;
+    plane samples;
+    if (!plane_create(&samples, COLS, ROWS, block_size)) {
         printf("Memory allocation failed!\n");
         exit(1);
     }
-
-    for (int i = 0; i < height; i++) {
-        matrix[i] = (unsigned char*)malloc(width * channels * sizeof(unsigned char));
-        if (matrix[i] == NULL) {
-            printf("Memory allocation failed!\n");
-            exit(1);
+    for (int i = 0; i < ROWS; i++) {
+        const unsigned char *in = plane_u8_row(channel_matrix, i);
+        double *out = plane_row(&samples, i);
+        for (int j = 0; j < COLS; j++) {
+            out[j] = (double)in[j];
         }
     }
-    return matrix;
-}
 
-// Populate the matrix from image data
-void populate_matrix(unsigned char **matrix, unsigned char *image_data, int width, int height, int channels) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int index = (i * width + j) * channels;
-            for (int c = 0; c < channels; c++) {
-                matrix[i][j * channels + c] = image_data[index + c];
-            }
-        }
+    if (block_size == BLOCK_SIZE) {
+        forward_dct_quantize_plane(samples.data, samples.stride, COLS, ROWS, block_table, quantized);
+    } else {
+        double *coefficients = (double *)malloc(blocks * block_size * block_size * sizeof(double));
+        forward_dct_plane_n(block_size, samples.data, samples.stride, COLS, ROWS, coefficients);
+        quantize_blocks(block_size, coefficients, blocks, block_table, quantized);
+        free(coefficients);
     }
+    double psnr = reconstruct_channel(&samples, block_size, block_table, quantized, blocks);
+    plane_free(&samples);
+    return psnr;
 }
 
-// DCT and quantization for each color channel
-void process_channel(unsigned char **channel_matrix, int **quantization_matrix, const char *filename) {
+// Debug conversion of one channel back to the "%5.1f\t" text dump
+void write_text_channel(const coeff_header *header, const short *quantized, const char *filename) {
     FILE *file = fopen(filename, "w");
 
     if (file == NULL) {
         printf("Error opening file %s!\n", filename);
         exit(1);
     }
+    coeff_write_text(file, header, quantized);
+    fclose(file);
+}
 
-    double **dct_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **quantized_matrix = (double **)malloc(ROWS * sizeof(double *));
-    for (int i = 0; i < ROWS; i++) {
-        dct_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        quantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
+// Baseline JFIF of the image: YCbCr 4:4:4, the Annex K luminance and
+// chrominance tables scaled to quality, always 8x8 blocks
+int write_jpeg(const char *filename, const plane_u8 *red, const plane_u8 *green, const plane_u8 *blue,
+               int quality, int restart_interval, int optimize) {
+    size_t blocks = (size_t)((COLS + BLOCK_SIZE - 1) / BLOCK_SIZE) * ((ROWS + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    plane planes[3];
+    short *coefficients[3];
+    for (int c = 0; c < 3; c++) {
+        coefficients[c] = (short *)malloc(blocks * BLOCK_SIZE * BLOCK_SIZE * sizeof(short));
+        if (!plane_create(&planes[c], COLS, ROWS, BLOCK_SIZE) || coefficients[c] == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
     }
-
     for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            dct_matrix[i][j] = (double)channel_matrix[i][j];
-        }
+        jpeg_rgb_to_ycbcr_shifted(plane_u8_row(red, i), plane_u8_row(green, i), plane_u8_row(blue, i), COLS,
+                                  plane_row(&planes[0], i), plane_row(&planes[1], i), plane_row(&planes[2], i));
     }
 
-    double dct_block[BLOCK_SIZE][BLOCK_SIZE];
-    for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
-        for (int j = 0; j < COLS; j += BLOCK_SIZE) {
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_block[x][y] = dct_matrix[i + x][j + y];
-                }
-            }
-
-            double dct_output[BLOCK_SIZE][BLOCK_SIZE];
-            dct(dct_block, dct_output);
-
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_matrix[i + x][j + y] = dct_output[x][y];
-                }
-            }
-        }
+    quant_table luma, chroma;
+    quant_table_for_quality(base_quantization_matrix, quality, &luma);
+    quant_table_for_quality(jpeg_chrominance_quantization, quality, &chroma);
+    jpeg_params params;
+    params.width = COLS;
+    params.height = ROWS;
+    params.components = 3;
+    params.restart_interval = restart_interval;
+    params.optimize = optimize;
+    params.quant[0] = luma.table;
+    params.quant[1] = chroma.table;
+    for (int c = 0; c < 3; c++) {
+        forward_dct_quantize_plane(planes[c].data, planes[c].stride, COLS, ROWS, params.quant[c ? 1 : 0], coefficients[c]);
+        plane_free(&planes[c]);
     }
 
-    quantize(dct_matrix, quantization_matrix, quantized_matrix);
-
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            fprintf(file, "%5.1f\t", quantized_matrix[i][j]);
-        }
-        fprintf(file, "\n");
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Error opening file %s!\n", filename);
+        exit(1);
     }
-
+    int written = jpeg_write(file, &params, (const short *const *)coefficients);
+    long size = ftell(file);
     fclose(file);
-
-    for (int i = 0; i < ROWS; i++) {
-        free(dct_matrix[i]);
-        free(quantized_matrix[i]);
+    for (int c = 0; c < 3; c++) free(coefficients[c]);
+    if (written) printf("Wrote %s, %ld bytes (%.3f bits/pixel)\n", filename, size, size * 8.0 / ((double)ROWS * COLS));
+    return written;
+}
+
+int main(int argc, char **argv) {
+    // Optional "-e table|aan|fixed|simd" selects the DCT engine, "-b 4|8|16|32" the
+    // block size, "-q 1..100" the quality the quantization table is scaled to and
+    // "-t" also writes the quantized_*.txt text dumps. "-j file.jpg" also writes a
+    // baseline JPEG at that quality, with an RST marker every n MCUs for
+    // "-r n" and optimal Huffman tables for "-O"
+    int block_size = BLOCK_SIZE;
+    int quality = 50;
+    int text_output = 0;
+    const char *jpeg_name = NULL;
+    int restart_interval = 0;
+    int optimize_tables = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            if (!dct_select_engine(argv[++i])) {
+                printf("Unknown DCT engine %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            block_size = atoi(argv[++i]);
+            if (!dct_block_size_supported(block_size)) {
+                printf("Unsupported block size %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            quality = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            text_output = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jpeg_name = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            restart_interval = atoi(argv[++i]);
+            if (restart_interval < 0 || restart_interval > 65535) {
+                printf("Restart interval %s out of range\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-O") == 0) {
+            optimize_tables = 1;
+        }
     }
-    free(dct_matrix);
-    free(quantized_matrix);
-}
 
-int main() {
     int width, height, channels;
 
     unsigned char *image_data = stbi_load("image.png", &width, &height, &channels, 0);
@@ -8151,46 +8216,71 @@ int main() {
     height = ROWS;
     width = COLS;
 
-    unsigned char **image_matrix = create_matrix(height, width, channels);
-    populate_matrix(image_matrix, image_data, width, height, channels);
+    plane_u8 image_matrix;
+    create_matrix(&image_matrix, height, width, channels);
+    populate_matrix(&image_matrix, image_data, width, height, channels);
 
-    int **quantization_matrix = (int **)malloc(ROWS * sizeof(int *));
-    for (int i = 0; i < ROWS; i++) {
-        quantization_matrix[i] = (int *)malloc(COLS * sizeof(int));
-    }
-    generate_quantization_matrix(quantization_matrix);
-
-    unsigned char **red_channel = create_matrix(height, width, 1);
-    unsigned char **green_channel = create_matrix(height, width, 1);
-    unsigned char **blue_channel = create_matrix(height, width, 1);
+    plane_u8 red_channel, green_channel, blue_channel;
+    create_matrix(&red_channel, height, width, 1);
+    create_matrix(&green_channel, height, width, 1);
+    create_matrix(&blue_channel, height, width, 1);
 
     for (int i = 0; i < height; i++) {
+        const unsigned char *pixel = plane_u8_row(&image_matrix, i);
+        unsigned char *red = plane_u8_row(&red_channel, i);
+        unsigned char *green = plane_u8_row(&green_channel, i);
+        unsigned char *blue = plane_u8_row(&blue_channel, i);
         for (int j = 0; j < width; j++) {
-            red_channel[i][j] = image_matrix[i][j * channels];
-            green_channel[i][j] = image_matrix[i][j * channels + 1];
-            blue_channel[i][j] = image_matrix[i][j * channels + 2];
+            red[j] = pixel[j * channels];
+            green[j] = pixel[j * channels + 1];
+            blue[j] = pixel[j * channels + 2];
         }
     }
 
-    process_channel(red_channel, quantization_matrix, "quantized_red.txt");
-    process_channel(green_channel, quantization_matrix, "quantized_green.txt");
-    process_channel(blue_channel, quantization_matrix, "quantized_blue.txt");
-
-    for (int i = 0; i < height; i++) {
-        free(image_matrix[i]);
-        free(red_channel[i]);
-        free(green_channel[i]);
-        free(blue_channel[i]);
+    coeff_header header;
+    header.width = width;
+    header.height = height;
+    header.channels = 3;
+    header.block_size = block_size;
+    header.coding = COEFF_CODING_RAW;
+    header.index_interval = 0;
+    quant_table quant;
+    quant_table_for_quality(base_quantization_matrix, quality, &quant);
+    quant_table_for_size((const int (*)[QUANT_BASE_SIZE])quant.table, block_size, header.table);
+
+    FILE *file = fopen("quantized.dctc", "wb");
+    if (file == NULL) {
+        printf("Error opening file quantized.dctc!\n");
+        return 1;
+    }
+    short *quantized = (short *)malloc(coeff_channel_size(&header) * sizeof(short));
+    const plane_u8 *planes[3] = {&red_channel, &green_channel, &blue_channel};
+    const char *text_names[3] = {"quantized_red.txt", "quantized_green.txt", "quantized_blue.txt"};
+    const char *channel_names[3] = {"red", "green", "blue"};
+    int written = coeff_write_header(file, &header);
+    for (int c = 0; c < 3; c++) {
+        double psnr = process_channel(planes[c], block_size, header.table, quantized);
+        printf("%s: %dx%d blocks, reconstructed at PSNR %.2f dB\n", channel_names[c], block_size, block_size, psnr);
+        written = written && coeff_write_channel(file, &header, quantized);
+        if (text_output) write_text_channel(&header, quantized, text_names[c]);
+    }
+    fclose(file);
+    free(quantized);
+    if (!written) {
+        printf("Error writing quantized.dctc\n");
+        return 1;
     }
-    free(image_matrix);
-    free(red_channel);
-    free(green_channel);
-    free(blue_channel);
 
-    for (int i = 0; i < ROWS; i++) {
-        free(quantization_matrix[i]);
+    if (jpeg_name != NULL && !write_jpeg(jpeg_name, &red_channel, &green_channel, &blue_channel, quality,
+                                         restart_interval, optimize_tables)) {
+        printf("Error writing %s\n", jpeg_name);
+        return 1;
     }
-    free(quantization_matrix);
+
+    plane_u8_free(&image_matrix);
+    plane_u8_free(&red_channel);
+    plane_u8_free(&green_channel);
+    plane_u8_free(&blue_channel);
 
     stbi_image_free(image_data);
 
@@ -1,6 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
+#define DCT_TRANSFORM_IMPLEMENTATION
+#include "dct_transform.h"
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+#define COEFF_FILE_IMPLEMENTATION
+#include "coeff_file.h"
+#define RLE_IMPLEMENTATION
+#include "rle.h"
+#define HUFFMAN_IMPLEMENTATION
+#include "huffman.h"
+#define RANS_IMPLEMENTATION
+#include "rans.h"
+#define ARITH_IMPLEMENTATION
+#include "arith.h"
+#define DC_PREDICT_IMPLEMENTATION
+#include "dc_predict.h"
+#define COEFF_DECODER_IMPLEMENTATION
+#include "coeff_decoder.h"
+#define PLANE_IMPLEMENTATION
+#include "plane.h"
 #include "stb_image.h"
 #define STB_IMAGE_IMPLEMENTATION
 #define ROWS 1920
@@ -8011,159 +8033,301 @@ int base_quantization_matrix[BLOCK_SIZE][BLOCK_SIZE] = {
     {72, 92, 95, 98, 112, 100, 103, 99}
 };
 
-// Function to compute the DCT of an 8x8 block
-void dct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int u = 0; u < BLOCK_SIZE; u++) {
-        for (int v = 0; v < BLOCK_SIZE; v++) {
-            double sum = 0.0;
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    sum += input[x][y] * cos(((2 * x + 1) * u * m_pi) / (2.0 * BLOCK_SIZE)) *
-                                               cos(((2 * y + 1) * v * m_pi) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            output[u][v] = 0.25 * cu * cv * sum;
-        }
-    }
-}
-
-// Dynamically generate the quantization matrix
-void generate_quantization_matrix(int **quantization_matrix) {
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            quantization_matrix[i][j] = base_quantization_matrix[i % BLOCK_SIZE][j % BLOCK_SIZE];
-        }
+// Create a plane for the image channels, rows padded to whole blocks
+void create_matrix(plane_u8 *matrix, int height, int width, int channels) {
+    if (!plane_u8_create(matrix, width * channels, height, BLOCK_SIZE)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
 }
 
-// Quantize using the generated quantization matrix
-void quantize(double **dct_matrix, int **quantization_matrix, double **result) {
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            result[i][j] = round(dct_matrix[i][j] / quantization_matrix[i][j]);
-        }
+// Populate the matrix from image data
+void populate_matrix(plane_u8 *matrix, unsigned char *image_data, int width, int height, int channels) {
+    for (int i = 0; i < height; i++) {
+        memcpy(plane_u8_row(matrix, i), image_data + (size_t)i * width * channels, (size_t)width * channels);
     }
 }
-
-// Create a matrix for the image channels
-unsigned char** create_matrix(int height, int width, int channels) {
-    unsigned char **matrix = (unsigned char**)malloc(height * sizeof(unsigned char*));
-    if (matrix == NULL) {
+// Pack a channel of 8x8 blocks into the sparse block format of coeff_file.h
+// (occupancy mask plus int8/int16 values per block), check that it unpacks
+// to the same coefficients and append it, after its index if the file has one,
+// to the sparse container
+size_t write_sparse_channel(FILE *file, const coeff_header *header, const short *quantized, short *unpacked) {
+    clock_t start = clock();
+    unsigned char *data;
+    size_t size = coeff_pack_sparse(header, quantized, &data);
+    double pack_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (size == 0) {
         printf("Memory allocation failed!\n");
         exit(1);
     }
 
-    for (int i = 0; i < height; i++) {
-        matrix[i] = (unsigned char*)malloc(width * channels * sizeof(unsigned char));
-        if (matrix[i] == NULL) {
+    start = clock();
+    int ok = coeff_unpack_sparse(header, data, size, unpacked);
+    double unpack_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    ok = ok && memcmp(unpacked, quantized, coeff_channel_size(header) * sizeof(short)) == 0;
+    printf("sparse: %zu bytes (%.3f bits/pixel), packed in %.1f ms, unpacked in %.1f ms%s\n", size,
+           size * 8.0 / ((double)header->width * header->height), pack_seconds * 1000.0, unpack_seconds * 1000.0,
+           ok ? "" : ", SPARSE MISMATCH");
+    int written = 1;
+    int segments = coeff_index_segments(header);
+    if (segments > 0) {
+        unsigned long *offsets = (unsigned long *)malloc((size_t)segments * sizeof(unsigned long));
+        if (offsets == NULL) {
             printf("Memory allocation failed!\n");
             exit(1);
         }
+        written = coeff_sparse_index(header, data, size, offsets) && coeff_write_index(file, offsets, segments);
+        free(offsets);
     }
-    return matrix;
-}
+    written = written && coeff_write_scan(file, data, size);
+    free(data);
+    return written ? size : 0;
+}
+
+// Dequantize and inverse transform a quantized channel back to samples and
+// return its PSNR against the samples it was coded from. This is the only
+// reconstruction for block sizes other than 8, which coeff_decoder.h
+// does not read.
+double reconstruct_channel(const plane *samples, int block_size, const int *block_table, const short *quantized,
+                           size_t blocks) {
+    double *dequantized = (double *)malloc(blocks * block_size * block_size * sizeof(double));
+    plane reconstructed;
+    if (dequantized == NULL || !plane_create(&reconstructed, COLS, ROWS, block_size)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    dequantize_blocks(block_size, quantized, blocks, block_table, dequantized);
+    inverse_dct_plane_n(block_size, dequantized, COLS, ROWS, reconstructed.data, reconstructed.stride);
 
-// Populate the matrix from image data
-void populate_matrix(unsigned char **matrix, unsigned char *image_data, int width, int height, int channels) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int index = (i * width + j) * channels;
-            for (int c = 0; c < channels; c++) {
-                matrix[i][j * channels + c] = image_data[index + c];
-            }
+    double squared_error = 0.0;
+    for (int i = 0; i < ROWS; i++) {
+        const double *original = plane_row(samples, i);
+        const double *decoded = plane_row(&reconstructed, i);
+        for (int j = 0; j < COLS; j++) {
+            double value = round(decoded[j]);
+            value = value < 0.0 ? 0.0 : value > 255.0 ? 255.0 : value;
+            squared_error += (value - original[j]) * (value - original[j]);
         }
     }
-}
-// Function to write sparse matrix to a file
-void write_sparse_matrix(double **quantized_matrix, const char *filename) {
-    FILE *file = fopen(filename, "w");
-    
-    if (file == NULL) {
-        printf("Error opening file %s!\n", filename);
+    free(dequantized);
+    plane_free(&reconstructed);
+    return 10.0 * log10(255.0 * 255.0 / (squared_error / ((double)ROWS * COLS) + 1e-12));
+}
+
+// DCT and quantization for each color channel, into block-major int16.
+// Returns the PSNR of the channel reconstructed from it.
+double process_channel(const plane_u8 *channel_matrix, int block_size, const int *block_table, short *quantized) {
+    int blocks_x = (COLS + block_size - 1) / block_size;
+    int blocks_y = (ROWS + block_size - 1) / block_size;
+    size_t blocks = (size_t)blocks_x * blocks_y;
+    plane samples;
+    if (!plane_create(&samples, COLS, ROWS, block_size)) {
+        printf("Memory allocation failed!\n");
         exit(1);
     }
-
-    // Iterate through the matrix and write non-zero entries to the file
     for (int i = 0; i < ROWS; i++) {
+        const unsigned char *in = plane_u8_row(channel_matrix, i);
+        double *out = plane_row(&samples, i);
         for (int j = 0; j < COLS; j++) {
-            if (quantized_matrix[i][j] != 0.0) {
-                // Write the position (i, j) and value to the file
-                fprintf(file, "%d %d %5.1f\n", i, j, quantized_matrix[i][j]);
-            }
+            out[j] = (double)in[j];
         }
     }
 
-    fclose(file);
+    if (block_size == BLOCK_SIZE) {
+        forward_dct_quantize_plane(samples.data, samples.stride, COLS, ROWS, block_table, quantized);
+    } else {
+        double *coefficients = (double *)malloc(blocks * block_size * block_size * sizeof(double));
+        forward_dct_plane_n(block_size, samples.data, samples.stride, COLS, ROWS, coefficients);
+        quantize_blocks(block_size, coefficients, blocks, block_table, quantized);
+        free(coefficients);
+    }
+    double psnr = reconstruct_channel(&samples, block_size, block_table, quantized, blocks);
+    plane_free(&samples);
+    return psnr;
 }
 
-// Updated process_channel to include sparse matrix compression
-void process_channel(unsigned char **channel_matrix, int **quantization_matrix, const char *quant_filename, const char *sparse_filename) {
-    FILE *file = fopen(quant_filename, "w");
+// Debug conversion of one channel back to the "%5.1f\t" text dump
+void write_text_channel(const coeff_header *header, const short *quantized, const char *filename) {
+    FILE *file = fopen(filename, "w");
 
     if (file == NULL) {
-        printf("Error opening file %s!\n", quant_filename);
+        printf("Error opening file %s!\n", filename);
         exit(1);
     }
+    coeff_write_text(file, header, quantized);
+    fclose(file);
+}
 
-    double **dct_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **quantized_matrix = (double **)malloc(ROWS * sizeof(double *));
-    for (int i = 0; i < ROWS; i++) {
-        dct_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        quantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
+// DC prediction of each indexed segment of interval block rows on its own,
+// of the whole channel when interval is 0
+void predict_dc_segments(short *quantized, int blocks_x, int blocks_y, int interval, int mode) {
+    int rows = interval > 0 ? interval : blocks_y;
+    for (int by = 0; by < blocks_y; by += rows) {
+        int count = blocks_y - by < rows ? blocks_y - by : rows;
+        dc_predict_forward(quantized + (size_t)by * blocks_x * RLE_BLOCK, blocks_x, count, mode);
     }
+}
 
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            dct_matrix[i][j] = (double)channel_matrix[i][j];
-        }
+// Huffman code a channel of 8x8 blocks with the Annex K luminance tables, or
+// with tables built from its own symbol histogram when optimize is set. The
+// tables used go to dc_table and ac_table; returns the scan size. DC is
+// coded as it is in block[0], already predicted with dc_predict.h. With
+// segment_blocks the scan is byte-aligned every that many blocks and the
+// offset of each segment goes to offsets (the coeff_file.h index).
+size_t huffman_code_channel(const short *quantized, size_t blocks, int optimize, huff_spec *dc_table,
+                            huff_spec *ac_table, size_t segment_blocks, unsigned long *offsets, unsigned char **scan) {
+    if (optimize) {
+        long dc_freq[HUFF_FREQ_SIZE] = {0};
+        long ac_freq[HUFF_FREQ_SIZE] = {0};
+        huff_count_blocks(quantized, blocks, NULL, dc_freq, ac_freq);
+        huff_build_spec(dc_freq, dc_table);
+        huff_build_spec(ac_freq, ac_table);
+    } else {
+        *dc_table = huff_dc_luminance;
+        *ac_table = huff_ac_luminance;
     }
-
-    double dct_block[BLOCK_SIZE][BLOCK_SIZE];
-    for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
-        for (int j = 0; j < COLS; j += BLOCK_SIZE) {
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_block[x][y] = dct_matrix[i + x][j + y];
-                }
-            }
-
-            double dct_output[BLOCK_SIZE][BLOCK_SIZE];
-            dct(dct_block, dct_output);
-
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_matrix[i + x][j + y] = dct_output[x][y];
-                }
-            }
-        }
+    huff_code dc_code, ac_code;
+    huff_build_code(dc_table, &dc_code);
+    huff_build_code(ac_table, &ac_code);
+
+    bit_writer writer;
+    bit_writer_init(&writer);
+    size_t step = segment_blocks > 0 ? segment_blocks : blocks;
+    for (size_t start = 0; start < blocks; start += step) {
+        if (offsets != NULL) offsets[start / step] = (unsigned long)writer.size;
+        huff_encode_blocks(&writer, quantized + start * RLE_BLOCK, blocks - start < step ? blocks - start : step,
+                           &dc_code, &ac_code, NULL);
+        bit_writer_finish(&writer);
+    }
+    *scan = writer.buffer;
+    return writer.size;
+}
+
+// Decode a Huffman scan of a channel straight to pixels, one block row at a
+// time: decode the row, undo its DC prediction, then dequantize and inverse
+// transform each block while the row is still in cache. DC-only blocks (most
+// of them at normal qualities) are a constant fill. The decoded coefficients
+// go to quantized, the samples to pixels (blocks_x * 8 per row). An indexed
+// scan restarts the reader and the prediction at every segment of interval
+// block rows. 0 on a corrupt scan, including one that does not end exactly
+// where its last block does.
+int decode_huffman_channel(const unsigned char *scan, size_t size, const huff_spec *dc_table, const huff_spec *ac_table,
+                           int dc_mode, int interval, const unsigned long *offsets, const int *table, int blocks_x,
+                           int blocks_y, short *quantized, unsigned char *pixels) {
+    huff_decoder *dc = (huff_decoder *)malloc(sizeof(huff_decoder));
+    huff_decoder *ac = (huff_decoder *)malloc(sizeof(huff_decoder));
+    unsigned char *last = (unsigned char *)malloc((size_t)blocks_x);
+    if (dc == NULL || ac == NULL || last == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    if (!huff_build_decoder(dc_table, dc) || !huff_build_decoder(ac_table, ac)) {
+        free(dc);
+        free(ac);
+        free(last);
+        return 0;
     }
 
-    quantize(dct_matrix, quantization_matrix, quantized_matrix);
+    huff_reader reader;
+    size_t stride = (size_t)blocks_x * BLOCK_SIZE;
+    int rows = interval > 0 ? interval : blocks_y;
+    int segments = (blocks_y + rows - 1) / rows;
+    int ok = 1;
+    for (int by = 0; ok && by < blocks_y; by++) {
+        int segment = by / rows;
+        short *first = quantized + (size_t)segment * rows * blocks_x * RLE_BLOCK;
+        if (by % rows == 0) {
+            size_t start = offsets != NULL ? offsets[segment] : 0;
+            size_t end = offsets != NULL && segment + 1 < segments ? offsets[segment + 1] : size;
+            huff_reader_init(&reader, scan + start, end - start);
+        }
+        short *row = quantized + (size_t)by * blocks_x * RLE_BLOCK;
+        for (int bx = 0; ok && bx < blocks_x; bx++) {
+            int end = huff_decode_block(&reader, dc, ac, NULL, row + bx * RLE_BLOCK);
+            last[bx] = (unsigned char)end;
+            ok = end != 0;
+        }
+        if (ok && (by % rows == rows - 1 || by == blocks_y - 1)) ok = huff_reader_finished(&reader);
+        if (!ok) break;
+        dc_predict_inverse_row(first, blocks_x, by % rows, dc_mode);
 
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            fprintf(file, "%5.1f\t", quantized_matrix[i][j]);
+        for (int bx = 0; bx < blocks_x; bx++) {
+            unsigned char *out = pixels + (size_t)by * BLOCK_SIZE * stride + bx * BLOCK_SIZE;
+            coeff_decoder_block_pixels(row + bx * RLE_BLOCK, table, last[bx] == 1, out, stride);
         }
-        fprintf(file, "\n");
     }
-
-    fclose(file);
-
-    // Write the sparse matrix representation
-    write_sparse_matrix(quantized_matrix, sparse_filename);
-
-    // Free the matrices
-    for (int i = 0; i < ROWS; i++) {
-        free(dct_matrix[i]);
-        free(quantized_matrix[i]);
+    free(dc);
+    free(ac);
+    free(last);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    // Optional "-e table|aan|fixed|simd" selects the DCT engine, "-b 4|8|16|32" the
+    // block size, "-q 1..100" the quality the quantization table is scaled to,
+    // "-t" also writes the quantized_*.txt text dumps, "-O" builds optimal
+    // Huffman tables per channel instead of using the Annex K ones, "-R 4..32"
+    // codes with interleaved rANS over that many states instead of Huffman and
+    // "-A" with the context-adaptive arithmetic coder. "-P previous|left|top|median"
+    // fixes the DC predictor for the entropy coders, "-P auto" (default) picks
+    // the cheapest one per channel. "-I n" indexes sparse.dctc and a Huffman
+    // coded.dctc every n block rows, for decoders that read a window
+    int block_size = BLOCK_SIZE;
+    int quality = 50;
+    int text_output = 0;
+    int optimize_tables = 0;
+    int rans_lanes = 0;
+    int arith_coding = 0;
+    int dc_mode = -1;
+    int index_interval = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            if (!dct_select_engine(argv[++i])) {
+                printf("Unknown DCT engine %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            block_size = atoi(argv[++i]);
+            if (!dct_block_size_supported(block_size)) {
+                printf("Unsupported block size %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            quality = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            text_output = 1;
+        } else if (strcmp(argv[i], "-O") == 0) {
+            optimize_tables = 1;
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            rans_lanes = atoi(argv[++i]);
+            if (rans_lanes < RANS_MIN_LANES || rans_lanes > RANS_MAX_LANES) {
+                printf("rANS needs %d to %d states\n", RANS_MIN_LANES, RANS_MAX_LANES);
+                return 1;
+            }
+            arith_coding = 0;
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            i++;
+            dc_mode = -2;
+            if (strcmp(argv[i], "auto") == 0) dc_mode = -1;
+            for (int mode = 0; mode < DC_PREDICT_MODES; mode++) {
+                if (strcmp(argv[i], dc_predict_names[mode]) == 0) dc_mode = mode;
+            }
+            if (dc_mode == -2) {
+                printf("Unknown DC predictor %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-A") == 0) {
+            arith_coding = 1;
+            rans_lanes = 0;
+        } else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+            index_interval = atoi(argv[++i]);
+            if (index_interval < 1 || index_interval > 65535) {
+                printf("Index interval must be 1 to 65535 block rows\n");
+                return 1;
+            }
+        }
     }
-    free(dct_matrix);
-    free(quantized_matrix);
-}
 
-int main() {
     int width, height, channels;
 
     // Load the image
@@ -8178,50 +8342,271 @@ int main() {
     width = COLS;
 
     // Create and populate the matrix
-    unsigned char **image_matrix = create_matrix(height, width, channels);
-    populate_matrix(image_matrix, image_data, width, height, channels);
-
-    // Allocate and generate quantization matrix
-    int **quantization_matrix = (int **)malloc(ROWS * sizeof(int *));
-    for (int i = 0; i < ROWS; i++) {
-        quantization_matrix[i] = (int *)malloc(COLS * sizeof(int));
-    }
-    generate_quantization_matrix(quantization_matrix);
+    plane_u8 image_matrix;
+    create_matrix(&image_matrix, height, width, channels);
+    populate_matrix(&image_matrix, image_data, width, height, channels);
 
     // Separate channels and process each
-    unsigned char **red_channel = create_matrix(height, width, 1);
-    unsigned char **green_channel = create_matrix(height, width, 1);
-    unsigned char **blue_channel = create_matrix(height, width, 1);
+    plane_u8 red_channel, green_channel, blue_channel;
+    create_matrix(&red_channel, height, width, 1);
+    create_matrix(&green_channel, height, width, 1);
+    create_matrix(&blue_channel, height, width, 1);
 
     for (int i = 0; i < height; i++) {
+        const unsigned char *pixel = plane_u8_row(&image_matrix, i);
+        unsigned char *red = plane_u8_row(&red_channel, i);
+        unsigned char *green = plane_u8_row(&green_channel, i);
+        unsigned char *blue = plane_u8_row(&blue_channel, i);
         for (int j = 0; j < width; j++) {
-            red_channel[i][j] = image_matrix[i][j * channels];
-            green_channel[i][j] = image_matrix[i][j * channels + 1];
-            blue_channel[i][j] = image_matrix[i][j * channels + 2];
+            red[j] = pixel[j * channels];
+            green[j] = pixel[j * channels + 1];
+            blue[j] = pixel[j * channels + 2];
         }
     }
 
-    // Process each channel and create quantized and sparse matrix files
-    process_channel(red_channel, quantization_matrix, "quantized_red.txt", "sparse_red.txt");
-    process_channel(green_channel, quantization_matrix, "quantized_green.txt", "sparse_green.txt");
-    process_channel(blue_channel, quantization_matrix, "quantized_blue.txt", "sparse_blue.txt");
+    coeff_header header;
+    header.width = width;
+    header.height = height;
+    header.channels = 3;
+    header.block_size = block_size;
+    header.coding = COEFF_CODING_RAW;
+    header.index_interval = 0;
+    quant_table quant;
+    quant_table_for_quality(base_quantization_matrix, quality, &quant);
+    quant_table_for_size((const int (*)[QUANT_BASE_SIZE])quant.table, block_size, header.table);
+    coeff_header coded = header;
+    coded.coding = arith_coding ? COEFF_CODING_ARITH : rans_lanes ? COEFF_CODING_RANS : COEFF_CODING_HUFFMAN;
+    coded.rans_lanes = rans_lanes;
+    // rANS and arithmetic scans run over the whole channel and take no index
+    coded.index_interval = coded.coding == COEFF_CODING_HUFFMAN ? index_interval : 0;
+    if (index_interval > 0 && coded.index_interval == 0) printf("coded.dctc: no index for rANS or arithmetic coding\n");
+
+    // Process each channel into the coefficient file and, for 8x8 blocks, the sparse one
+    FILE *file = fopen("quantized.dctc", "wb");
+    if (file == NULL) {
+        printf("Error opening file quantized.dctc!\n");
+        return 1;
+    }
+    coeff_header sparse = header;
+    sparse.coding = COEFF_CODING_SPARSE;
+    sparse.index_interval = index_interval;
+    FILE *sparse_file = NULL;
+    if (block_size == BLOCK_SIZE) {
+        sparse_file = fopen("sparse.dctc", "wb");
+        if (sparse_file == NULL) {
+            printf("Error opening file sparse.dctc!\n");
+            return 1;
+        }
+    }
+    short *quantized = (short *)malloc(coeff_channel_size(&header) * sizeof(short));
+    if (quantized == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    size_t blocks = coeff_channel_size(&header) / RLE_BLOCK;
+    int blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    rle_pair *pairs = NULL;
+    short *predicted = NULL;
+    unsigned char *scans[3];
+    size_t scan_sizes[3];
+    int segments = coeff_index_segments(&coded);
+    unsigned long *indexes[3] = {NULL, NULL, NULL};
+    if (segments > 0 && block_size == BLOCK_SIZE) {
+        for (int c = 0; c < 3; c++) {
+            indexes[c] = (unsigned long *)malloc((size_t)segments * sizeof(unsigned long));
+            if (indexes[c] == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+        }
+    }
+    if (block_size == BLOCK_SIZE) {
+        pairs = (rle_pair *)malloc(blocks * RLE_MAX_PAIRS * sizeof(rle_pair));
+        predicted = (short *)malloc(blocks * RLE_BLOCK * sizeof(short));
+        if (pairs == NULL || predicted == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+    const plane_u8 *planes[3] = {&red_channel, &green_channel, &blue_channel};
+    const char *text_names[3] = {"quantized_red.txt", "quantized_green.txt", "quantized_blue.txt"};
+    const char *channel_names[3] = {"red", "green", "blue"};
+    int written = coeff_write_header(file, &header);
+    int sparse_written = sparse_file == NULL || coeff_write_header(sparse_file, &sparse);
+    for (int c = 0; c < 3; c++) {
+        double psnr = process_channel(planes[c], block_size, header.table, quantized);
+        printf("%s: %dx%d blocks, reconstructed at PSNR %.2f dB\n", channel_names[c], block_size, block_size, psnr);
+        written = written && coeff_write_channel(file, &header, quantized);
+        if (text_output) write_text_channel(&header, quantized, text_names[c]);
+        if (sparse_file != NULL) {
+            printf("%s ", channel_names[c]);
+            sparse_written = sparse_written && write_sparse_channel(sparse_file, &sparse, quantized, predicted) > 0;
+        }
 
-    // Free memory
-    for (int i = 0; i < height; i++) {
-        free(image_matrix[i]);
-        free(red_channel[i]);
-        free(green_channel[i]);
-        free(blue_channel[i]);
+        // Zigzag (run, level) pairs of the AC coefficients, 8x8 blocks only
+        if (pairs != NULL) {
+            size_t count = rle_encode_blocks(quantized, blocks, pairs);
+            printf("%s: %zu run/level pairs for %zu AC coefficients\n", channel_names[c], count, blocks * (RLE_BLOCK - 1));
+
+            // The entropy coders see DC as the residual of the channel's predictor
+            clock_t start = clock();
+            int mode = dc_mode < 0 ? dc_predict_choose(quantized, blocks_x, blocks_y) : dc_mode;
+            memcpy(predicted, quantized, blocks * RLE_BLOCK * sizeof(short));
+            predict_dc_segments(predicted, blocks_x, blocks_y, coded.index_interval, mode);
+            double predict_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+            coded.dc_predictor[c] = mode;
+            printf("%s: DC predictor %s, about %ld DC bits (%ld with the previous block), %.2f ms\n", channel_names[c],
+                   dc_predict_names[mode], dc_predict_cost(quantized, blocks_x, blocks_y, mode),
+                   dc_predict_cost(quantized, blocks_x, blocks_y, DC_PREDICT_PREVIOUS), predict_seconds * 1000.0);
+
+            if (arith_coding) {
+                // Against Huffman with optimal tables on the same blocks; MB/s
+                // counts one byte per pixel of the channel
+                double pixels = (double)width * height;
+                huff_spec dc_table, ac_table;
+                unsigned char *huffman_scan;
+                start = clock();
+                size_t huffman_size = huffman_code_channel(predicted, blocks, 1, &dc_table, &ac_table, 0, NULL, &huffman_scan);
+                double huffman_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+                free(huffman_scan);
+
+                start = clock();
+                scan_sizes[c] = arith_encode_blocks(predicted, blocks_x, blocks_y, &scans[c]);
+                double encode_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+                if (scan_sizes[c] == 0) {
+                    printf("Error arithmetic coding channel %s\n", channel_names[c]);
+                    return 1;
+                }
+                short *decoded = (short *)malloc(blocks * RLE_BLOCK * sizeof(short));
+                if (decoded == NULL) {
+                    printf("Memory allocation failed!\n");
+                    exit(1);
+                }
+                start = clock();
+                int decoded_ok = arith_decode_blocks(scans[c], scan_sizes[c], blocks_x, blocks_y, decoded);
+                dc_predict_inverse(decoded, blocks_x, blocks_y, mode);
+                double decode_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+                decoded_ok = decoded_ok && memcmp(decoded, quantized, blocks * RLE_BLOCK * sizeof(short)) == 0;
+                free(decoded);
+                printf("%s: %zu bytes arithmetic coded, %.3f bits/pixel (Huffman %.3f), encode %.1f MB/s "
+                       "(Huffman %.1f MB/s), decode %.1f MB/s%s\n",
+                       channel_names[c], scan_sizes[c], 8.0 * scan_sizes[c] / pixels, 8.0 * huffman_size / pixels,
+                       pixels / encode_seconds / 1e6, pixels / huffman_seconds / 1e6, pixels / decode_seconds / 1e6,
+                       decoded_ok ? "" : ", DECODE MISMATCH");
+                continue;
+            }
+
+            if (rans_lanes) {
+                // Static model from this channel's tokens, then check it decodes back
+                start = clock();
+                scan_sizes[c] = rans_encode_blocks(predicted, blocks, rans_lanes, coded.rans_dc_freq[c],
+                                                   coded.rans_ac_freq[c], &scans[c]);
+                double encode_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+                if (scan_sizes[c] == 0) {
+                    printf("Error rANS coding channel %s\n", channel_names[c]);
+                    return 1;
+                }
+                short *decoded = (short *)malloc(blocks * RLE_BLOCK * sizeof(short));
+                if (decoded == NULL) {
+                    printf("Memory allocation failed!\n");
+                    exit(1);
+                }
+                start = clock();
+                int decoded_ok = rans_decode_blocks(scans[c], scan_sizes[c], coded.rans_dc_freq[c], coded.rans_ac_freq[c],
+                                                     rans_lanes, blocks, decoded);
+                dc_predict_inverse(decoded, blocks_x, blocks_y, mode);
+                double decode_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+                decoded_ok = decoded_ok && memcmp(decoded, quantized, blocks * RLE_BLOCK * sizeof(short)) == 0;
+                free(decoded);
+                printf("%s: %zu bytes rANS coded (%d states), %.3f bits/pixel, encode %.1f ms, decode %.1f ms%s\n",
+                       channel_names[c], scan_sizes[c], rans_lanes, 8.0 * scan_sizes[c] / ((double)width * height),
+                       encode_seconds * 1000.0, decode_seconds * 1000.0, decoded_ok ? "" : ", DECODE MISMATCH");
+                continue;
+            }
+
+            start = clock();
+            scan_sizes[c] = huffman_code_channel(predicted, blocks, optimize_tables, &coded.dc_table[c], &coded.ac_table[c],
+                                                 (size_t)coded.index_interval * blocks_x, indexes[c], &scans[c]);
+            double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+            printf("%s: %zu bytes Huffman coded, %.3f bits/pixel, %.1f ms\n", channel_names[c], scan_sizes[c],
+                   8.0 * scan_sizes[c] / ((double)width * height), seconds * 1000.0);
+
+            // Decode it back to pixels and check against the coefficients and the source
+            short *decoded = (short *)malloc(blocks * RLE_BLOCK * sizeof(short));
+            unsigned char *pixels = (unsigned char *)malloc(blocks * RLE_BLOCK);
+            if (decoded == NULL || pixels == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+            // First pass faults the buffers in; the second is what a reader decoding
+            // frame after frame into the same buffers would see
+            decode_huffman_channel(scans[c], scan_sizes[c], &coded.dc_table[c], &coded.ac_table[c], mode,
+                                   coded.index_interval, indexes[c], header.table, blocks_x, blocks_y, decoded, pixels);
+            start = clock();
+            int decoded_ok = decode_huffman_channel(scans[c], scan_sizes[c], &coded.dc_table[c], &coded.ac_table[c], mode,
+                                                    coded.index_interval, indexes[c], header.table, blocks_x, blocks_y,
+                                                    decoded, pixels);
+            seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+            decoded_ok = decoded_ok && memcmp(decoded, quantized, blocks * RLE_BLOCK * sizeof(short)) == 0;
+            double squared_error = 0.0;
+            for (int i = 0; i < height; i++) {
+                const unsigned char *original = plane_u8_row(planes[c], i);
+                for (int j = 0; j < width; j++) {
+                    double d = (double)pixels[(size_t)i * blocks_x * BLOCK_SIZE + j] - original[j];
+                    squared_error += d * d;
+                }
+            }
+            double psnr = 10.0 * log10(255.0 * 255.0 / (squared_error / ((double)width * height) + 1e-12));
+            printf("%s: decoded to pixels in %.1f ms (%.0f MB/s), PSNR %.2f dB%s\n", channel_names[c], seconds * 1000.0,
+                   (double)width * height / seconds / 1e6, psnr, decoded_ok ? "" : ", DECODE MISMATCH");
+            free(decoded);
+            free(pixels);
+        }
+    }
+    fclose(file);
+    free(quantized);
+    if (!written) {
+        printf("Error writing quantized.dctc\n");
+        return 1;
+    }
+    if (sparse_file != NULL) {
+        fclose(sparse_file);
+        if (!sparse_written) {
+            printf("Error writing sparse.dctc\n");
+            return 1;
+        }
     }
-    free(image_matrix);
-    free(red_channel);
-    free(green_channel);
-    free(blue_channel);
 
-    for (int i = 0; i < ROWS; i++) {
-        free(quantization_matrix[i]);
+    // Entropy-coded container: the tables go in the header, so it is written
+    // once every channel has been coded
+    if (pairs != NULL) {
+        free(pairs);
+        free(predicted);
+        file = fopen("coded.dctc", "wb");
+        if (file == NULL) {
+            printf("Error opening file coded.dctc!\n");
+            return 1;
+        }
+        written = coeff_write_header(file, &coded);
+        for (int c = 0; c < 3; c++) {
+            if (segments > 0) written = written && coeff_write_index(file, indexes[c], segments);
+            written = written && coeff_write_scan(file, scans[c], scan_sizes[c]);
+            free(scans[c]);
+            free(indexes[c]);
+        }
+        fclose(file);
+        if (!written) {
+            printf("Error writing coded.dctc\n");
+            return 1;
+        }
     }
-    free(quantization_matrix);
+
+    // Free memory
+    plane_u8_free(&image_matrix);
+    plane_u8_free(&red_channel);
+    plane_u8_free(&green_channel);
+    plane_u8_free(&blue_channel);
 
     stbi_image_free(image_data);
 
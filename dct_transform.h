@@ -0,0 +1,1453 @@
+/* dct_transform.h - 8x8 forward / inverse DCT shared by the compressor programs
+
+   Do this:
+      #define DCT_TRANSFORM_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   dct() and idct() are separable: a 1-D pass over the rows followed by a
+   1-D pass over the columns, both reading the same precomputed 8x8 basis
+   table, so no cos()/sqrt() is evaluated per block. dct_reference() and
+   idct_reference() keep the original direct 4-deep-loop definition so the
+   fast paths can be checked against it.
+
+   Fast engines:
+      dct_aan() / idct_aan()      Arai-Agui-Nakajima factorisation in double,
+                                  5 multiplies per 1-D pass plus one scale
+                                  multiply per coefficient
+      dct_int() / idct_int()      Loeffler-Ligtenberg-Moschytz factorisation
+                                  in 32-bit fixed point (13 fraction bits),
+                                  12 multiplies per 1-D pass; coefficients fit
+                                  in 16 bits
+      dct_fixed() / idct_fixed()  double-in/double-out wrappers around the
+                                  integer kernels
+
+      dct_avx2() / idct_avx2()    AAN on a whole block held in eight 8-lane
+      dct_sse2() / idct_sse2()    float registers (two 4-lane halves for
+                                  SSE2), with an in-register transpose
+                                  between the column and row passes
+
+   The block loops call through dct_forward / dct_inverse, which default to
+   the table engine and are switched at runtime with dct_select_engine(),
+   e.g. from a "-e aan" command line option. "-e simd" checks cpuid once and
+   takes the widest kernel this machine supports, falling back to dct_aan(),
+   so one binary runs on every x86 generation. The SIMD kernels are built
+   with per-function target attributes, no -mavx2 is needed; define
+   DCT_NO_SIMD to leave them out.
+
+   forward_dct_plane() / inverse_dct_plane() transform every block of a
+   channel in one call with the selected engine, writing / reading
+   block-major coefficients; with AVX2 two blocks are interleaved per
+   loop iteration.
+
+   Scaled decoding: idct_int_pixels_4x4(), _2x2() and _1x1() turn a block
+   straight into 4x4, 2x2 or 1x1 pixels (1/2, 1/4 and 1/8 scale) with an
+   orthonormal 4-, 2- or 1-point inverse DCT of its low-frequency 4x4, 2x2
+   or DC coefficients, scaled so a flat block keeps its level. The rest of
+   the block is never read, which is what makes thumbnails cheap.
+*/
+#ifndef DCT_TRANSFORM_H
+#define DCT_TRANSFORM_H
+
+#define DCT_SIZE 8
+
+typedef enum {
+    DCT_ENGINE_TABLE = 0,
+    DCT_ENGINE_AAN,
+    DCT_ENGINE_FIXED,
+    DCT_ENGINE_SIMD
+} dct_engine;
+
+#define DCT_CPU_SSE2 1
+#define DCT_CPU_AVX2 2
+
+typedef void (*dct_block_fn)(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+
+extern dct_block_fn dct_forward;
+extern dct_block_fn dct_inverse;
+
+void dct(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+void idct(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+
+void dct_reference(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+void idct_reference(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+
+void dct_aan(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+void idct_aan(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+
+// In place. dct_int() takes 0..255 samples and leaves coefficients scaled by 8
+// (3 extra fraction bits); idct_int() takes true coefficients and leaves samples.
+void dct_int(int block[DCT_SIZE][DCT_SIZE]);
+void idct_int(int block[DCT_SIZE][DCT_SIZE]);
+// idct_int() straight to 8-bit pixels for decoders: dequantized coefficients
+// in natural order in, samples clamped to 0..255 written 8 per row `stride`
+// bytes apart. 16-bit SSE2 kernel when it is compiled in and the CPU has it.
+void idct_int_pixels(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride);
+// Same input, N x N pixels out from the top-left N x N coefficients only
+void idct_int_pixels_4x4(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride);
+void idct_int_pixels_2x2(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride);
+void idct_int_pixels_1x1(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride);
+
+void dct_fixed(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+void idct_fixed(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+
+// Looks at which coefficients are nonzero: DC-only blocks are a constant
+// fill, support inside the top-left 4x4 runs a reduced separable kernel,
+// anything else goes to dct_inverse.
+void idct_sparse(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+
+// Only defined when the SIMD kernels are compiled in (x86, no DCT_NO_SIMD)
+void dct_sse2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+void idct_sse2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+void dct_avx2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+void idct_avx2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]);
+
+// Bitmask of DCT_CPU_* flags for the running machine, detected once
+int dct_cpu_features(void);
+
+// Transform a whole plane in one call. src is row-major with `stride`
+// elements per row; coefficients go to dst block-major, one contiguous run
+// of 64 per 8x8 block, blocks in raster order, so dst needs
+// ceil(width/8) * ceil(height/8) * 64 doubles. Partial edge blocks are
+// padded by repeating the last row/column.
+void forward_dct_plane(const double *src, int stride, int width, int height, double *dst);
+// Inverse of forward_dct_plane(): block-major coefficients in, row-major samples out.
+void inverse_dct_plane(const double *src, int width, int height, double *dst, int stride);
+
+// forward_dct_plane() and quantization in one pass: each block is divided
+// by the 64-entry `table` (indexed by position in the block) through
+// precomputed reciprocals while it is still in registers, and written as
+// block-major int16 quantized coefficients. No double coefficient plane
+// is ever stored.
+void forward_dct_quantize_plane(const double *src, int stride, int width, int height, const int *table, short *dst);
+
+// Same as above for an n x n block size chosen at runtime, n = 4, 8, 16 or
+// 32; each block holds n * n coefficients. n = 8 goes through the selected
+// engine, the other sizes through table kernels specialised per size.
+#define DCT_MAX_SIZE 32
+int dct_block_size_supported(int n);
+void forward_dct_plane_n(int n, const double *src, int stride, int width, int height, double *dst);
+void inverse_dct_plane_n(int n, const double *src, int width, int height, double *dst, int stride);
+
+void dct_set_engine(dct_engine engine);
+// Accepts "table", "aan", "fixed" or "simd". Returns 0 and leaves the engine unchanged otherwise.
+int dct_select_engine(const char *name);
+
+#endif // DCT_TRANSFORM_H
+
+#ifdef DCT_TRANSFORM_IMPLEMENTATION
+#ifndef DCT_TRANSFORM_IMPLEMENTATION_DONE
+#define DCT_TRANSFORM_IMPLEMENTATION_DONE
+
+#include <math.h>
+#include <string.h>
+
+#define DCT_PI 3.14159265358979323846264338327950288
+
+dct_block_fn dct_forward = dct;
+dct_block_fn dct_inverse = idct;
+
+// dct_basis[u][x] = 0.5 * c(u) * cos((2x + 1) * u * pi / 16), c(0) = 1/sqrt(2), else 1
+static double dct_basis[DCT_SIZE][DCT_SIZE];
+// AAN output of dct_aan's butterflies is scaled by 8 * s(u) * s(v), s(0) = 1, s(k) = sqrt(2) * cos(k * pi / 16)
+static double dct_aan_descale[DCT_SIZE][DCT_SIZE];
+static double idct_aan_prescale[DCT_SIZE][DCT_SIZE];
+static int dct_basis_ready = 0;
+
+static void dct_init_basis(void) {
+    if (dct_basis_ready) return;
+    for (int u = 0; u < DCT_SIZE; u++) {
+        double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
+        for (int x = 0; x < DCT_SIZE; x++) {
+            dct_basis[u][x] = 0.5 * cu * cos(((2 * x + 1) * u * DCT_PI) / (2.0 * DCT_SIZE));
+        }
+    }
+
+    double aan_scale[DCT_SIZE];
+    for (int k = 0; k < DCT_SIZE; k++) {
+        aan_scale[k] = (k == 0) ? 1.0 : sqrt(2.0) * cos(k * DCT_PI / 16.0);
+    }
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            dct_aan_descale[u][v] = 1.0 / (8.0 * aan_scale[u] * aan_scale[v]);
+            idct_aan_prescale[u][v] = aan_scale[u] * aan_scale[v] / 8.0;
+        }
+    }
+    dct_basis_ready = 1;
+}
+
+// Function to compute the DCT of an 8x8 block (row pass, then column pass)
+void dct(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    double tmp[DCT_SIZE][DCT_SIZE];
+    dct_init_basis();
+
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            double sum = 0.0;
+            for (int y = 0; y < DCT_SIZE; y++) {
+                sum += input[x][y] * dct_basis[v][y];
+            }
+            tmp[x][v] = sum;
+        }
+    }
+
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            double sum = 0.0;
+            for (int x = 0; x < DCT_SIZE; x++) {
+                sum += dct_basis[u][x] * tmp[x][v];
+            }
+            output[u][v] = sum;
+        }
+    }
+}
+
+// Function to compute the IDCT of an 8x8 block (row pass, then column pass)
+void idct(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    double tmp[DCT_SIZE][DCT_SIZE];
+    dct_init_basis();
+
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            double sum = 0.0;
+            for (int v = 0; v < DCT_SIZE; v++) {
+                sum += input[u][v] * dct_basis[v][y];
+            }
+            tmp[u][y] = sum;
+        }
+    }
+
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            double sum = 0.0;
+            for (int u = 0; u < DCT_SIZE; u++) {
+                sum += dct_basis[u][x] * tmp[u][y];
+            }
+            output[x][y] = sum;
+        }
+    }
+}
+
+// Direct O(N^4) definition, kept as the reference for dct()
+void dct_reference(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            double sum = 0.0;
+            for (int x = 0; x < DCT_SIZE; x++) {
+                for (int y = 0; y < DCT_SIZE; y++) {
+                    sum += input[x][y] * cos(((2 * x + 1) * u * DCT_PI) / (2.0 * DCT_SIZE)) *
+                                               cos(((2 * y + 1) * v * DCT_PI) / (2.0 * DCT_SIZE));
+                }
+            }
+            double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
+            double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
+            output[u][v] = 0.25 * cu * cv * sum;
+        }
+    }
+}
+
+// Direct O(N^4) definition, kept as the reference for idct()
+void idct_reference(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            double sum = 0.0;
+            for (int u = 0; u < DCT_SIZE; u++) {
+                for (int v = 0; v < DCT_SIZE; v++) {
+                    double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
+                    double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
+                    sum += cu * cv * input[u][v] * cos(((2 * x + 1) * u * DCT_PI) / (2.0 * DCT_SIZE)) *
+                                                         cos(((2 * y + 1) * v * DCT_PI) / (2.0 * DCT_SIZE));
+                }
+            }
+            output[x][y] = 0.25 * sum;
+        }
+    }
+}
+
+// One 1-D AAN forward pass over 8 values spaced `step` apart
+static void dct_aan_1d(double *d, int step) {
+    double tmp0 = d[0 * step] + d[7 * step], tmp7 = d[0 * step] - d[7 * step];
+    double tmp1 = d[1 * step] + d[6 * step], tmp6 = d[1 * step] - d[6 * step];
+    double tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+    double tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+    // Even part
+    double tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    double tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+    d[0 * step] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+    double z1 = (tmp12 + tmp13) * 0.707106781186547524;
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    // Odd part
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+    double z5 = (tmp10 - tmp12) * 0.382683432365089772;
+    double z2 = 0.541196100146196984 * tmp10 + z5;
+    double z4 = 1.306562964876376527 * tmp12 + z5;
+    double z3 = tmp11 * 0.707106781186547524;
+    double z11 = tmp7 + z3, z13 = tmp7 - z3;
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[1 * step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+}
+
+// One 1-D AAN inverse pass over 8 prescaled values spaced `step` apart
+static void idct_aan_1d(double *d, int step) {
+    // Even part
+    double tmp0 = d[0 * step], tmp1 = d[2 * step], tmp2 = d[4 * step], tmp3 = d[6 * step];
+    double tmp10 = tmp0 + tmp2, tmp11 = tmp0 - tmp2;
+    double tmp13 = tmp1 + tmp3;
+    double tmp12 = (tmp1 - tmp3) * 1.414213562373095049 - tmp13;
+    tmp0 = tmp10 + tmp13;
+    tmp3 = tmp10 - tmp13;
+    tmp1 = tmp11 + tmp12;
+    tmp2 = tmp11 - tmp12;
+
+    // Odd part
+    double tmp4 = d[1 * step], tmp5 = d[3 * step], tmp6 = d[5 * step], tmp7 = d[7 * step];
+    double z13 = tmp6 + tmp5, z10 = tmp6 - tmp5;
+    double z11 = tmp4 + tmp7, z12 = tmp4 - tmp7;
+    tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) * 1.414213562373095049;
+    double z5 = (z10 + z12) * 1.847759065022573512;
+    tmp10 = z5 - z12 * 1.082392200292393968;
+    tmp12 = z5 - z10 * 2.613125929752753055;
+    tmp6 = tmp12 - tmp7;
+    tmp5 = tmp11 - tmp6;
+    tmp4 = tmp10 - tmp5;
+
+    d[0 * step] = tmp0 + tmp7;
+    d[7 * step] = tmp0 - tmp7;
+    d[1 * step] = tmp1 + tmp6;
+    d[6 * step] = tmp1 - tmp6;
+    d[2 * step] = tmp2 + tmp5;
+    d[5 * step] = tmp2 - tmp5;
+    d[3 * step] = tmp3 + tmp4;
+    d[4 * step] = tmp3 - tmp4;
+}
+
+void dct_aan(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    dct_init_basis();
+    if (output != input) memcpy(output, input, sizeof(double) * DCT_SIZE * DCT_SIZE);
+
+    for (int x = 0; x < DCT_SIZE; x++) dct_aan_1d(&output[x][0], 1);
+    for (int v = 0; v < DCT_SIZE; v++) dct_aan_1d(&output[0][v], DCT_SIZE);
+
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            output[u][v] *= dct_aan_descale[u][v];
+        }
+    }
+}
+
+void idct_aan(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    dct_init_basis();
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            output[u][v] = input[u][v] * idct_aan_prescale[u][v];
+        }
+    }
+
+    for (int v = 0; v < DCT_SIZE; v++) idct_aan_1d(&output[0][v], DCT_SIZE);
+    for (int x = 0; x < DCT_SIZE; x++) idct_aan_1d(&output[x][0], 1);
+}
+
+// Fixed-point constants: round(c * 2^13)
+#define DCT_CONST_BITS 13
+#define DCT_PASS1_BITS 2
+#define DCT_FIX_0_298631336 2446
+#define DCT_FIX_0_390180644 3196
+#define DCT_FIX_0_541196100 4433
+#define DCT_FIX_0_765366865 6270
+#define DCT_FIX_0_899976223 7373
+#define DCT_FIX_1_175875602 9633
+#define DCT_FIX_1_501321110 12299
+#define DCT_FIX_1_847759065 15137
+#define DCT_FIX_1_961570560 16069
+#define DCT_FIX_2_053119869 16819
+#define DCT_FIX_2_562915447 20995
+#define DCT_FIX_3_072711026 25172
+#define DCT_DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+// One 1-D integer forward pass. Pass 1 keeps PASS1_BITS extra bits, pass 2 removes them.
+static void dct_int_1d(int *d, int step, int pass) {
+    int shift = (pass == 1) ? DCT_CONST_BITS - DCT_PASS1_BITS : DCT_CONST_BITS + DCT_PASS1_BITS;
+    int tmp0 = d[0 * step] + d[7 * step], tmp7 = d[0 * step] - d[7 * step];
+    int tmp1 = d[1 * step] + d[6 * step], tmp6 = d[1 * step] - d[6 * step];
+    int tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+    int tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+    // Even part
+    int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+    if (pass == 1) {
+        d[0 * step] = (tmp10 + tmp11) * (1 << DCT_PASS1_BITS);
+        d[4 * step] = (tmp10 - tmp11) * (1 << DCT_PASS1_BITS);
+    } else {
+        d[0 * step] = DCT_DESCALE(tmp10 + tmp11, DCT_PASS1_BITS);
+        d[4 * step] = DCT_DESCALE(tmp10 - tmp11, DCT_PASS1_BITS);
+    }
+    int z1 = (tmp12 + tmp13) * DCT_FIX_0_541196100;
+    d[2 * step] = DCT_DESCALE(z1 + tmp13 * DCT_FIX_0_765366865, shift);
+    d[6 * step] = DCT_DESCALE(z1 - tmp12 * DCT_FIX_1_847759065, shift);
+
+    // Odd part
+    z1 = tmp4 + tmp7;
+    int z2 = tmp5 + tmp6;
+    int z3 = tmp4 + tmp6;
+    int z4 = tmp5 + tmp7;
+    int z5 = (z3 + z4) * DCT_FIX_1_175875602;
+    tmp4 *= DCT_FIX_0_298631336;
+    tmp5 *= DCT_FIX_2_053119869;
+    tmp6 *= DCT_FIX_3_072711026;
+    tmp7 *= DCT_FIX_1_501321110;
+    z1 *= -DCT_FIX_0_899976223;
+    z2 *= -DCT_FIX_2_562915447;
+    z3 = z3 * -DCT_FIX_1_961570560 + z5;
+    z4 = z4 * -DCT_FIX_0_390180644 + z5;
+    d[7 * step] = DCT_DESCALE(tmp4 + z1 + z3, shift);
+    d[5 * step] = DCT_DESCALE(tmp5 + z2 + z4, shift);
+    d[3 * step] = DCT_DESCALE(tmp6 + z2 + z3, shift);
+    d[1 * step] = DCT_DESCALE(tmp7 + z1 + z4, shift);
+}
+
+// One 1-D integer inverse pass. Pass 1 keeps PASS1_BITS extra bits, pass 2 removes them and the 1/8.
+static void idct_int_1d(int *d, int step, int pass) {
+    int shift = (pass == 1) ? DCT_CONST_BITS - DCT_PASS1_BITS : DCT_CONST_BITS + DCT_PASS1_BITS + 3;
+
+    // Even part
+    int z2 = d[2 * step], z3 = d[6 * step];
+    int z1 = (z2 + z3) * DCT_FIX_0_541196100;
+    int tmp2 = z1 - z3 * DCT_FIX_1_847759065;
+    int tmp3 = z1 + z2 * DCT_FIX_0_765366865;
+    z2 = d[0 * step];
+    z3 = d[4 * step];
+    int tmp0 = (z2 + z3) * (1 << DCT_CONST_BITS);
+    int tmp1 = (z2 - z3) * (1 << DCT_CONST_BITS);
+    int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+    // Odd part
+    tmp0 = d[7 * step];
+    tmp1 = d[5 * step];
+    tmp2 = d[3 * step];
+    tmp3 = d[1 * step];
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    int z4 = tmp1 + tmp3;
+    int z5 = (z3 + z4) * DCT_FIX_1_175875602;
+    tmp0 *= DCT_FIX_0_298631336;
+    tmp1 *= DCT_FIX_2_053119869;
+    tmp2 *= DCT_FIX_3_072711026;
+    tmp3 *= DCT_FIX_1_501321110;
+    z1 *= -DCT_FIX_0_899976223;
+    z2 *= -DCT_FIX_2_562915447;
+    z3 = z3 * -DCT_FIX_1_961570560 + z5;
+    z4 = z4 * -DCT_FIX_0_390180644 + z5;
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    d[0 * step] = DCT_DESCALE(tmp10 + tmp3, shift);
+    d[7 * step] = DCT_DESCALE(tmp10 - tmp3, shift);
+    d[1 * step] = DCT_DESCALE(tmp11 + tmp2, shift);
+    d[6 * step] = DCT_DESCALE(tmp11 - tmp2, shift);
+    d[2 * step] = DCT_DESCALE(tmp12 + tmp1, shift);
+    d[5 * step] = DCT_DESCALE(tmp12 - tmp1, shift);
+    d[3 * step] = DCT_DESCALE(tmp13 + tmp0, shift);
+    d[4 * step] = DCT_DESCALE(tmp13 - tmp0, shift);
+}
+
+void dct_int(int block[DCT_SIZE][DCT_SIZE]) {
+    // Level shift to -128..127 so pass 2 stays inside 32 bits
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            block[x][y] -= 128;
+        }
+    }
+    for (int x = 0; x < DCT_SIZE; x++) dct_int_1d(&block[x][0], 1, 1);
+    for (int v = 0; v < DCT_SIZE; v++) dct_int_1d(&block[0][v], DCT_SIZE, 2);
+    // Undo the level shift: a flat 128 block has DC 1024, i.e. 8192 at this scale
+    block[0][0] += 1024 * 8;
+}
+
+void idct_int(int block[DCT_SIZE][DCT_SIZE]) {
+    for (int v = 0; v < DCT_SIZE; v++) idct_int_1d(&block[0][v], DCT_SIZE, 1);
+    for (int x = 0; x < DCT_SIZE; x++) idct_int_1d(&block[x][0], 1, 2);
+}
+
+static void idct_int_pixels_generic(const short *coefficients, unsigned char *out, int stride) {
+    int block[DCT_SIZE][DCT_SIZE];
+    for (int k = 0; k < DCT_SIZE * DCT_SIZE; k++) block[k / DCT_SIZE][k % DCT_SIZE] = coefficients[k];
+    idct_int(block);
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            int value = block[x][y];
+            out[x * stride + y] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+        }
+    }
+}
+
+static unsigned char dct_clamp_pixel(int value) {
+    return (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// 4-point orthonormal inverse DCT: sqrt(1/2) cos(pi/8) and sqrt(1/2) cos(3pi/8)
+// in 13 fraction bits; the even part's 1/2 is folded into the descale
+#define DCT_FIX_0_270598050 2217
+#define DCT_FIX_0_653281482 5352
+
+void idct_int_pixels_4x4(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride) {
+    int workspace[4][4];
+    // Rows u = 0..3 over v, keeping DCT_PASS1_BITS extra bits
+    for (int u = 0; u < 4; u++) {
+        const short *in = coefficients + u * DCT_SIZE;
+        int even0 = (in[0] + in[2]) * (1 << (DCT_CONST_BITS - 1));
+        int even1 = (in[0] - in[2]) * (1 << (DCT_CONST_BITS - 1));
+        int odd0 = in[1] * DCT_FIX_0_653281482 + in[3] * DCT_FIX_0_270598050;
+        int odd1 = in[1] * DCT_FIX_0_270598050 - in[3] * DCT_FIX_0_653281482;
+        workspace[u][0] = DCT_DESCALE(even0 + odd0, DCT_CONST_BITS - DCT_PASS1_BITS);
+        workspace[u][3] = DCT_DESCALE(even0 - odd0, DCT_CONST_BITS - DCT_PASS1_BITS);
+        workspace[u][1] = DCT_DESCALE(even1 + odd1, DCT_CONST_BITS - DCT_PASS1_BITS);
+        workspace[u][2] = DCT_DESCALE(even1 - odd1, DCT_CONST_BITS - DCT_PASS1_BITS);
+    }
+    // Columns, then the extra bits, the even part's 1/2 and the 4/8 size
+    // ratio (a flat 8x8 block has DC 8m, a flat 4x4 one 4m) come off
+    for (int y = 0; y < 4; y++) {
+        int even0 = (workspace[0][y] + workspace[2][y]) * (1 << (DCT_CONST_BITS - 1));
+        int even1 = (workspace[0][y] - workspace[2][y]) * (1 << (DCT_CONST_BITS - 1));
+        int odd0 = workspace[1][y] * DCT_FIX_0_653281482 + workspace[3][y] * DCT_FIX_0_270598050;
+        int odd1 = workspace[1][y] * DCT_FIX_0_270598050 - workspace[3][y] * DCT_FIX_0_653281482;
+        int shift = DCT_CONST_BITS + DCT_PASS1_BITS + 1;
+        out[0 * stride + y] = dct_clamp_pixel(DCT_DESCALE(even0 + odd0, shift));
+        out[3 * stride + y] = dct_clamp_pixel(DCT_DESCALE(even0 - odd0, shift));
+        out[1 * stride + y] = dct_clamp_pixel(DCT_DESCALE(even1 + odd1, shift));
+        out[2 * stride + y] = dct_clamp_pixel(DCT_DESCALE(even1 - odd1, shift));
+    }
+}
+
+// 2-point orthonormal inverse is sqrt(1/2) (a + b), sqrt(1/2) (a - b): with
+// both passes and the 2/8 size ratio every output is the signed sum / 8
+void idct_int_pixels_2x2(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride) {
+    int a = coefficients[0], b = coefficients[1];
+    int c = coefficients[DCT_SIZE], d = coefficients[DCT_SIZE + 1];
+    out[0] = dct_clamp_pixel(DCT_DESCALE(a + b + c + d, 3));
+    out[1] = dct_clamp_pixel(DCT_DESCALE(a - b + c - d, 3));
+    out[stride] = dct_clamp_pixel(DCT_DESCALE(a + b - c - d, 3));
+    out[stride + 1] = dct_clamp_pixel(DCT_DESCALE(a - b - c + d, 3));
+}
+
+// The block mean, what idct_int() gives for a DC-only block
+void idct_int_pixels_1x1(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride) {
+    (void)stride;
+    out[0] = dct_clamp_pixel(DCT_DESCALE(coefficients[0], 3));
+}
+
+void dct_fixed(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    int block[DCT_SIZE][DCT_SIZE];
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            block[x][y] = (int)lround(input[x][y]);
+        }
+    }
+    dct_int(block);
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            output[u][v] = block[u][v] * 0.125;
+        }
+    }
+}
+
+void idct_fixed(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    int block[DCT_SIZE][DCT_SIZE];
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            block[u][v] = (int)lround(input[u][v]);
+        }
+    }
+    idct_int(block);
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            output[x][y] = block[x][y];
+        }
+    }
+}
+
+// DC-only and low-frequency blocks skip the full transform
+void idct_sparse(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    int rows = 0, cols = 0;
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            if (input[u][v] != 0.0) {
+                if (u >= rows) rows = u + 1;
+                if (v >= cols) cols = v + 1;
+            }
+        }
+    }
+
+    if (rows <= 1 && cols <= 1) {
+        // Flat block: every sample is 0.25 * c(0) * c(0) * DC
+        double value = input[0][0] * 0.125;
+        for (int x = 0; x < DCT_SIZE; x++) {
+            for (int y = 0; y < DCT_SIZE; y++) {
+                output[x][y] = value;
+            }
+        }
+        return;
+    }
+
+    if (rows > DCT_SIZE / 2 || cols > DCT_SIZE / 2) {
+        dct_inverse(input, output);
+        return;
+    }
+
+    // Support inside the top-left 4x4: run the separable passes over the
+    // nonzero rows / columns only
+    double tmp[DCT_SIZE / 2][DCT_SIZE];
+    dct_init_basis();
+    for (int u = 0; u < rows; u++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            double sum = 0.0;
+            for (int v = 0; v < cols; v++) {
+                sum += input[u][v] * dct_basis[v][y];
+            }
+            tmp[u][y] = sum;
+        }
+    }
+    for (int x = 0; x < DCT_SIZE; x++) {
+        for (int y = 0; y < DCT_SIZE; y++) {
+            double sum = 0.0;
+            for (int u = 0; u < rows; u++) {
+                sum += dct_basis[u][x] * tmp[u][y];
+            }
+            output[x][y] = sum;
+        }
+    }
+}
+
+// SIMD kernels
+#if !defined(DCT_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define DCT_X86_SIMD
+#endif
+
+#ifdef DCT_X86_SIMD
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DCT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DCT_TARGET(isa)
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h> // __cpuid
+static int dct_detect_cpu(void) {
+    int info[4], features = 0;
+    __cpuid(info, 1);
+    if ((info[3] >> 26) & 1) features |= DCT_CPU_SSE2;
+    // AVX2 also needs the OS to save the upper ymm halves (OSXSAVE + XCR0 bits 1 and 2)
+    if (((info[2] >> 27) & 1) && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if ((info[1] >> 5) & 1) features |= DCT_CPU_AVX2;
+    }
+    return features;
+}
+#else
+static int dct_detect_cpu(void) {
+    int features = 0;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) features |= DCT_CPU_SSE2;
+    if (__builtin_cpu_supports("avx2")) features |= DCT_CPU_AVX2;
+    return features;
+}
+#endif
+
+int dct_cpu_features(void) {
+    static int features = -1;
+    if (features < 0) features = dct_detect_cpu();
+    return features;
+}
+
+static float dct_aan_descale_f[DCT_SIZE][DCT_SIZE];
+static float idct_aan_prescale_f[DCT_SIZE][DCT_SIZE];
+static int dct_simd_ready = 0;
+
+static void dct_init_simd(void) {
+    if (dct_simd_ready) return;
+    dct_init_basis();
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            dct_aan_descale_f[u][v] = (float)dct_aan_descale[u][v];
+            idct_aan_prescale_f[u][v] = (float)idct_aan_prescale[u][v];
+        }
+    }
+    dct_simd_ready = 1;
+}
+
+// The 1-D AAN butterflies of dct_aan_1d / idct_aan_1d, applied lane-wise to
+// eight vectors r[0..7], so every lane is an independent column.
+#define DCT_AAN_FWD_VEC(T, r, ADD, SUB, MUL, SET1) do {                         \
+    T tmp0 = ADD(r[0], r[7]), tmp7 = SUB(r[0], r[7]);                           \
+    T tmp1 = ADD(r[1], r[6]), tmp6 = SUB(r[1], r[6]);                           \
+    T tmp2 = ADD(r[2], r[5]), tmp5 = SUB(r[2], r[5]);                           \
+    T tmp3 = ADD(r[3], r[4]), tmp4 = SUB(r[3], r[4]);                           \
+    T tmp10 = ADD(tmp0, tmp3), tmp13 = SUB(tmp0, tmp3);                         \
+    T tmp11 = ADD(tmp1, tmp2), tmp12 = SUB(tmp1, tmp2);                         \
+    r[0] = ADD(tmp10, tmp11);                                                   \
+    r[4] = SUB(tmp10, tmp11);                                                   \
+    T z1 = MUL(ADD(tmp12, tmp13), SET1(0.707106781f));                          \
+    r[2] = ADD(tmp13, z1);                                                      \
+    r[6] = SUB(tmp13, z1);                                                      \
+    tmp10 = ADD(tmp4, tmp5);                                                    \
+    tmp11 = ADD(tmp5, tmp6);                                                    \
+    tmp12 = ADD(tmp6, tmp7);                                                    \
+    T z5 = MUL(SUB(tmp10, tmp12), SET1(0.382683433f));                          \
+    T z2 = ADD(MUL(tmp10, SET1(0.541196100f)), z5);                             \
+    T z4 = ADD(MUL(tmp12, SET1(1.306562965f)), z5);                             \
+    T z3 = MUL(tmp11, SET1(0.707106781f));                                      \
+    T z11 = ADD(tmp7, z3), z13 = SUB(tmp7, z3);                                 \
+    r[5] = ADD(z13, z2);                                                        \
+    r[3] = SUB(z13, z2);                                                        \
+    r[1] = ADD(z11, z4);                                                        \
+    r[7] = SUB(z11, z4);                                                        \
+} while (0)
+
+#define DCT_AAN_INV_VEC(T, r, ADD, SUB, MUL, SET1) do {                         \
+    T tmp10 = ADD(r[0], r[4]), tmp11 = SUB(r[0], r[4]);                         \
+    T tmp13 = ADD(r[2], r[6]);                                                  \
+    T tmp12 = SUB(MUL(SUB(r[2], r[6]), SET1(1.414213562f)), tmp13);             \
+    T tmp0 = ADD(tmp10, tmp13), tmp3 = SUB(tmp10, tmp13);                       \
+    T tmp1 = ADD(tmp11, tmp12), tmp2 = SUB(tmp11, tmp12);                       \
+    T z13 = ADD(r[5], r[3]), z10 = SUB(r[5], r[3]);                             \
+    T z11 = ADD(r[1], r[7]), z12 = SUB(r[1], r[7]);                             \
+    T tmp7 = ADD(z11, z13);                                                     \
+    tmp11 = MUL(SUB(z11, z13), SET1(1.414213562f));                             \
+    T z5 = MUL(ADD(z10, z12), SET1(1.847759065f));                              \
+    tmp10 = SUB(z5, MUL(z12, SET1(1.082392200f)));                              \
+    tmp12 = SUB(z5, MUL(z10, SET1(2.613125930f)));                              \
+    T tmp6 = SUB(tmp12, tmp7);                                                  \
+    T tmp5 = SUB(tmp11, tmp6);                                                  \
+    T tmp4 = SUB(tmp10, tmp5);                                                  \
+    r[0] = ADD(tmp0, tmp7);                                                     \
+    r[7] = SUB(tmp0, tmp7);                                                     \
+    r[1] = ADD(tmp1, tmp6);                                                     \
+    r[6] = SUB(tmp1, tmp6);                                                     \
+    r[2] = ADD(tmp2, tmp5);                                                     \
+    r[5] = SUB(tmp2, tmp5);                                                     \
+    r[3] = ADD(tmp3, tmp4);                                                     \
+    r[4] = SUB(tmp3, tmp4);                                                     \
+} while (0)
+
+// SSE2: each row is two 4-lane halves, lo = columns 0..3, hi = columns 4..7
+
+DCT_TARGET("sse2") static void dct_sse2_fwd_1d(__m128 *r) {
+    DCT_AAN_FWD_VEC(__m128, r, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps);
+}
+
+DCT_TARGET("sse2") static void dct_sse2_inv_1d(__m128 *r) {
+    DCT_AAN_INV_VEC(__m128, r, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps);
+}
+
+// 8x8 transpose as four 4x4 transposes, swapping the off-diagonal quadrants
+DCT_TARGET("sse2") static void dct_sse2_transpose(__m128 lo[DCT_SIZE], __m128 hi[DCT_SIZE]) {
+    _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+    _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+    _MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+    _MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+    for (int k = 0; k < 4; k++) {
+        __m128 t = hi[k];
+        hi[k] = lo[k + 4];
+        lo[k + 4] = t;
+    }
+}
+
+DCT_TARGET("sse2") static void dct_sse2_load(double input[DCT_SIZE][DCT_SIZE], __m128 lo[DCT_SIZE], __m128 hi[DCT_SIZE]) {
+    for (int x = 0; x < DCT_SIZE; x++) {
+        lo[x] = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(&input[x][0])), _mm_cvtpd_ps(_mm_loadu_pd(&input[x][2])));
+        hi[x] = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(&input[x][4])), _mm_cvtpd_ps(_mm_loadu_pd(&input[x][6])));
+    }
+}
+
+DCT_TARGET("sse2") static void dct_sse2_store(__m128 lo[DCT_SIZE], __m128 hi[DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    for (int x = 0; x < DCT_SIZE; x++) {
+        _mm_storeu_pd(&output[x][0], _mm_cvtps_pd(lo[x]));
+        _mm_storeu_pd(&output[x][2], _mm_cvtps_pd(_mm_movehl_ps(lo[x], lo[x])));
+        _mm_storeu_pd(&output[x][4], _mm_cvtps_pd(hi[x]));
+        _mm_storeu_pd(&output[x][6], _mm_cvtps_pd(_mm_movehl_ps(hi[x], hi[x])));
+    }
+}
+
+DCT_TARGET("sse2") void dct_sse2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    __m128 lo[DCT_SIZE], hi[DCT_SIZE];
+    dct_init_simd();
+    dct_sse2_load(input, lo, hi);
+
+    dct_sse2_fwd_1d(lo);
+    dct_sse2_fwd_1d(hi);
+    dct_sse2_transpose(lo, hi);
+    dct_sse2_fwd_1d(lo);
+    dct_sse2_fwd_1d(hi);
+    dct_sse2_transpose(lo, hi);
+
+    for (int u = 0; u < DCT_SIZE; u++) {
+        lo[u] = _mm_mul_ps(lo[u], _mm_loadu_ps(&dct_aan_descale_f[u][0]));
+        hi[u] = _mm_mul_ps(hi[u], _mm_loadu_ps(&dct_aan_descale_f[u][4]));
+    }
+    dct_sse2_store(lo, hi, output);
+}
+
+DCT_TARGET("sse2") void idct_sse2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    __m128 lo[DCT_SIZE], hi[DCT_SIZE];
+    dct_init_simd();
+    dct_sse2_load(input, lo, hi);
+
+    for (int u = 0; u < DCT_SIZE; u++) {
+        lo[u] = _mm_mul_ps(lo[u], _mm_loadu_ps(&idct_aan_prescale_f[u][0]));
+        hi[u] = _mm_mul_ps(hi[u], _mm_loadu_ps(&idct_aan_prescale_f[u][4]));
+    }
+
+    dct_sse2_inv_1d(lo);
+    dct_sse2_inv_1d(hi);
+    dct_sse2_transpose(lo, hi);
+    dct_sse2_inv_1d(lo);
+    dct_sse2_inv_1d(hi);
+    dct_sse2_transpose(lo, hi);
+
+    dct_sse2_store(lo, hi, output);
+}
+
+// AVX2: each row is one 8-lane register
+
+DCT_TARGET("avx2") static void dct_avx2_fwd_1d(__m256 *r) {
+    DCT_AAN_FWD_VEC(__m256, r, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps);
+}
+
+DCT_TARGET("avx2") static void dct_avx2_inv_1d(__m256 *r) {
+    DCT_AAN_INV_VEC(__m256, r, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps);
+}
+
+DCT_TARGET("avx2") static void dct_avx2_transpose(__m256 r[DCT_SIZE]) {
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+DCT_TARGET("avx2") static void dct_avx2_load(const double *src, int stride, __m256 r[DCT_SIZE]) {
+    for (int x = 0; x < DCT_SIZE; x++) {
+        __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd(src + x * stride));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd(src + x * stride + 4));
+        r[x] = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+    }
+}
+
+DCT_TARGET("avx2") static void dct_avx2_store(__m256 r[DCT_SIZE], double *dst, int stride) {
+    for (int x = 0; x < DCT_SIZE; x++) {
+        _mm256_storeu_pd(dst + x * stride, _mm256_cvtps_pd(_mm256_castps256_ps128(r[x])));
+        _mm256_storeu_pd(dst + x * stride + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(r[x], 1)));
+    }
+}
+
+DCT_TARGET("avx2") static void dct_avx2_fwd_block(__m256 r[DCT_SIZE]) {
+    dct_avx2_fwd_1d(r);
+    dct_avx2_transpose(r);
+    dct_avx2_fwd_1d(r);
+    dct_avx2_transpose(r);
+    for (int u = 0; u < DCT_SIZE; u++) {
+        r[u] = _mm256_mul_ps(r[u], _mm256_loadu_ps(&dct_aan_descale_f[u][0]));
+    }
+}
+
+DCT_TARGET("avx2") static void dct_avx2_inv_block(__m256 r[DCT_SIZE]) {
+    for (int u = 0; u < DCT_SIZE; u++) {
+        r[u] = _mm256_mul_ps(r[u], _mm256_loadu_ps(&idct_aan_prescale_f[u][0]));
+    }
+    dct_avx2_inv_1d(r);
+    dct_avx2_transpose(r);
+    dct_avx2_inv_1d(r);
+    dct_avx2_transpose(r);
+}
+
+DCT_TARGET("avx2") void dct_avx2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    __m256 r[DCT_SIZE];
+    dct_init_simd();
+    dct_avx2_load(&input[0][0], DCT_SIZE, r);
+    dct_avx2_fwd_block(r);
+    dct_avx2_store(r, &output[0][0], DCT_SIZE);
+}
+
+DCT_TARGET("avx2") void idct_avx2(double input[DCT_SIZE][DCT_SIZE], double output[DCT_SIZE][DCT_SIZE]) {
+    __m256 r[DCT_SIZE];
+    dct_init_simd();
+    dct_avx2_load(&input[0][0], DCT_SIZE, r);
+    dct_avx2_inv_block(r);
+    dct_avx2_store(r, &output[0][0], DCT_SIZE);
+}
+
+// Plane kernels over one row of full blocks: two blocks per iteration, 16
+// ymm registers live, so the butterflies of one block fill the latency of
+// the other's.
+DCT_TARGET("avx2") static void forward_dct_row_avx2(const double *src, int stride, int blocks, double *dst) {
+    dct_init_simd();
+    int bx = 0;
+    for (; bx + 2 <= blocks; bx += 2) {
+        __m256 a[DCT_SIZE], b[DCT_SIZE];
+        dct_avx2_load(src + bx * DCT_SIZE, stride, a);
+        dct_avx2_load(src + (bx + 1) * DCT_SIZE, stride, b);
+        dct_avx2_fwd_block(a);
+        dct_avx2_fwd_block(b);
+        dct_avx2_store(a, dst + bx * DCT_SIZE * DCT_SIZE, DCT_SIZE);
+        dct_avx2_store(b, dst + (bx + 1) * DCT_SIZE * DCT_SIZE, DCT_SIZE);
+    }
+    for (; bx < blocks; bx++) {
+        __m256 a[DCT_SIZE];
+        dct_avx2_load(src + bx * DCT_SIZE, stride, a);
+        dct_avx2_fwd_block(a);
+        dct_avx2_store(a, dst + bx * DCT_SIZE * DCT_SIZE, DCT_SIZE);
+    }
+}
+
+DCT_TARGET("avx2") static void inverse_dct_row_avx2(const double *src, int blocks, double *dst, int stride) {
+    dct_init_simd();
+    int bx = 0;
+    for (; bx + 2 <= blocks; bx += 2) {
+        __m256 a[DCT_SIZE], b[DCT_SIZE];
+        dct_avx2_load(src + bx * DCT_SIZE * DCT_SIZE, DCT_SIZE, a);
+        dct_avx2_load(src + (bx + 1) * DCT_SIZE * DCT_SIZE, DCT_SIZE, b);
+        dct_avx2_inv_block(a);
+        dct_avx2_inv_block(b);
+        dct_avx2_store(a, dst + bx * DCT_SIZE, stride);
+        dct_avx2_store(b, dst + (bx + 1) * DCT_SIZE, stride);
+    }
+    for (; bx < blocks; bx++) {
+        __m256 a[DCT_SIZE];
+        dct_avx2_load(src + bx * DCT_SIZE * DCT_SIZE, DCT_SIZE, a);
+        dct_avx2_inv_block(a);
+        dct_avx2_store(a, dst + bx * DCT_SIZE, stride);
+    }
+}
+
+// Fused transform + quantization: the AAN descale and 1/q fold into one
+// multiply per coefficient, rounded half away from zero like round(), and
+// packed to int16 with saturation before the block leaves registers.
+DCT_TARGET("avx2") static void forward_dct_quantize_row_avx2(const double *src, int stride, int blocks, const double *recip, short *dst) {
+    float scale[DCT_SIZE][DCT_SIZE];
+    dct_init_simd();
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            scale[u][v] = (float)(dct_aan_descale[u][v] * recip[u * DCT_SIZE + v]);
+        }
+    }
+
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    for (int bx = 0; bx < blocks; bx++) {
+        __m256 r[DCT_SIZE];
+        dct_avx2_load(src + bx * DCT_SIZE, stride, r);
+        dct_avx2_fwd_1d(r);
+        dct_avx2_transpose(r);
+        dct_avx2_fwd_1d(r);
+        dct_avx2_transpose(r);
+
+        short *out = dst + bx * DCT_SIZE * DCT_SIZE;
+        for (int u = 0; u < DCT_SIZE; u += 2) {
+            __m256 a = _mm256_mul_ps(r[u], _mm256_loadu_ps(scale[u]));
+            __m256 b = _mm256_mul_ps(r[u + 1], _mm256_loadu_ps(scale[u + 1]));
+            __m256i qa = _mm256_cvttps_epi32(_mm256_add_ps(a, _mm256_or_ps(_mm256_and_ps(a, sign), half)));
+            __m256i qb = _mm256_cvttps_epi32(_mm256_add_ps(b, _mm256_or_ps(_mm256_and_ps(b, sign), half)));
+            // packs works per 128-bit lane, the permute puts rows u and u + 1 back in order
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(qa, qb), 0xD8);
+            _mm256_storeu_si256((__m256i *)(out + u * DCT_SIZE), packed);
+        }
+    }
+}
+
+// idct_int() in 16-bit lanes: eight columns per vector, the products formed
+// in 32 bits by madd on interleaved pairs. The odd-part rotations are the
+// idct_int_1d() ones with the shared multiplies folded into the pair
+// constants, so the integer results are the same, just saturated to 0..255.
+#define DCT_PAIR16(a, b) _mm_setr_epi16((a), (b), (a), (b), (a), (b), (a), (b))
+
+typedef struct {
+    __m128i lo, hi;
+} dct_wide;
+
+DCT_TARGET("sse2") static inline dct_wide dct_wide_madd(__m128i x, __m128i y, __m128i pair) {
+    dct_wide w = {_mm_madd_epi16(_mm_unpacklo_epi16(x, y), pair), _mm_madd_epi16(_mm_unpackhi_epi16(x, y), pair)};
+    return w;
+}
+
+DCT_TARGET("sse2") static inline dct_wide dct_wide_add(dct_wide a, dct_wide b) {
+    dct_wide w = {_mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi)};
+    return w;
+}
+
+DCT_TARGET("sse2") static inline dct_wide dct_wide_sub(dct_wide a, dct_wide b) {
+    dct_wide w = {_mm_sub_epi32(a.lo, b.lo), _mm_sub_epi32(a.hi, b.hi)};
+    return w;
+}
+
+// x << DCT_CONST_BITS in 32 bits
+DCT_TARGET("sse2") static inline dct_wide dct_wide_scale(__m128i x) {
+    const __m128i zero = _mm_setzero_si128();
+    dct_wide w = {_mm_srai_epi32(_mm_unpacklo_epi16(zero, x), 16 - DCT_CONST_BITS),
+                  _mm_srai_epi32(_mm_unpackhi_epi16(zero, x), 16 - DCT_CONST_BITS)};
+    return w;
+}
+
+// (a + b + bias) >> shift and (a - b + bias) >> shift, packed back to 16 bits
+DCT_TARGET("sse2") static inline void dct_wide_butterfly(dct_wide a, dct_wide b, __m128i bias, __m128i shift,
+                                                         __m128i *sum, __m128i *difference) {
+    a.lo = _mm_add_epi32(a.lo, bias);
+    a.hi = _mm_add_epi32(a.hi, bias);
+    dct_wide s = dct_wide_add(a, b), d = dct_wide_sub(a, b);
+    *sum = _mm_packs_epi32(_mm_sra_epi32(s.lo, shift), _mm_sra_epi32(s.hi, shift));
+    *difference = _mm_packs_epi32(_mm_sra_epi32(d.lo, shift), _mm_sra_epi32(d.hi, shift));
+}
+
+DCT_TARGET("sse2") static void idct_int_sse2_1d(__m128i r[DCT_SIZE], __m128i bias, __m128i shift) {
+    // Even part
+    dct_wide tmp2 = dct_wide_madd(r[2], r[6], DCT_PAIR16(DCT_FIX_0_541196100, DCT_FIX_0_541196100 - DCT_FIX_1_847759065));
+    dct_wide tmp3 = dct_wide_madd(r[2], r[6], DCT_PAIR16(DCT_FIX_0_541196100 + DCT_FIX_0_765366865, DCT_FIX_0_541196100));
+    dct_wide tmp0 = dct_wide_scale(_mm_add_epi16(r[0], r[4]));
+    dct_wide tmp1 = dct_wide_scale(_mm_sub_epi16(r[0], r[4]));
+    dct_wide tmp10 = dct_wide_add(tmp0, tmp3), tmp13 = dct_wide_sub(tmp0, tmp3);
+    dct_wide tmp11 = dct_wide_add(tmp1, tmp2), tmp12 = dct_wide_sub(tmp1, tmp2);
+
+    // Odd part: z5 = (z3 + z4) * c is spread over the (r1 + r7, r3 + r5) rotation
+    __m128i z1 = _mm_add_epi16(r[7], r[1]), z2 = _mm_add_epi16(r[5], r[3]);
+    dct_wide z1z5 = dct_wide_madd(z1, z2, DCT_PAIR16(DCT_FIX_1_175875602 - DCT_FIX_0_899976223, DCT_FIX_1_175875602));
+    dct_wide z2z5 = dct_wide_madd(z1, z2, DCT_PAIR16(DCT_FIX_1_175875602, DCT_FIX_1_175875602 - DCT_FIX_2_562915447));
+    dct_wide odd0 = dct_wide_madd(r[7], r[3], DCT_PAIR16(DCT_FIX_0_298631336 - DCT_FIX_1_961570560, -DCT_FIX_1_961570560));
+    dct_wide odd2 = dct_wide_madd(r[7], r[3], DCT_PAIR16(-DCT_FIX_1_961570560, DCT_FIX_3_072711026 - DCT_FIX_1_961570560));
+    dct_wide odd1 = dct_wide_madd(r[5], r[1], DCT_PAIR16(DCT_FIX_2_053119869 - DCT_FIX_0_390180644, -DCT_FIX_0_390180644));
+    dct_wide odd3 = dct_wide_madd(r[5], r[1], DCT_PAIR16(-DCT_FIX_0_390180644, DCT_FIX_1_501321110 - DCT_FIX_0_390180644));
+    odd0 = dct_wide_add(odd0, z1z5);
+    odd1 = dct_wide_add(odd1, z2z5);
+    odd2 = dct_wide_add(odd2, z2z5);
+    odd3 = dct_wide_add(odd3, z1z5);
+
+    dct_wide_butterfly(tmp10, odd3, bias, shift, &r[0], &r[7]);
+    dct_wide_butterfly(tmp11, odd2, bias, shift, &r[1], &r[6]);
+    dct_wide_butterfly(tmp12, odd1, bias, shift, &r[2], &r[5]);
+    dct_wide_butterfly(tmp13, odd0, bias, shift, &r[3], &r[4]);
+}
+
+DCT_TARGET("sse2") static void idct_int_pixels_sse2(const short *coefficients, unsigned char *out, int stride) {
+    __m128i r[DCT_SIZE], t;
+    for (int u = 0; u < DCT_SIZE; u++) r[u] = _mm_loadu_si128((const __m128i *)(coefficients + u * DCT_SIZE));
+    // Level shift so pass 2 has the headroom of 16 bits; the 128 comes back exactly in the bias
+    r[0] = _mm_sub_epi16(r[0], _mm_setr_epi16(1024, 0, 0, 0, 0, 0, 0, 0));
+
+    idct_int_sse2_1d(r, _mm_set1_epi32(1 << (DCT_CONST_BITS - DCT_PASS1_BITS - 1)),
+                     _mm_cvtsi32_si128(DCT_CONST_BITS - DCT_PASS1_BITS));
+
+    // 16-bit 8x8 transpose in three interleave rounds
+    static const int pairs[3][4][2] = {{{0, 4}, {1, 5}, {2, 6}, {3, 7}},
+                                       {{0, 2}, {1, 3}, {4, 6}, {5, 7}},
+                                       {{0, 1}, {2, 3}, {4, 5}, {6, 7}}};
+    for (int round = 0; round < 3; round++) {
+        for (int k = 0; k < 4; k++) {
+            int a = pairs[round][k][0], b = pairs[round][k][1];
+            t = r[a];
+            r[a] = _mm_unpacklo_epi16(t, r[b]);
+            r[b] = _mm_unpackhi_epi16(t, r[b]);
+        }
+    }
+
+    const int shift = DCT_CONST_BITS + DCT_PASS1_BITS + 3;
+    idct_int_sse2_1d(r, _mm_set1_epi32((1 << (shift - 1)) + (128 << shift)), _mm_cvtsi32_si128(shift));
+
+    // Saturate to bytes and transpose back: r[y] holds column y of the block
+    __m128i p[DCT_SIZE / 2];
+    for (int k = 0; k < DCT_SIZE / 2; k++) p[k] = _mm_packus_epi16(r[2 * k], r[2 * k + 1]);
+    static const int byte_pairs[3][2][2] = {{{0, 2}, {1, 3}}, {{0, 1}, {2, 3}}, {{0, 2}, {1, 3}}};
+    for (int round = 0; round < 3; round++) {
+        for (int k = 0; k < 2; k++) {
+            int a = byte_pairs[round][k][0], b = byte_pairs[round][k][1];
+            t = p[a];
+            p[a] = _mm_unpacklo_epi8(t, p[b]);
+            p[b] = _mm_unpackhi_epi8(t, p[b]);
+        }
+    }
+    // Rows 0/1, 2/3, 4/5 and 6/7 end up in p[0], p[2], p[1] and p[3]
+    static const int row_pairs[DCT_SIZE / 2] = {0, 2, 1, 3};
+    for (int k = 0; k < DCT_SIZE / 2; k++) {
+        __m128i rows = p[row_pairs[k]];
+        _mm_storel_epi64((__m128i *)(out + (2 * k) * stride), rows);
+        _mm_storel_epi64((__m128i *)(out + (2 * k + 1) * stride), _mm_shuffle_epi32(rows, 0x4E));
+    }
+}
+
+void idct_int_pixels(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride) {
+    static int sse2 = -1;
+    if (sse2 < 0) sse2 = (dct_cpu_features() & DCT_CPU_SSE2) != 0;
+    if (sse2) {
+        idct_int_pixels_sse2(coefficients, out, stride);
+    } else {
+        idct_int_pixels_generic(coefficients, out, stride);
+    }
+}
+
+#else
+
+int dct_cpu_features(void) {
+    return 0;
+}
+
+void idct_int_pixels(const short coefficients[DCT_SIZE * DCT_SIZE], unsigned char *out, int stride) {
+    idct_int_pixels_generic(coefficients, out, stride);
+}
+
+#endif // DCT_X86_SIMD
+
+// Whole-plane transforms
+
+typedef void (*dct_row_fn)(const double *src, int stride, int blocks, double *dst);
+typedef void (*idct_row_fn)(const double *src, int blocks, double *dst, int stride);
+
+// One row of full blocks through whatever dct_forward / dct_inverse currently are
+static void forward_dct_row_generic(const double *src, int stride, int blocks, double *dst) {
+    double block[DCT_SIZE][DCT_SIZE];
+    for (int bx = 0; bx < blocks; bx++) {
+        for (int x = 0; x < DCT_SIZE; x++) {
+            memcpy(block[x], src + x * stride + bx * DCT_SIZE, sizeof(block[x]));
+        }
+        dct_forward(block, (double (*)[DCT_SIZE])(dst + bx * DCT_SIZE * DCT_SIZE));
+    }
+}
+
+static void inverse_dct_row_generic(const double *src, int blocks, double *dst, int stride) {
+    double block[DCT_SIZE][DCT_SIZE];
+    for (int bx = 0; bx < blocks; bx++) {
+        dct_inverse((double (*)[DCT_SIZE])(src + bx * DCT_SIZE * DCT_SIZE), block);
+        for (int x = 0; x < DCT_SIZE; x++) {
+            memcpy(dst + x * stride + bx * DCT_SIZE, block[x], sizeof(block[x]));
+        }
+    }
+}
+
+static dct_row_fn dct_row_kernel = forward_dct_row_generic;
+static idct_row_fn idct_row_kernel = inverse_dct_row_generic;
+
+void forward_dct_plane(const double *src, int stride, int width, int height, double *dst) {
+    int blocks_x = (width + DCT_SIZE - 1) / DCT_SIZE;
+    int full_x = width / DCT_SIZE, full_y = height / DCT_SIZE;
+
+    for (int by = 0; by < full_y; by++) {
+        dct_row_kernel(src + (size_t)by * DCT_SIZE * stride, stride, full_x,
+                       dst + (size_t)by * blocks_x * DCT_SIZE * DCT_SIZE);
+    }
+
+    // Partial blocks on the right and bottom edges repeat the last column / row
+    double block[DCT_SIZE][DCT_SIZE];
+    int blocks_y = (height + DCT_SIZE - 1) / DCT_SIZE;
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = (by < full_y) ? full_x : 0; bx < blocks_x; bx++) {
+            for (int x = 0; x < DCT_SIZE; x++) {
+                int i = by * DCT_SIZE + x;
+                if (i >= height) i = height - 1;
+                for (int y = 0; y < DCT_SIZE; y++) {
+                    int j = bx * DCT_SIZE + y;
+                    if (j >= width) j = width - 1;
+                    block[x][y] = src[(size_t)i * stride + j];
+                }
+            }
+            dct_forward(block, (double (*)[DCT_SIZE])(dst + ((size_t)by * blocks_x + bx) * DCT_SIZE * DCT_SIZE));
+        }
+    }
+}
+
+void inverse_dct_plane(const double *src, int width, int height, double *dst, int stride) {
+    int blocks_x = (width + DCT_SIZE - 1) / DCT_SIZE;
+    int full_x = width / DCT_SIZE, full_y = height / DCT_SIZE;
+
+    for (int by = 0; by < full_y; by++) {
+        idct_row_kernel(src + (size_t)by * blocks_x * DCT_SIZE * DCT_SIZE, full_x,
+                        dst + (size_t)by * DCT_SIZE * stride, stride);
+    }
+
+    // Partial edge blocks: only the samples inside the plane are written
+    double block[DCT_SIZE][DCT_SIZE];
+    int blocks_y = (height + DCT_SIZE - 1) / DCT_SIZE;
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = (by < full_y) ? full_x : 0; bx < blocks_x; bx++) {
+            dct_inverse((double (*)[DCT_SIZE])(src + ((size_t)by * blocks_x + bx) * DCT_SIZE * DCT_SIZE), block);
+            for (int x = 0; x < DCT_SIZE && by * DCT_SIZE + x < height; x++) {
+                for (int y = 0; y < DCT_SIZE && bx * DCT_SIZE + y < width; y++) {
+                    dst[(size_t)(by * DCT_SIZE + x) * stride + bx * DCT_SIZE + y] = block[x][y];
+                }
+            }
+        }
+    }
+}
+
+// Fused forward transform + quantization
+
+typedef void (*dct_quant_row_fn)(const double *src, int stride, int blocks, const double *recip, short *dst);
+
+static short dct_quantize_coefficient(double value, double recip) {
+    double q = round(value * recip);
+    if (q > 32767.0) q = 32767.0;
+    if (q < -32768.0) q = -32768.0;
+    return (short)q;
+}
+
+static void dct_quantize_block(double block[DCT_SIZE][DCT_SIZE], const double *recip, short *dst) {
+    for (int u = 0; u < DCT_SIZE; u++) {
+        for (int v = 0; v < DCT_SIZE; v++) {
+            dst[u * DCT_SIZE + v] = dct_quantize_coefficient(block[u][v], recip[u * DCT_SIZE + v]);
+        }
+    }
+}
+
+static void forward_dct_quantize_row_generic(const double *src, int stride, int blocks, const double *recip, short *dst) {
+    double block[DCT_SIZE][DCT_SIZE], coefficients[DCT_SIZE][DCT_SIZE];
+    for (int bx = 0; bx < blocks; bx++) {
+        for (int x = 0; x < DCT_SIZE; x++) {
+            memcpy(block[x], src + x * stride + bx * DCT_SIZE, sizeof(block[x]));
+        }
+        dct_forward(block, coefficients);
+        dct_quantize_block(coefficients, recip, dst + bx * DCT_SIZE * DCT_SIZE);
+    }
+}
+
+static dct_quant_row_fn dct_quant_row_kernel = forward_dct_quantize_row_generic;
+
+void forward_dct_quantize_plane(const double *src, int stride, int width, int height, const int *table, short *dst) {
+    double recip[DCT_SIZE * DCT_SIZE];
+    for (int k = 0; k < DCT_SIZE * DCT_SIZE; k++) {
+        recip[k] = 1.0 / table[k];
+    }
+
+    int blocks_x = (width + DCT_SIZE - 1) / DCT_SIZE;
+    int full_x = width / DCT_SIZE, full_y = height / DCT_SIZE;
+    for (int by = 0; by < full_y; by++) {
+        dct_quant_row_kernel(src + (size_t)by * DCT_SIZE * stride, stride, full_x, recip,
+                             dst + (size_t)by * blocks_x * DCT_SIZE * DCT_SIZE);
+    }
+
+    double block[DCT_SIZE][DCT_SIZE], coefficients[DCT_SIZE][DCT_SIZE];
+    int blocks_y = (height + DCT_SIZE - 1) / DCT_SIZE;
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = (by < full_y) ? full_x : 0; bx < blocks_x; bx++) {
+            for (int x = 0; x < DCT_SIZE; x++) {
+                int i = by * DCT_SIZE + x;
+                if (i >= height) i = height - 1;
+                for (int y = 0; y < DCT_SIZE; y++) {
+                    int j = bx * DCT_SIZE + y;
+                    if (j >= width) j = width - 1;
+                    block[x][y] = src[(size_t)i * stride + j];
+                }
+            }
+            dct_forward(block, coefficients);
+            dct_quantize_block(coefficients, recip, dst + ((size_t)by * blocks_x + bx) * DCT_SIZE * DCT_SIZE);
+        }
+    }
+}
+
+// Block sizes other than 8: one set of kernels per size, generated from a
+// single macro so each copy has N as a compile-time constant and the
+// compiler unrolls the inner products.
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define DCT_UNROLL _Pragma("GCC unroll 32")
+#elif defined(__clang__)
+#define DCT_UNROLL _Pragma("unroll")
+#else
+#define DCT_UNROLL
+#endif
+
+#define DCT_DEFINE_SIZED(N)                                                      \
+static double dct_basis_##N[N][N];                                              \
+static int dct_basis_##N##_ready = 0;                                           \
+                                                                                \
+static void dct_init_basis_##N(void) {                                          \
+    if (dct_basis_##N##_ready) return;                                          \
+    for (int u = 0; u < N; u++) {                                               \
+        double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;                           \
+        for (int x = 0; x < N; x++) {                                           \
+            dct_basis_##N[u][x] = sqrt(2.0 / N) * cu *                          \
+                                  cos(((2 * x + 1) * u * DCT_PI) / (2.0 * N));  \
+        }                                                                       \
+    }                                                                           \
+    dct_basis_##N##_ready = 1;                                                  \
+}                                                                               \
+                                                                                \
+static void dct_forward_##N(const double *src, int stride, double *dst) {       \
+    double tmp[N][N];                                                           \
+    for (int x = 0; x < N; x++) {                                               \
+        for (int v = 0; v < N; v++) {                                           \
+            double sum = 0.0;                                                   \
+            DCT_UNROLL                                                          \
+            for (int y = 0; y < N; y++) sum += src[x * stride + y] * dct_basis_##N[v][y]; \
+            tmp[x][v] = sum;                                                    \
+        }                                                                       \
+    }                                                                           \
+    for (int u = 0; u < N; u++) {                                               \
+        for (int v = 0; v < N; v++) {                                           \
+            double sum = 0.0;                                                   \
+            DCT_UNROLL                                                          \
+            for (int x = 0; x < N; x++) sum += dct_basis_##N[u][x] * tmp[x][v]; \
+            dst[u * N + v] = sum;                                               \
+        }                                                                       \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static void dct_inverse_##N(const double *src, double *dst, int stride) {       \
+    double tmp[N][N];                                                           \
+    for (int u = 0; u < N; u++) {                                               \
+        for (int y = 0; y < N; y++) {                                           \
+            double sum = 0.0;                                                   \
+            DCT_UNROLL                                                          \
+            for (int v = 0; v < N; v++) sum += src[u * N + v] * dct_basis_##N[v][y]; \
+            tmp[u][y] = sum;                                                    \
+        }                                                                       \
+    }                                                                           \
+    for (int x = 0; x < N; x++) {                                               \
+        for (int y = 0; y < N; y++) {                                           \
+            double sum = 0.0;                                                   \
+            DCT_UNROLL                                                          \
+            for (int u = 0; u < N; u++) sum += dct_basis_##N[u][x] * tmp[u][y]; \
+            dst[x * stride + y] = sum;                                          \
+        }                                                                       \
+    }                                                                           \
+}
+
+DCT_DEFINE_SIZED(4)
+DCT_DEFINE_SIZED(16)
+DCT_DEFINE_SIZED(32)
+
+int dct_block_size_supported(int n) {
+    return n == 4 || n == 8 || n == 16 || n == 32;
+}
+
+void forward_dct_plane_n(int n, const double *src, int stride, int width, int height, double *dst) {
+    void (*forward)(const double *, int, double *);
+    switch (n) {
+    case 4: dct_init_basis_4(); forward = dct_forward_4; break;
+    case 16: dct_init_basis_16(); forward = dct_forward_16; break;
+    case 32: dct_init_basis_32(); forward = dct_forward_32; break;
+    default: forward_dct_plane(src, stride, width, height, dst); return;
+    }
+
+    int blocks_x = (width + n - 1) / n, blocks_y = (height + n - 1) / n;
+    double edge[DCT_MAX_SIZE * DCT_MAX_SIZE];
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            double *out = dst + ((size_t)by * blocks_x + bx) * n * n;
+            if ((by + 1) * n <= height && (bx + 1) * n <= width) {
+                forward(src + (size_t)by * n * stride + bx * n, stride, out);
+                continue;
+            }
+            // Partial edge block, repeat the last row / column
+            for (int x = 0; x < n; x++) {
+                int i = by * n + x;
+                if (i >= height) i = height - 1;
+                for (int y = 0; y < n; y++) {
+                    int j = bx * n + y;
+                    if (j >= width) j = width - 1;
+                    edge[x * n + y] = src[(size_t)i * stride + j];
+                }
+            }
+            forward(edge, n, out);
+        }
+    }
+}
+
+void inverse_dct_plane_n(int n, const double *src, int width, int height, double *dst, int stride) {
+    void (*inverse)(const double *, double *, int);
+    switch (n) {
+    case 4: dct_init_basis_4(); inverse = dct_inverse_4; break;
+    case 16: dct_init_basis_16(); inverse = dct_inverse_16; break;
+    case 32: dct_init_basis_32(); inverse = dct_inverse_32; break;
+    default: inverse_dct_plane(src, width, height, dst, stride); return;
+    }
+
+    int blocks_x = (width + n - 1) / n, blocks_y = (height + n - 1) / n;
+    double edge[DCT_MAX_SIZE * DCT_MAX_SIZE];
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            const double *in = src + ((size_t)by * blocks_x + bx) * n * n;
+            if ((by + 1) * n <= height && (bx + 1) * n <= width) {
+                inverse(in, dst + (size_t)by * n * stride + bx * n, stride);
+                continue;
+            }
+            inverse(in, edge, n);
+            for (int x = 0; x < n && by * n + x < height; x++) {
+                for (int y = 0; y < n && bx * n + y < width; y++) {
+                    dst[(size_t)(by * n + x) * stride + bx * n + y] = edge[x * n + y];
+                }
+            }
+        }
+    }
+}
+
+void dct_set_engine(dct_engine engine) {
+    dct_row_kernel = forward_dct_row_generic;
+    idct_row_kernel = inverse_dct_row_generic;
+    dct_quant_row_kernel = forward_dct_quantize_row_generic;
+    switch (engine) {
+    case DCT_ENGINE_AAN:
+        dct_forward = dct_aan;
+        dct_inverse = idct_aan;
+        break;
+    case DCT_ENGINE_FIXED:
+        dct_forward = dct_fixed;
+        dct_inverse = idct_fixed;
+        break;
+    case DCT_ENGINE_SIMD:
+        dct_forward = dct_aan;
+        dct_inverse = idct_aan;
+#ifdef DCT_X86_SIMD
+        if (dct_cpu_features() & DCT_CPU_AVX2) {
+            dct_forward = dct_avx2;
+            dct_inverse = idct_avx2;
+            dct_row_kernel = forward_dct_row_avx2;
+            idct_row_kernel = inverse_dct_row_avx2;
+            dct_quant_row_kernel = forward_dct_quantize_row_avx2;
+        } else if (dct_cpu_features() & DCT_CPU_SSE2) {
+            dct_forward = dct_sse2;
+            dct_inverse = idct_sse2;
+        }
+#endif
+        break;
+    default:
+        dct_forward = dct;
+        dct_inverse = idct;
+        break;
+    }
+}
+
+int dct_select_engine(const char *name) {
+    if (strcmp(name, "table") == 0) dct_set_engine(DCT_ENGINE_TABLE);
+    else if (strcmp(name, "aan") == 0) dct_set_engine(DCT_ENGINE_AAN);
+    else if (strcmp(name, "fixed") == 0) dct_set_engine(DCT_ENGINE_FIXED);
+    else if (strcmp(name, "simd") == 0) dct_set_engine(DCT_ENGINE_SIMD);
+    else return 0;
+    return 1;
+}
+
+#endif // DCT_TRANSFORM_IMPLEMENTATION_DONE
+#endif // DCT_TRANSFORM_IMPLEMENTATION
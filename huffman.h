@@ -0,0 +1,702 @@
+/* huffman.h - JPEG-style Huffman coding of quantized 8x8 blocks
+
+   Do this:
+      #define HUFFMAN_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+   Needs rle.h (with RLE_IMPLEMENTATION defined in the same program).
+
+   Each block codes the DC difference from the previous block of the
+   channel as a size category plus extra bits, then its zigzag (run, level)
+   pairs as run/size symbols plus extra bits, with ZRL (0xF0) for every 16
+   zeros of a longer run and EOB (0x00) from rle.h. The default tables are
+   the ones in Annex K of the JPEG standard.
+
+   bit_writer collects codes MSB-first in a 64-bit register and moves them
+   to the buffer 32 bits at a time. Every 0xFF byte is followed by a 0x00
+   (JPEG byte stuffing), done without branching on the data: each byte is
+   stored, a zero is stored after it, and the write position moves past the
+   zero only when the byte was 0xFF.
+
+   For a per-image table, huff_count_blocks() gathers the DC and AC symbol
+   histograms from the quantized blocks (the same symbols the encoder will
+   emit) and huff_build_spec() turns them into an optimal code limited to
+   16 bits, using the procedure of JPEG Annex K.2.
+
+   Decoding peeks HUFF_LOOKUP_BITS (11) bits at a time from a 64-bit buffer
+   that is refilled with up to 7 bytes at once whenever none of the next 8
+   is 0xFF (byte by byte, undoing the stuffing, otherwise). A code of up to
+   11 bits is one lookup in huff_decoder.lookup. For AC the ac table goes
+   further: an entry holds the whole coefficient (code plus extra bits)
+   when that fits in the 11 bits, and a second one when the rest of the
+   bits hold it too, so runs of short codes decode two per lookup. Longer
+   codes fall back to the canonical maxcode walk of Annex F.2.2.3.
+*/
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <stddef.h>
+
+// JPEG BITS/HUFFVAL form: bits[l] codes of length l (1..16), bits[0] unused,
+// values listed in order of increasing code length
+typedef struct {
+    unsigned char bits[17];
+    unsigned char values[256];
+} huff_spec;
+
+// Encoder form: code and length per symbol, size 0 when the symbol has no code
+typedef struct {
+    unsigned short code[256];
+    unsigned char size[256];
+} huff_code;
+
+typedef struct {
+    unsigned long long accumulator;   // pending bits, right-aligned
+    int bits;                         // number of pending bits, < 32 between calls
+    int stuffing;                     // 1: JPEG 0xFF 0x00 stuffing, 0: plain bits
+    unsigned char *buffer;
+    size_t size;
+    size_t capacity;
+} bit_writer;
+
+extern const huff_spec huff_dc_luminance;
+extern const huff_spec huff_ac_luminance;
+extern const huff_spec huff_dc_chrominance;
+extern const huff_spec huff_ac_chrominance;
+
+void huff_build_code(const huff_spec *spec, huff_code *code);
+
+// Symbol frequencies for huff_build_spec(): HUFF_FREQ_SIZE entries, the last
+// one reserved so that no real symbol gets the all-ones code
+#define HUFF_FREQ_SIZE 257
+
+// Add the symbol counts of a block-major channel of 8x8 blocks to dc_freq
+// and ac_freq (callers zero them first); *dc_predictor as for huff_encode_blocks()
+void huff_count_blocks(const short *coefficients, size_t blocks, int *dc_predictor, long *dc_freq, long *ac_freq);
+
+// Optimal code lengths for freq, limited to 16 bits
+void huff_build_spec(const long *freq, huff_spec *spec);
+
+void bit_writer_init(bit_writer *w);
+// Same writer without byte stuffing, for bit streams outside a JPEG scan
+void bit_writer_init_raw(bit_writer *w);
+// Append the low count bits of value, count 0..32
+void bit_writer_put(bit_writer *w, unsigned int value, int count);
+// Pad the last byte with 1 bits and write out everything pending
+void bit_writer_finish(bit_writer *w);
+// bit_writer_finish(), then the two marker bytes 0xFF, marker without
+// stuffing (RSTn inside a JPEG scan)
+void bit_writer_marker(bit_writer *w, int marker);
+void bit_writer_free(bit_writer *w);
+
+// Code a block-major channel of 8x8 blocks. *dc_predictor is the previous
+// DC value (0 at the start of a scan) and is updated to the last block's DC.
+// A NULL dc_predictor codes block[0] as the difference itself, for DC that
+// dc_predict.h has already predicted.
+void huff_encode_blocks(bit_writer *w, const short *coefficients, size_t blocks,
+                        const huff_code *dc, const huff_code *ac, int *dc_predictor);
+
+// Decoding: codes up to this long resolve with one table lookup
+#define HUFF_LOOKUP_BITS 11
+
+// run of a huff_ac_entry that ends the block
+#define HUFF_RUN_EOB 0xFF
+
+// Whole AC coefficients found in the next HUFF_LOOKUP_BITS bits: ZRL is run
+// 15 with level 0, length[0] == 0 means the first one is not resolved here
+// and length[1] == 0 that there is no second one
+typedef struct {
+    short level[2];
+    unsigned char run[2];
+    unsigned char length[2];   // code plus extra bits
+} huff_ac_entry;
+
+typedef struct {
+    unsigned short lookup[1 << HUFF_LOOKUP_BITS];   // symbol | length << 8, 0 for longer codes
+    huff_ac_entry ac[1 << HUFF_LOOKUP_BITS];         // used for AC tables
+    int maxcode[17];                                 // largest code of each length, -1 for none
+    int valoffset[17];                               // values[] index of code c of length l is c + valoffset[l]
+    unsigned char values[256];
+} huff_decoder;
+
+typedef struct {
+    unsigned long long buffer;   // next bits of the scan, MSB first
+    int bits;                    // valid bits in buffer
+    const unsigned char *p;
+    const unsigned char *end;
+    int overrun;                 // zero bytes fed past the end of the scan (or a marker)
+} huff_reader;
+
+// 1 if spec can be decoded: at most 256 symbols, no length with more codes
+// than the shorter ones leave room for, and for a DC table (dc set) no size
+// category above 16. Tables read from a file must pass before use; inline
+// so that coeff_file.h can check them without the implementation.
+static inline int huff_spec_valid(const huff_spec *spec, int dc) {
+    // Canonical codes of length l run from code to code + bits[l] - 1 and
+    // must fit in l bits; an over-subscribed table would index past lookup[]
+    int code = 0, count = 0;
+    for (int l = 1; l <= 16; l++) {
+        if (code + spec->bits[l] > (1 << l)) return 0;
+        code = (code + spec->bits[l]) << 1;
+        count += spec->bits[l];
+    }
+    if (count > 256) return 0;
+    for (int k = 0; dc && k < count; k++) {
+        if (spec->values[k] > 16) return 0;
+    }
+    return 1;
+}
+
+// 0, with d unusable, when spec is not huff_spec_valid()
+int huff_build_decoder(const huff_spec *spec, huff_decoder *d);
+
+void huff_reader_init(huff_reader *r, const unsigned char *data, size_t size);
+
+// One 8x8 block in raster order (zeroed first); dc_predictor as for
+// huff_encode_blocks(). Returns 0 on a corrupt code, a run past the end of
+// the block or a code that needed bits past the end of the scan, else one
+// more than the last zigzag position decoded, so 1 means a DC-only block.
+int huff_decode_block(huff_reader *r, const huff_decoder *dc, const huff_decoder *ac, int *dc_predictor, short *block);
+
+// Consecutive blocks of a block-major channel; 1 on success, 0 on a corrupt scan
+int huff_decode_blocks(huff_reader *r, short *coefficients, size_t blocks,
+                       const huff_decoder *dc, const huff_decoder *ac, int *dc_predictor);
+
+// 1 if the last block decoded ended the scan (or the indexed segment the
+// reader was given): every byte used and only bit_writer_finish()'s 1-bit
+// padding left over. A scan that decodes cleanly but stops short or runs
+// on is corrupt.
+int huff_reader_finished(const huff_reader *r);
+
+#endif // HUFFMAN_H
+
+#ifdef HUFFMAN_IMPLEMENTATION
+#ifndef HUFFMAN_IMPLEMENTATION_DONE
+#define HUFFMAN_IMPLEMENTATION_DONE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const huff_spec huff_dc_luminance = {
+    {0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}
+};
+
+const huff_spec huff_dc_chrominance = {
+    {0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}
+};
+
+const huff_spec huff_ac_luminance = {
+    {0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+    {0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+     0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+     0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+     0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+     0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+     0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+     0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+     0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+     0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+     0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+     0xf9, 0xfa}
+};
+
+const huff_spec huff_ac_chrominance = {
+    {0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77},
+    {0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+     0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+     0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+     0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+     0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+     0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+     0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+     0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+     0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+     0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+     0xf9, 0xfa}
+};
+
+// Canonical codes as in JPEG Annex C: consecutive values within a length,
+// shifted left by one between lengths
+void huff_build_code(const huff_spec *spec, huff_code *code) {
+    memset(code->size, 0, sizeof(code->size));
+    unsigned int next = 0;
+    int k = 0;
+    for (int length = 1; length <= 16; length++) {
+        for (int i = 0; i < spec->bits[length]; i++) {
+            unsigned char symbol = spec->values[k++];
+            code->code[symbol] = (unsigned short)next++;
+            code->size[symbol] = (unsigned char)length;
+        }
+        next <<= 1;
+    }
+}
+
+void bit_writer_init(bit_writer *w) {
+    w->accumulator = 0;
+    w->bits = 0;
+    w->stuffing = 1;
+    w->size = 0;
+    w->capacity = 1 << 16;
+    w->buffer = (unsigned char *)malloc(w->capacity);
+    if (w->buffer == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+}
+
+void bit_writer_init_raw(bit_writer *w) {
+    bit_writer_init(w);
+    w->stuffing = 0;
+}
+
+void bit_writer_free(bit_writer *w) {
+    free(w->buffer);
+    w->buffer = NULL;
+    w->size = w->capacity = 0;
+}
+
+// Room for one stuffed word: 4 bytes and up to 4 stuffed zeros
+static void bit_writer_reserve(bit_writer *w) {
+    if (w->size + 8 > w->capacity) {
+        w->capacity *= 2;
+        w->buffer = (unsigned char *)realloc(w->buffer, w->capacity);
+        if (w->buffer == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+}
+
+// Store the top count bytes of word, stuffing a 0x00 after each 0xFF
+// unless the writer is raw
+static void bit_writer_bytes(bit_writer *w, unsigned int word, int count) {
+    bit_writer_reserve(w);
+    unsigned char *p = w->buffer + w->size;
+    for (int i = 0; i < count; i++) {
+        unsigned char byte = (unsigned char)(word >> (24 - 8 * i));
+        p[0] = byte;
+        p[1] = 0;
+        p += 1 + ((byte == 0xFF) & w->stuffing);
+    }
+    w->size = (size_t)(p - w->buffer);
+}
+
+void bit_writer_put(bit_writer *w, unsigned int value, int count) {
+    w->accumulator = (w->accumulator << count) | (value & (unsigned int)((1ull << count) - 1));
+    w->bits += count;
+    if (w->bits >= 32) {
+        w->bits -= 32;
+        bit_writer_bytes(w, (unsigned int)(w->accumulator >> w->bits), 4);
+    }
+}
+
+void bit_writer_finish(bit_writer *w) {
+    int pad = (8 - (w->bits & 7)) & 7;
+    bit_writer_put(w, (1u << pad) - 1, pad);
+    if (w->bits > 0) {
+        unsigned int word = (unsigned int)(w->accumulator << (32 - w->bits));
+        bit_writer_bytes(w, word, w->bits / 8);
+        w->bits = 0;
+    }
+}
+
+void bit_writer_marker(bit_writer *w, int marker) {
+    bit_writer_finish(w);
+    bit_writer_reserve(w);
+    w->buffer[w->size++] = 0xFF;
+    w->buffer[w->size++] = (unsigned char)marker;
+}
+
+// Size category: number of bits in |v|, 0 for 0
+static int huff_magnitude_bits(int v) {
+    unsigned int magnitude = (unsigned int)(v < 0 ? -v : v);
+#if defined(__GNUC__) || defined(__clang__)
+    return magnitude ? 32 - __builtin_clz(magnitude) : 0;
+#else
+    int bits = 0;
+    while (magnitude) {
+        magnitude >>= 1;
+        bits++;
+    }
+    return bits;
+#endif
+}
+
+// Huffman code of symbol followed by the size extra bits of v
+// (v itself when positive, v - 1 when negative, low size bits)
+static void huff_put_symbol(bit_writer *w, const huff_code *table, int symbol, int v, int size) {
+    unsigned int extra = (unsigned int)(v - (v < 0)) & ((1u << size) - 1);
+    bit_writer_put(w, ((unsigned int)table->code[symbol] << size) | extra, table->size[symbol] + size);
+}
+
+// Baseline has no AC size above 10
+static int huff_clamp_level(int level) {
+    if (level > 1023) return 1023;
+    if (level < -1023) return -1023;
+    return level;
+}
+
+void huff_encode_blocks(bit_writer *w, const short *coefficients, size_t blocks,
+                        const huff_code *dc, const huff_code *ac, int *dc_predictor) {
+    rle_pair pairs[RLE_MAX_PAIRS];
+    for (size_t b = 0; b < blocks; b++) {
+        const short *block = coefficients + b * RLE_BLOCK;
+
+        int diff = dc_predictor ? block[0] - *dc_predictor : block[0];
+        if (dc_predictor) *dc_predictor = block[0];
+        huff_put_symbol(w, dc, huff_magnitude_bits(diff), diff, huff_magnitude_bits(diff));
+
+        int count = rle_encode_block(block, pairs);
+        for (int i = 0; i < count; i++) {
+            if (RLE_IS_EOB(pairs[i])) {
+                bit_writer_put(w, ac->code[0x00], ac->size[0x00]);
+                break;
+            }
+            int run = pairs[i].run;
+            while (run > 15) {
+                bit_writer_put(w, ac->code[0xF0], ac->size[0xF0]);
+                run -= 16;
+            }
+            int level = huff_clamp_level(pairs[i].level);
+            int size = huff_magnitude_bits(level);
+            huff_put_symbol(w, ac, (run << 4) | size, level, size);
+        }
+    }
+}
+
+// Mirrors huff_encode_blocks() symbol for symbol. Counts go to four
+// interleaved sub-histograms so back-to-back hits on the same symbol
+// (EOB and small DC sizes, mostly) do not wait on each other's increments.
+void huff_count_blocks(const short *coefficients, size_t blocks, int *dc_predictor, long *dc_freq, long *ac_freq) {
+    long dc_count[4][16] = {{0}};
+    long ac_count[4][256] = {{0}};
+    rle_pair pairs[RLE_MAX_PAIRS];
+    for (size_t b = 0; b < blocks; b++) {
+        const short *block = coefficients + b * RLE_BLOCK;
+
+        dc_count[b & 3][huff_magnitude_bits(dc_predictor ? block[0] - *dc_predictor : block[0])]++;
+        if (dc_predictor) *dc_predictor = block[0];
+
+        int count = rle_encode_block(block, pairs);
+        for (int i = 0; i < count; i++) {
+            int lane = i & 3;
+            if (RLE_IS_EOB(pairs[i])) {
+                ac_count[lane][0x00]++;
+                break;
+            }
+            int run = pairs[i].run;
+            ac_count[lane][0xF0] += run >> 4;
+            run &= 15;
+            ac_count[lane][(run << 4) | huff_magnitude_bits(huff_clamp_level(pairs[i].level))]++;
+        }
+    }
+    for (int lane = 0; lane < 4; lane++) {
+        for (int k = 0; k < 16; k++) dc_freq[k] += dc_count[lane][k];
+        for (int k = 0; k < 256; k++) ac_freq[k] += ac_count[lane][k];
+    }
+}
+
+// Deepest possible tree over HUFF_FREQ_SIZE symbols, before length limiting
+#define HUFF_MAX_CODE_LENGTH (HUFF_FREQ_SIZE - 1)
+
+void huff_build_spec(const long *freq, huff_spec *spec) {
+    long count[HUFF_FREQ_SIZE];
+    int code_size[HUFF_FREQ_SIZE];
+    int others[HUFF_FREQ_SIZE];
+    int bits[HUFF_MAX_CODE_LENGTH + 1] = {0};
+
+    for (int i = 0; i < HUFF_FREQ_SIZE; i++) {
+        count[i] = freq[i];
+        code_size[i] = 0;
+        others[i] = -1;
+    }
+    count[HUFF_FREQ_SIZE - 1] = 1;
+
+    // Merge the two least frequent trees until one is left, tracking each
+    // symbol's depth (ties go to the larger symbol, as in Annex K.2)
+    for (;;) {
+        int c1 = -1, c2 = -1;
+        long v1 = 0, v2 = 0;
+        for (int i = 0; i < HUFF_FREQ_SIZE; i++) {
+            if (count[i] && (c1 < 0 || count[i] <= v1)) {
+                v1 = count[i];
+                c1 = i;
+            }
+        }
+        for (int i = 0; i < HUFF_FREQ_SIZE; i++) {
+            if (count[i] && i != c1 && (c2 < 0 || count[i] <= v2)) {
+                v2 = count[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) break;
+
+        count[c1] += count[c2];
+        count[c2] = 0;
+        code_size[c1]++;
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            code_size[c1]++;
+        }
+        others[c1] = c2;
+        code_size[c2]++;
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            code_size[c2]++;
+        }
+    }
+
+    for (int i = 0; i < HUFF_FREQ_SIZE; i++) {
+        if (code_size[i]) bits[code_size[i]]++;
+    }
+
+    // Limit lengths to 16: move pairs of over-long codes up, splitting a shorter code
+    for (int i = HUFF_MAX_CODE_LENGTH; i > 16; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) j--;
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+    // Drop the reserved symbol, which holds the longest code
+    int longest = 16;
+    while (bits[longest] == 0) longest--;
+    bits[longest]--;
+
+    memset(spec, 0, sizeof(*spec));
+    for (int i = 1; i <= 16; i++) spec->bits[i] = (unsigned char)bits[i];
+    int k = 0;
+    for (int length = 1; length <= HUFF_MAX_CODE_LENGTH; length++) {
+        for (int symbol = 0; symbol < HUFF_FREQ_SIZE - 1; symbol++) {
+            if (code_size[symbol] == length) spec->values[k++] = (unsigned char)symbol;
+        }
+    }
+}
+
+// Decoding
+
+// Symbol for the code at the top of bits (available bits, MSB first) with
+// its length, or -1 when no code fits in them
+static int huff_peek_symbol(const huff_decoder *d, unsigned int bits, int available, int *length) {
+    for (int l = 1; l <= available && l <= 16; l++) {
+        int code = (int)(bits >> (available - l));
+        if (code <= d->maxcode[l]) {
+            *length = l;
+            return d->values[code + d->valoffset[l]];
+        }
+    }
+    return -1;
+}
+
+// Extra bits of a size category back to the signed value
+static int huff_extend(unsigned int bits, int size) {
+    return size && bits < (1u << (size - 1)) ? (int)bits - (1 << size) + 1 : (int)bits;
+}
+
+// One AC coefficient from the top of bits; returns the bits it takes, 0 when
+// it does not fit or the symbol is not a valid AC symbol
+static int huff_peek_coefficient(const huff_decoder *d, unsigned int bits, int available,
+                                 unsigned char *run, short *level) {
+    int length;
+    int symbol = huff_peek_symbol(d, bits, available, &length);
+    if (symbol < 0) return 0;
+    int size = symbol & 15;
+    if (size == 0) {
+        if (symbol != 0x00 && symbol != 0xF0) return 0;
+        *run = symbol == 0x00 ? HUFF_RUN_EOB : 15;
+        *level = 0;
+        return length;
+    }
+    if (length + size > available) return 0;
+    *run = (unsigned char)(symbol >> 4);
+    *level = (short)huff_extend((bits >> (available - length - size)) & ((1u << size) - 1), size);
+    return length + size;
+}
+
+int huff_build_decoder(const huff_spec *spec, huff_decoder *d) {
+    if (!huff_spec_valid(spec, 0)) return 0;
+    memset(d->lookup, 0, sizeof(d->lookup));
+    int count = 0;
+    for (int l = 1; l <= 16; l++) count += spec->bits[l];
+    memcpy(d->values, spec->values, (size_t)count);
+
+    // Canonical codes, as huff_build_code() assigns them
+    int code = 0, k = 0;
+    d->maxcode[0] = -1;
+    d->valoffset[0] = 0;
+    for (int l = 1; l <= 16; l++) {
+        d->valoffset[l] = k - code;
+        d->maxcode[l] = spec->bits[l] ? code + spec->bits[l] - 1 : -1;
+        for (int i = 0; i < spec->bits[l] && k < count; i++, k++, code++) {
+            if (l > HUFF_LOOKUP_BITS) continue;
+            int first = code << (HUFF_LOOKUP_BITS - l);
+            for (int j = 0; j < (1 << (HUFF_LOOKUP_BITS - l)); j++) {
+                d->lookup[first + j] = (unsigned short)(spec->values[k] | (l << 8));
+            }
+        }
+        code <<= 1;
+    }
+
+    for (unsigned int bits = 0; bits < (1u << HUFF_LOOKUP_BITS); bits++) {
+        huff_ac_entry *e = &d->ac[bits];
+        memset(e, 0, sizeof(*e));
+        e->length[0] = (unsigned char)huff_peek_coefficient(d, bits, HUFF_LOOKUP_BITS, &e->run[0], &e->level[0]);
+        int rest = HUFF_LOOKUP_BITS - e->length[0];
+        if (e->length[0] == 0 || e->run[0] == HUFF_RUN_EOB || rest == 0) continue;
+        e->length[1] = (unsigned char)huff_peek_coefficient(d, bits & ((1u << rest) - 1), rest, &e->run[1], &e->level[1]);
+    }
+    return 1;
+}
+
+void huff_reader_init(huff_reader *r, const unsigned char *data, size_t size) {
+    r->buffer = 0;
+    r->bits = 0;
+    r->p = data;
+    r->end = data + size;
+    r->overrun = 0;
+}
+
+static unsigned long long huff_load_be64(const unsigned char *p) {
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    unsigned long long v;
+    memcpy(&v, p, 8);
+    return __builtin_bswap64(v);
+#else
+    unsigned long long v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+#endif
+}
+
+// Top the buffer up to at least 57 bits. Called with bits < 32.
+static void huff_refill(huff_reader *r) {
+    if (r->end - r->p >= 8) {
+        unsigned long long v = huff_load_be64(r->p);
+        unsigned long long inverted = ~v;
+        // No 0xFF among the 8 bytes: take as many whole bytes as fit in one go
+        if (!((inverted - 0x0101010101010101ull) & ~inverted & 0x8080808080808080ull)) {
+            int n = (63 - r->bits) >> 3;
+            r->buffer |= (v >> (64 - 8 * n)) << (64 - 8 * n - r->bits);
+            r->bits += 8 * n;
+            r->p += n;
+            return;
+        }
+    }
+    while (r->bits <= 56) {
+        unsigned int byte = 0;
+        if (r->p < r->end && (*r->p != 0xFF || (r->p + 1 < r->end && r->p[1] == 0x00))) {
+            byte = *r->p;
+            r->p += byte == 0xFF ? 2 : 1;   // 0xFF 0x00 is a stuffed 0xFF
+        } else {
+            r->overrun++;                   // end of the scan or a marker: zeros from here
+        }
+        r->buffer |= (unsigned long long)byte << (56 - r->bits);
+        r->bits += 8;
+    }
+}
+
+static void huff_skip(huff_reader *r, int count) {
+    r->buffer <<= count;
+    r->bits -= count;
+}
+
+// Next symbol; the buffer holds at least 16 bits
+static int huff_decode_symbol(huff_reader *r, const huff_decoder *d) {
+    unsigned int entry = d->lookup[r->buffer >> (64 - HUFF_LOOKUP_BITS)];
+    if (entry) {
+        huff_skip(r, (int)(entry >> 8));
+        return (int)(entry & 0xFF);
+    }
+    int length;
+    int symbol = huff_peek_symbol(d, (unsigned int)(r->buffer >> 48), 16, &length);
+    if (symbol >= 0) huff_skip(r, length);
+    return symbol;
+}
+
+// size extra bits, size <= 16, as a signed value
+static int huff_receive(huff_reader *r, int size) {
+    if (size == 0) return 0;
+    unsigned int bits = (unsigned int)(r->buffer >> (64 - size));
+    huff_skip(r, size);
+    return huff_extend(bits, size);
+}
+
+int huff_decode_block(huff_reader *r, const huff_decoder *dc, const huff_decoder *ac, int *dc_predictor, short *block) {
+    memset(block, 0, RLE_BLOCK * sizeof(short));
+
+    // Refilled to >= 32 bits before each code: room for a 16-bit code and 16 extra bits
+    if (r->bits < 32) huff_refill(r);
+    int size = huff_decode_symbol(r, dc);
+    if (size < 0 || size > 16) return 0;
+    int diff = huff_receive(r, size);
+    if (dc_predictor) {
+        *dc_predictor += diff;
+        diff = *dc_predictor;
+    }
+    block[0] = (short)diff;
+
+    int k = 1;
+    while (k < RLE_BLOCK) {
+        if (r->bits < 32) huff_refill(r);
+        const huff_ac_entry *e = &ac->ac[r->buffer >> (64 - HUFF_LOOKUP_BITS)];
+        if (e->length[0]) {
+            huff_skip(r, e->length[0]);
+            if (e->run[0] == HUFF_RUN_EOB) break;
+            k += e->run[0];
+            if (k >= RLE_BLOCK) return 0;
+            block[rle_zigzag[k++]] = e->level[0];
+
+            // The second one only belongs to this block if the first did not end it
+            if (e->length[1] == 0 || k >= RLE_BLOCK) continue;
+            huff_skip(r, e->length[1]);
+            if (e->run[1] == HUFF_RUN_EOB) break;
+            k += e->run[1];
+            if (k >= RLE_BLOCK) return 0;
+            block[rle_zigzag[k++]] = e->level[1];
+            continue;
+        }
+
+        int symbol = huff_decode_symbol(r, ac);
+        if (symbol < 0) return 0;
+        int run = symbol >> 4;
+        size = symbol & 15;
+        if (size == 0) {
+            if (symbol == 0x00) break;
+            if (symbol != 0xF0) return 0;
+            k += 16;   // ZRL: 16 zeros, which must still fit in the block
+            if (k > RLE_BLOCK) return 0;
+            continue;
+        }
+        k += run;
+        if (k >= RLE_BLOCK) return 0;
+        block[rle_zigzag[k++]] = (short)huff_receive(r, size);
+    }
+
+    // The zero bytes fed past the end sit at the bottom of the buffer; more
+    // of them than there are bits left means this block consumed some
+    if (r->overrun * 8 > r->bits) return 0;
+    return k;
+}
+
+int huff_decode_blocks(huff_reader *r, short *coefficients, size_t blocks,
+                       const huff_decoder *dc, const huff_decoder *ac, int *dc_predictor) {
+    for (size_t b = 0; b < blocks; b++) {
+        if (!huff_decode_block(r, dc, ac, dc_predictor, coefficients + b * RLE_BLOCK)) return 0;
+    }
+    return 1;
+}
+
+int huff_reader_finished(const huff_reader *r) {
+    int left = r->bits - r->overrun * 8;   // scan bits still unread
+    if (r->p != r->end || left < 0 || left >= 8) return 0;
+    unsigned int padding = (1u << left) - 1;
+    return left == 0 || (unsigned int)(r->buffer >> (64 - left)) == padding;
+}
+
+#endif // HUFFMAN_IMPLEMENTATION_DONE
+#endif // HUFFMAN_IMPLEMENTATION
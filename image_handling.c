@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#define PLANE_IMPLEMENTATION
+#include "plane.h"
 #include "stb_image.h"
 #define STB_IMAGE_IMPLEMENTATION
 
@@ -7991,59 +7994,51 @@ ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
 WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 ------------------------------------------------------------------------------
 */
-unsigned char** create_matrix(int height, int width, int channels) {
-    unsigned char **matrix = malloc(height * sizeof(unsigned char*));
-    for (int i = 0; i < height; i++) {
-        matrix[i] = malloc(width * channels * sizeof(unsigned char));
+void create_matrix(plane_u8 *matrix, int height, int width, int channels) {
+    if (!plane_u8_create(matrix, width * channels, height, 1)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
-    return matrix;
 }
 
-void free_matrix(unsigned char **matrix, int height) {
+void populate_matrix(plane_u8 *matrix, unsigned char *image_data, int width, int height, int channels) {
     for (int i = 0; i < height; i++) {
-        free(matrix[i]);
-    }
-    free(matrix);
-}
-
-void populate_matrix(unsigned char **matrix, unsigned char *image_data, int width, int height, int channels) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int index = (i * width + j) * channels; // Calculate the index in the flat array
-            for (int c = 0; c < channels; c++) {
-                matrix[i][j * channels + c] = image_data[index + c]; // Copy each channel
-            }
-        }
+        // Each image row is one contiguous run of width * channels bytes
+        memcpy(plane_u8_row(matrix, i), image_data + (size_t)i * width * channels, (size_t)width * channels);
     }
 }
-void print_image_matrix(FILE *file,unsigned char **matrix, int width, int height, int channels) {
+void print_image_matrix(FILE *file,const plane_u8 *matrix, int width, int height, int channels) {
     for (int i = 0; i < height; i++) {
+        const unsigned char *row = plane_u8_row(matrix, i);
         for (int j = 0; j < width; j++) {
-            fprintf(file,"(%d, %d, %d) ", matrix[i][j * channels], matrix[i][j * channels + 1], matrix[i][j * channels + 2]);
+            fprintf(file,"(%d, %d, %d) ", row[j * channels], row[j * channels + 1], row[j * channels + 2]);
         }
         printf("\n");
     }
 }
-void print_image_chennelsred(FILE *file,unsigned char **matrix, int width, int height, int channels) {
+void print_image_chennelsred(FILE *file,const plane_u8 *matrix, int width, int height, int channels) {
     for (int i = 0; i < height; i++) {
+        const unsigned char *row = plane_u8_row(matrix, i);
         for (int j = 0; j < width; j++) {
-            fprintf(file,"%d ", matrix[i][j * channels]);
+            fprintf(file,"%d ", row[j * channels]);
         }
         fprintf(file,"\n");
     }
 }
-void print_image_chennelsgreen(FILE *file,unsigned char **matrix, int width, int height, int channels) {
+void print_image_chennelsgreen(FILE *file,const plane_u8 *matrix, int width, int height, int channels) {
     for (int i = 0; i < height; i++) {
+        const unsigned char *row = plane_u8_row(matrix, i);
         for (int j = 0; j < width; j++) {
-            fprintf(file,"%d ", matrix[i][j * channels + 1]);
+            fprintf(file,"%d ", row[j * channels + 1]);
         }
         fprintf(file,"\n");
     }
 }
-void print_image_chennelsblue(FILE *file,unsigned char **matrix, int width, int height, int channels) {
+void print_image_chennelsblue(FILE *file,const plane_u8 *matrix, int width, int height, int channels) {
     for (int i = 0; i < height; i++) {
+        const unsigned char *row = plane_u8_row(matrix, i);
         for (int j = 0; j < width; j++) {
-            fprintf(file,"%d ", matrix[i][j * channels + 2]);
+            fprintf(file,"%d ", row[j * channels + 2]);
         }
         fprintf(file,"\n");
     }
@@ -8060,8 +8055,9 @@ int main(){
     }
 
     // Create and populate the matrix
-    unsigned char **image_matrix = create_matrix(height, width, channels);
-    populate_matrix(image_matrix, image_data, width, height, channels);
+    plane_u8 image_matrix;
+    create_matrix(&image_matrix, height, width, channels);
+    populate_matrix(&image_matrix, image_data, width, height, channels);
     FILE *file1,*file2,*file3;
     file2 = fopen("matrixgreen.txt","w");
     file1 = fopen("matrixred.txt", "w");
@@ -8081,12 +8077,12 @@ int main(){
     }
     
     // Print the image matrix
-    print_image_chennelsred(file1,image_matrix, width, height, channels);
-    print_image_chennelsgreen(file2,image_matrix, width, height, (channels));
-    print_image_chennelsblue(file3,image_matrix, width, height, (channels));
+    print_image_chennelsred(file1,&image_matrix, width, height, channels);
+    print_image_chennelsgreen(file2,&image_matrix, width, height, (channels));
+    print_image_chennelsblue(file3,&image_matrix, width, height, (channels));
 
     // Free allocated memory
-    free_matrix(image_matrix, height);
+    plane_u8_free(&image_matrix);
     stbi_image_free(image_data);
     
     return 0;
@@ -0,0 +1,422 @@
+/* image_writer.h - streaming PPM/PGM, BMP and PNG writers
+
+   Do this:
+      #define IMAGE_WRITER_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   The writers take 8-bit greyscale or RGB rows top to bottom, any number
+   at a time, straight from the caller's buffer (a decoder strip, say),
+   and keep nothing but one converted row between calls:
+
+      PNM  binary P5 (grey) / P6 (RGB), rows as they are
+      BMP  top-down (negative height) 24-bit BGR, or 8-bit with a grey
+           palette, rows padded to 4 bytes
+      PNG  8-bit grey / RGB, one IDAT chunk per image_writer_put_rows()
+           call. The zlib stream is either stored blocks (no compression,
+           filter None) or, with IMAGE_PNG_RLE, the Sub filter followed
+           by fixed-Huffman deflate whose only matches are runs (distance
+           1), the zlib Z_RLE strategy: flat areas and DC-only blocks
+           become a few bits per run at a fraction of a real deflate's cost.
+
+   image_writer_format() picks the format from a file name's extension.
+*/
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define IMAGE_FORMAT_PNM 0
+#define IMAGE_FORMAT_BMP 1
+#define IMAGE_FORMAT_PNG 2
+
+#define IMAGE_PNG_STORE 0
+#define IMAGE_PNG_RLE 1
+
+typedef struct {
+    FILE *file;
+    int format;
+    int width, height, channels;
+    int png_mode;
+    int rows_written;
+    unsigned char *row;                 // one converted row (BMP, PNG)
+    unsigned char *buffer;              // PNG: compressed data of the pending IDAT
+    size_t size, capacity;
+    unsigned long long bits;            // PNG RLE: deflate bits, LSB first
+    int bit_count;
+    unsigned long adler_a, adler_b;     // zlib Adler-32 of the filtered rows
+    int error;
+} image_writer;
+
+// .ppm, .pgm and .pnm -> IMAGE_FORMAT_PNM, .bmp, .png; -1 for anything else
+int image_writer_format(const char *filename);
+
+// channels 1 (grey) or 3 (RGB). png_mode is IMAGE_PNG_STORE or
+// IMAGE_PNG_RLE, ignored for the other formats. All return 1 on success,
+// 0 on bad parameters or a write error.
+int image_writer_open(image_writer *w, FILE *file, int format, int width, int height, int channels, int png_mode);
+// rows rows of width * channels bytes, stride bytes apart
+int image_writer_put_rows(image_writer *w, const unsigned char *pixels, size_t stride, int rows);
+// Trailer (PNG: final deflate block, Adler-32, IEND); fails if fewer than
+// height rows were written. Frees the writer's buffers, not the file.
+int image_writer_close(image_writer *w);
+
+#endif // IMAGE_WRITER_H
+
+#ifdef IMAGE_WRITER_IMPLEMENTATION
+#ifndef IMAGE_WRITER_IMPLEMENTATION_DONE
+#define IMAGE_WRITER_IMPLEMENTATION_DONE
+
+#include <stdlib.h>
+#include <string.h>
+
+int image_writer_format(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (dot == NULL) return -1;
+    if (strcmp(dot, ".ppm") == 0 || strcmp(dot, ".pgm") == 0 || strcmp(dot, ".pnm") == 0) return IMAGE_FORMAT_PNM;
+    if (strcmp(dot, ".bmp") == 0) return IMAGE_FORMAT_BMP;
+    if (strcmp(dot, ".png") == 0) return IMAGE_FORMAT_PNG;
+    return -1;
+}
+
+static void image_put16le(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void image_put32le(unsigned char *p, unsigned long v) {
+    image_put16le(p, (unsigned int)(v & 0xffff));
+    image_put16le(p + 2, (unsigned int)(v >> 16));
+}
+
+static void image_put32be(unsigned char *p, unsigned long v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+// PNG chunks
+
+static unsigned long image_crc_table[256];
+static int image_crc_ready = 0;
+
+static unsigned long image_crc(unsigned long crc, const unsigned char *data, size_t size) {
+    if (!image_crc_ready) {
+        for (unsigned long n = 0; n < 256; n++) {
+            unsigned long c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+            image_crc_table[n] = c;
+        }
+        image_crc_ready = 1;
+    }
+    for (size_t i = 0; i < size; i++) crc = image_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static void image_png_chunk(image_writer *w, const char *type, const unsigned char *data, size_t size) {
+    unsigned char head[8], tail[4];
+    image_put32be(head, (unsigned long)size);
+    memcpy(head + 4, type, 4);
+    unsigned long crc = image_crc(0xFFFFFFFFUL, head + 4, 4);
+    crc = image_crc(crc, data, size) ^ 0xFFFFFFFFUL;
+    image_put32be(tail, crc);
+    // IEND has no data and passes NULL, which fwrite() must not see even for 0 bytes
+    if (fwrite(head, 1, 8, w->file) != 8 || (size > 0 && fwrite(data, 1, size, w->file) != size) ||
+        fwrite(tail, 1, 4, w->file) != 4) {
+        w->error = 1;
+    }
+}
+
+// Room for extra more bytes of deflate data; 0 (and w->error set) if the
+// writer has already failed or the buffer cannot grow. The old buffer is
+// kept either way and freed by image_writer_close().
+static int image_reserve(image_writer *w, size_t extra) {
+    if (w->error) return 0;
+    if (w->size + extra <= w->capacity) return 1;
+    size_t capacity = w->capacity;
+    while (w->size + extra > capacity) capacity = capacity ? 2 * capacity : 1 << 16;
+    unsigned char *buffer = (unsigned char *)realloc(w->buffer, capacity);
+    if (buffer == NULL) {
+        w->error = 1;
+        return 0;
+    }
+    w->buffer = buffer;
+    w->capacity = capacity;
+    return 1;
+}
+
+// Adler-32 in chunks short enough that the sums cannot overflow 32 bits
+static void image_adler(image_writer *w, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        size_t count = size < 5552 ? size : 5552;
+        for (size_t i = 0; i < count; i++) {
+            w->adler_a += data[i];
+            w->adler_b += w->adler_a;
+        }
+        w->adler_a %= 65521;
+        w->adler_b %= 65521;
+        data += count;
+        size -= count;
+    }
+}
+
+// Deflate bits go out LSB first; Huffman codes are stored bit-reversed
+static void image_put_bits(image_writer *w, unsigned int value, int count) {
+    if (w->error) return;
+    w->bits |= (unsigned long long)value << w->bit_count;
+    w->bit_count += count;
+    if (w->bit_count >= 32) {
+        if (!image_reserve(w, 4)) return;
+        image_put32le(w->buffer + w->size, (unsigned long)(w->bits & 0xFFFFFFFFUL));
+        w->size += 4;
+        w->bits >>= 32;
+        w->bit_count -= 32;
+    }
+}
+
+// Fixed Huffman code (RFC 1951 3.2.6) of literal/length symbol s, reversed, and its length
+static unsigned short image_fixed_code[288];
+static unsigned char image_fixed_length[288];
+// Length 3..258 to its symbol, extra bit count and extra value
+static unsigned short image_length_symbol[259];
+static unsigned char image_length_extra_bits[259];
+static unsigned char image_length_extra[259];
+static int image_deflate_ready = 0;
+
+static void image_deflate_init(void) {
+    if (image_deflate_ready) return;
+    for (int s = 0; s < 288; s++) {
+        int code, length;
+        if (s < 144) code = 0x30 + s, length = 8;
+        else if (s < 256) code = 0x190 + s - 144, length = 9;
+        else if (s < 280) code = s - 256, length = 7;
+        else code = 0xC0 + s - 280, length = 8;
+        int reversed = 0;
+        for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        image_fixed_code[s] = (unsigned short)reversed;
+        image_fixed_length[s] = (unsigned char)length;
+    }
+    static const unsigned short base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const unsigned char extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    for (int i = 0; i < 29; i++) {
+        int end = i == 28 ? 259 : base[i + 1];
+        for (int length = base[i]; length < end; length++) {
+            image_length_symbol[length] = (unsigned short)(257 + i);
+            image_length_extra_bits[length] = extra[i];
+            image_length_extra[length] = (unsigned char)(length - base[i]);
+        }
+    }
+    image_deflate_ready = 1;
+}
+
+static void image_put_symbol(image_writer *w, int symbol) {
+    image_put_bits(w, image_fixed_code[symbol], image_fixed_length[symbol]);
+}
+
+// One filtered row as runs and literals; a run repeats the byte before it (distance 1)
+static void image_deflate_rle(image_writer *w, const unsigned char *data, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        size_t run = 0;
+        if (i > 0) {
+            while (i + run < size && run < 258 && data[i + run] == data[i - 1]) run++;
+        }
+        if (run >= 3) {
+            image_put_symbol(w, image_length_symbol[run]);
+            image_put_bits(w, image_length_extra[run], image_length_extra_bits[run]);
+            image_put_bits(w, 0, 5);   // distance code 0: distance 1
+            i += run;
+        } else {
+            image_put_symbol(w, data[i++]);
+        }
+    }
+}
+
+// Stored blocks carry at most 65535 bytes each
+static void image_deflate_store(image_writer *w, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        size_t count = size < 65535 ? size : 65535;
+        if (!image_reserve(w, 5 + count)) return;
+        unsigned char *p = w->buffer + w->size;
+        p[0] = 0;   // BFINAL 0, BTYPE 00
+        image_put16le(p + 1, (unsigned int)count);
+        image_put16le(p + 3, (unsigned int)(~count & 0xFFFF));
+        memcpy(p + 5, data, count);
+        w->size += 5 + count;
+        data += count;
+        size -= count;
+    }
+}
+
+static void image_png_row(image_writer *w, const unsigned char *pixels) {
+    size_t bytes = (size_t)w->width * w->channels;
+    unsigned char *row = w->row;
+    if (w->png_mode == IMAGE_PNG_RLE) {
+        row[0] = 1;   // Sub: each byte minus the same channel of the pixel to its left
+        memcpy(row + 1, pixels, (size_t)w->channels);
+        for (size_t i = (size_t)w->channels; i < bytes; i++) row[1 + i] = (unsigned char)(pixels[i] - pixels[i - w->channels]);
+        image_adler(w, row, bytes + 1);
+        image_deflate_rle(w, row, bytes + 1);
+    } else {
+        row[0] = 0;
+        memcpy(row + 1, pixels, bytes);
+        image_adler(w, row, bytes + 1);
+        image_deflate_store(w, row, bytes + 1);
+    }
+}
+
+static int image_png_open(image_writer *w) {
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (fwrite(signature, 1, 8, w->file) != 8) return 0;
+    unsigned char ihdr[13];
+    image_put32be(ihdr, (unsigned long)w->width);
+    image_put32be(ihdr + 4, (unsigned long)w->height);
+    ihdr[8] = 8;                            // bit depth
+    ihdr[9] = w->channels == 1 ? 0 : 2;     // grey or truecolour
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;     // deflate, adaptive filtering, no interlace
+    image_png_chunk(w, "IHDR", ihdr, sizeof(ihdr));
+
+    image_deflate_init();
+    w->adler_a = 1;
+    w->adler_b = 0;
+    if (!image_reserve(w, 2)) return 0;
+    w->buffer[w->size++] = 0x78;            // zlib header: deflate, 32K window
+    w->buffer[w->size++] = 0x01;            // no dictionary, check bits
+    if (w->png_mode == IMAGE_PNG_RLE) image_put_bits(w, 2, 3);   // BFINAL 0, BTYPE 01 (fixed Huffman)
+    return !w->error;
+}
+
+static int image_png_close(image_writer *w) {
+    if (w->png_mode == IMAGE_PNG_RLE) {
+        image_put_symbol(w, 256);           // end of the fixed-Huffman block
+        image_put_bits(w, 3, 3);            // final block: BFINAL 1, BTYPE 01, empty
+        image_put_symbol(w, 256);
+        while (w->bit_count > 0) {
+            if (!image_reserve(w, 1)) return 0;
+            w->buffer[w->size++] = (unsigned char)w->bits;
+            w->bits >>= 8;
+            w->bit_count = w->bit_count > 8 ? w->bit_count - 8 : 0;
+        }
+    } else {
+        if (!image_reserve(w, 5)) return 0;
+        unsigned char *p = w->buffer + w->size;
+        p[0] = 1;                           // final, empty stored block
+        image_put16le(p + 1, 0);
+        image_put16le(p + 3, 0xFFFF);
+        w->size += 5;
+    }
+    if (!image_reserve(w, 4)) return 0;
+    image_put32be(w->buffer + w->size, (w->adler_b << 16) | w->adler_a);
+    w->size += 4;
+    image_png_chunk(w, "IDAT", w->buffer, w->size);
+    w->size = 0;
+    image_png_chunk(w, "IEND", NULL, 0);
+    return !w->error;
+}
+
+// BMP
+
+static int image_bmp_row_bytes(const image_writer *w) {
+    return (w->width * w->channels + 3) & ~3;
+}
+
+static int image_bmp_open(image_writer *w) {
+    int palette = w->channels == 1 ? 256 * 4 : 0;
+    unsigned long image_size = (unsigned long)image_bmp_row_bytes(w) * w->height;
+    unsigned char header[54 + 256 * 4];
+    memset(header, 0, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    image_put32le(header + 2, 54 + palette + image_size);
+    image_put32le(header + 10, 54 + (unsigned long)palette);
+    image_put32le(header + 14, 40);
+    image_put32le(header + 18, (unsigned long)w->width);
+    image_put32le(header + 22, (unsigned long)-w->height);   // negative: rows top-down, as they arrive
+    image_put16le(header + 26, 1);
+    image_put16le(header + 28, (unsigned int)(8 * w->channels));
+    image_put32le(header + 34, image_size);
+    image_put32le(header + 38, 2835);                       // 72 dpi
+    image_put32le(header + 42, 2835);
+    if (palette) {
+        image_put32le(header + 46, 256);
+        for (int i = 0; i < 256; i++) {
+            header[54 + 4 * i] = header[55 + 4 * i] = header[56 + 4 * i] = (unsigned char)i;
+        }
+    }
+    size_t size = 54 + (size_t)palette;
+    return fwrite(header, 1, size, w->file) == size;
+}
+
+static void image_bmp_row(image_writer *w, const unsigned char *pixels) {
+    int bytes = image_bmp_row_bytes(w);
+    unsigned char *row = w->row;
+    if (w->channels == 1) {
+        memcpy(row, pixels, (size_t)w->width);
+    } else {
+        for (int x = 0; x < w->width; x++) {
+            row[3 * x] = pixels[3 * x + 2];
+            row[3 * x + 1] = pixels[3 * x + 1];
+            row[3 * x + 2] = pixels[3 * x];
+        }
+    }
+    memset(row + w->width * w->channels, 0, (size_t)(bytes - w->width * w->channels));
+    if (fwrite(row, 1, (size_t)bytes, w->file) != (size_t)bytes) w->error = 1;
+}
+
+int image_writer_open(image_writer *w, FILE *file, int format, int width, int height, int channels, int png_mode) {
+    memset(w, 0, sizeof(*w));
+    w->file = file;
+    w->format = format;
+    w->width = width;
+    w->height = height;
+    w->channels = channels;
+    w->png_mode = png_mode;
+    if (width < 1 || height < 1 || (channels != 1 && channels != 3)) return 0;
+    if (format < IMAGE_FORMAT_PNM || format > IMAGE_FORMAT_PNG) return 0;
+    if (png_mode != IMAGE_PNG_STORE && png_mode != IMAGE_PNG_RLE) return 0;
+
+    if (format == IMAGE_FORMAT_PNM) {
+        return fprintf(file, "P%d\n%d %d\n255\n", channels == 1 ? 5 : 6, width, height) > 0;
+    }
+    // Room for the PNG filter byte or the BMP padding
+    w->row = (unsigned char *)malloc((size_t)width * channels + 4);
+    if (w->row == NULL) return 0;
+    return format == IMAGE_FORMAT_BMP ? image_bmp_open(w) : image_png_open(w);
+}
+
+int image_writer_put_rows(image_writer *w, const unsigned char *pixels, size_t stride, int rows) {
+    if (w->error || rows < 0 || w->rows_written + rows > w->height) return 0;
+    size_t bytes = (size_t)w->width * w->channels;
+    for (int y = 0; y < rows && !w->error; y++) {
+        const unsigned char *row = pixels + (size_t)y * stride;
+        if (w->format == IMAGE_FORMAT_PNM) {
+            if (fwrite(row, 1, bytes, w->file) != bytes) w->error = 1;
+        } else if (w->format == IMAGE_FORMAT_BMP) {
+            image_bmp_row(w, row);
+        } else {
+            image_png_row(w, row);
+        }
+    }
+    // Whole bytes of this call's deflate data go out as one IDAT
+    if (w->format == IMAGE_FORMAT_PNG && w->size > 0 && !w->error) {
+        image_png_chunk(w, "IDAT", w->buffer, w->size);
+        w->size = 0;
+    }
+    w->rows_written += rows;
+    return !w->error;
+}
+
+int image_writer_close(image_writer *w) {
+    int ok = !w->error && w->rows_written == w->height;
+    if (ok && w->format == IMAGE_FORMAT_PNG) ok = image_png_close(w);
+    free(w->row);
+    free(w->buffer);
+    w->row = w->buffer = NULL;
+    return ok && !ferror(w->file);
+}
+
+#endif // IMAGE_WRITER_IMPLEMENTATION_DONE
+#endif // IMAGE_WRITER_IMPLEMENTATION
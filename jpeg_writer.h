@@ -0,0 +1,223 @@
+/* jpeg_writer.h - baseline JFIF writer for quantized 8x8 blocks
+
+   Do this:
+      #define JPEG_WRITER_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+   Needs huffman.h and rle.h (with their implementations in the same program).
+
+   jpeg_write() takes block-major int16 planes, one per component, as
+   forward_dct_quantize_plane() writes them, and produces a file any JPEG
+   decoder reads: SOI, APP0 (JFIF 1.01), DQT, SOF0, DHT, DRI when restart
+   intervals are on, one SOS with the entropy-coded scan, EOI.
+
+   The blocks must be transformed the JPEG way, from samples with 128
+   subtracted, so that a flat mid-grey block has DC 0. Three components
+   are YCbCr (see jpeg_rgb_to_ycbcr_shifted()), one is greyscale. There is
+   no chroma subsampling: every MCU is one block of each component, in
+   raster order, interleaved in a single scan.
+
+   Baseline allows two tables of each kind per scan, so component 0 uses
+   quantization and Huffman table set 0 and components 1 and 2 share set 1.
+   The Huffman tables are the Annex K ones unless optimize is set, in which
+   case they are built from the symbol histograms of the blocks being
+   written (huff_count_blocks() / huff_build_spec()). With a restart
+   interval the scan is byte-aligned and an RST0..RST7 marker written every
+   restart_interval MCUs, and the DC predictors restart from 0, so a
+   decoder can resynchronise (or start work) at each marker.
+*/
+#ifndef JPEG_WRITER_H
+#define JPEG_WRITER_H
+
+#include <stdio.h>
+
+#define JPEG_MAX_COMPONENTS 3
+
+// Annex K.1 chrominance table, the counterpart of the luminance base table
+extern const int jpeg_chrominance_quantization[8][8];
+
+typedef struct {
+    int width, height;                   // 1..65535
+    int components;                      // 1 (greyscale) or 3 (YCbCr)
+    int restart_interval;                // MCUs between RSTn markers, 0 for none
+    int optimize;                        // 1: per-image Huffman tables, 0: Annex K
+    const int *quant[2];                 // 64 entries (u * 8 + v), 1..255: set 0 luma, set 1 chroma
+} jpeg_params;
+
+// coefficients[c] is component c, ceil(width / 8) * ceil(height / 8) blocks
+// of 64. Returns 1 on success, 0 on bad parameters or a write error.
+int jpeg_write(FILE *file, const jpeg_params *params, const short *const *coefficients);
+
+// JFIF colour transform of count pixels, with the -128 level shift the
+// blocks need already applied to all three outputs
+void jpeg_rgb_to_ycbcr_shifted(const unsigned char *r, const unsigned char *g, const unsigned char *b, int count,
+                               double *y, double *cb, double *cr);
+
+#endif // JPEG_WRITER_H
+
+#ifdef JPEG_WRITER_IMPLEMENTATION
+#ifndef JPEG_WRITER_IMPLEMENTATION_DONE
+#define JPEG_WRITER_IMPLEMENTATION_DONE
+
+const int jpeg_chrominance_quantization[8][8] = {
+    {17, 18, 24, 47, 99, 99, 99, 99},
+    {18, 21, 26, 66, 99, 99, 99, 99},
+    {24, 26, 56, 99, 99, 99, 99, 99},
+    {47, 66, 99, 99, 99, 99, 99, 99},
+    {99, 99, 99, 99, 99, 99, 99, 99},
+    {99, 99, 99, 99, 99, 99, 99, 99},
+    {99, 99, 99, 99, 99, 99, 99, 99},
+    {99, 99, 99, 99, 99, 99, 99, 99}
+};
+
+void jpeg_rgb_to_ycbcr_shifted(const unsigned char *r, const unsigned char *g, const unsigned char *b, int count,
+                               double *y, double *cb, double *cr) {
+    for (int i = 0; i < count; i++) {
+        double red = r[i], green = g[i], blue = b[i];
+        y[i] = 0.299 * red + 0.587 * green + 0.114 * blue - 128.0;
+        cb[i] = -0.168735892 * red - 0.331264108 * green + 0.5 * blue;
+        cr[i] = 0.5 * red - 0.418687589 * green - 0.081312411 * blue;
+    }
+}
+
+static void jpeg_put16(FILE *file, int value) {
+    fputc((value >> 8) & 0xFF, file);
+    fputc(value & 0xFF, file);
+}
+
+static void jpeg_put_marker(FILE *file, int marker, int length) {
+    fputc(0xFF, file);
+    fputc(marker, file);
+    jpeg_put16(file, length);
+}
+
+static void jpeg_put_dht(FILE *file, int table_class, int id, const huff_spec *spec) {
+    int count = 0;
+    for (int length = 1; length <= 16; length++) count += spec->bits[length];
+    jpeg_put_marker(file, 0xC4, 2 + 1 + 16 + count);
+    fputc((table_class << 4) | id, file);
+    fwrite(spec->bits + 1, 1, 16, file);
+    fwrite(spec->values, 1, (size_t)count, file);
+}
+
+// Symbol histograms of table set `set`, mirroring the DC predictor resets
+// the scan will do at every restart marker: with one block of each
+// component per MCU, an interval is a contiguous run of blocks
+static void jpeg_count_symbols(const jpeg_params *p, const short *const *coefficients, size_t blocks, int set,
+                               long *dc_freq, long *ac_freq) {
+    size_t interval = p->restart_interval > 0 ? (size_t)p->restart_interval : blocks;
+    for (int c = set; c < p->components && c < (set ? JPEG_MAX_COMPONENTS : 1); c++) {
+        for (size_t start = 0; start < blocks; start += interval) {
+            int predictor = 0;
+            size_t count = blocks - start < interval ? blocks - start : interval;
+            huff_count_blocks(coefficients[c] + start * RLE_BLOCK, count, &predictor, dc_freq, ac_freq);
+        }
+    }
+}
+
+int jpeg_write(FILE *file, const jpeg_params *p, const short *const *coefficients) {
+    if (p->width < 1 || p->width > 65535 || p->height < 1 || p->height > 65535) return 0;
+    if (p->components != 1 && p->components != 3) return 0;
+    if (p->restart_interval < 0 || p->restart_interval > 65535) return 0;
+    int sets = p->components == 1 ? 1 : 2;
+    for (int s = 0; s < sets; s++) {
+        for (int k = 0; k < RLE_BLOCK; k++) {
+            if (p->quant[s][k] < 1 || p->quant[s][k] > 255) return 0;
+        }
+    }
+
+    size_t blocks_x = (size_t)(p->width + 7) / 8, blocks_y = (size_t)(p->height + 7) / 8;
+    size_t blocks = blocks_x * blocks_y;
+
+    huff_spec dc_spec[2], ac_spec[2];
+    for (int s = 0; s < sets; s++) {
+        if (p->optimize) {
+            long dc_freq[HUFF_FREQ_SIZE] = {0};
+            long ac_freq[HUFF_FREQ_SIZE] = {0};
+            jpeg_count_symbols(p, coefficients, blocks, s, dc_freq, ac_freq);
+            huff_build_spec(dc_freq, &dc_spec[s]);
+            huff_build_spec(ac_freq, &ac_spec[s]);
+        } else {
+            dc_spec[s] = s ? huff_dc_chrominance : huff_dc_luminance;
+            ac_spec[s] = s ? huff_ac_chrominance : huff_ac_luminance;
+        }
+    }
+
+    // SOI and the JFIF APP0 segment: version 1.01, no units, 1:1 aspect, no thumbnail
+    static const unsigned char jfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    fputc(0xFF, file);
+    fputc(0xD8, file);
+    jpeg_put_marker(file, 0xE0, 2 + (int)sizeof(jfif));
+    fwrite(jfif, 1, sizeof(jfif), file);
+
+    // Quantization tables go out in zigzag order, 8-bit precision
+    for (int s = 0; s < sets; s++) {
+        jpeg_put_marker(file, 0xDB, 2 + 1 + RLE_BLOCK);
+        fputc(s, file);
+        for (int k = 0; k < RLE_BLOCK; k++) fputc(p->quant[s][rle_zigzag[k]], file);
+    }
+
+    // Baseline frame, 1x1 sampling for every component
+    jpeg_put_marker(file, 0xC0, 8 + 3 * p->components);
+    fputc(8, file);
+    jpeg_put16(file, p->height);
+    jpeg_put16(file, p->width);
+    fputc(p->components, file);
+    for (int c = 0; c < p->components; c++) {
+        fputc(c + 1, file);
+        fputc(0x11, file);
+        fputc(c ? 1 : 0, file);
+    }
+
+    for (int s = 0; s < sets; s++) {
+        jpeg_put_dht(file, 0, s, &dc_spec[s]);
+        jpeg_put_dht(file, 1, s, &ac_spec[s]);
+    }
+
+    if (p->restart_interval > 0) {
+        jpeg_put_marker(file, 0xDD, 4);
+        jpeg_put16(file, p->restart_interval);
+    }
+
+    // One interleaved scan over every coefficient, no successive approximation
+    jpeg_put_marker(file, 0xDA, 6 + 2 * p->components);
+    fputc(p->components, file);
+    for (int c = 0; c < p->components; c++) {
+        fputc(c + 1, file);
+        fputc(c ? 0x11 : 0x00, file);
+    }
+    fputc(0, file);
+    fputc(63, file);
+    fputc(0, file);
+
+    huff_code dc_code[2], ac_code[2];
+    for (int s = 0; s < sets; s++) {
+        huff_build_code(&dc_spec[s], &dc_code[s]);
+        huff_build_code(&ac_spec[s], &ac_code[s]);
+    }
+
+    bit_writer writer;
+    bit_writer_init(&writer);
+    int predictor[JPEG_MAX_COMPONENTS] = {0};
+    int restart = 0, until_restart = p->restart_interval;
+    for (size_t b = 0; b < blocks; b++) {
+        if (p->restart_interval > 0 && until_restart-- == 0) {
+            bit_writer_marker(&writer, 0xD0 + (restart++ & 7));
+            for (int c = 0; c < p->components; c++) predictor[c] = 0;
+            until_restart = p->restart_interval - 1;
+        }
+        for (int c = 0; c < p->components; c++) {
+            int s = c ? 1 : 0;
+            huff_encode_blocks(&writer, coefficients[c] + b * RLE_BLOCK, 1, &dc_code[s], &ac_code[s], &predictor[c]);
+        }
+    }
+    bit_writer_finish(&writer);
+    fwrite(writer.buffer, 1, writer.size, file);
+    bit_writer_free(&writer);
+
+    fputc(0xFF, file);
+    fputc(0xD9, file);
+    return !ferror(file);
+}
+
+#endif // JPEG_WRITER_IMPLEMENTATION_DONE
+#endif // JPEG_WRITER_IMPLEMENTATION
@@ -0,0 +1,141 @@
+/* plane.h - image planes in one aligned allocation
+
+   Do this:
+      #define PLANE_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   A plane is a width x height grid of doubles (plane) or bytes (plane_u8)
+   held in a single 64-byte-aligned buffer, row y starting at
+   data + y * stride. Instead of one malloc per row and a pointer per row
+   to chase on every access, there is one allocation per plane and rows
+   sit back to back, so walking a block or the whole image is a linear
+   pass the compiler can vectorise.
+
+   The buffer is padded:
+
+      columns   width rounded up to the block size, then to a multiple of
+                64 bytes, so every row (and every 8-double block row
+                inside it) starts on a cache line
+      rows      height rounded up to the block size (padded_height), so
+                block loops can read whole edge blocks without a check
+
+   The padding is zero-filled when the plane is created. plane_row() and
+   plane_u8_row() give the start of a row; the loops take that pointer
+   once and index it by column. plane_get_block() / plane_put_block() move
+   one 8x8 block between a plane and a double[8][8] for the DCT.
+*/
+#ifndef PLANE_H
+#define PLANE_H
+
+#include <stddef.h>
+
+#define PLANE_ALIGN 64
+
+typedef struct {
+    double *data;           // PLANE_ALIGN-aligned, row y at data + y * stride
+    int width, height;      // the image
+    int stride;             // elements from one row to the next
+    int padded_height;      // rows allocated, height rounded up to the block size
+    void *allocation;       // what plane_free() releases
+} plane;
+
+typedef struct {
+    unsigned char *data;
+    int width, height;
+    int stride;
+    int padded_height;
+    void *allocation;
+} plane_u8;
+
+// 1 on success, 0 on bad dimensions or a failed allocation (the plane is
+// then empty and safe to free). block is the size edges are padded to.
+int plane_create(plane *p, int width, int height, int block);
+int plane_u8_create(plane_u8 *p, int width, int height, int block);
+void plane_free(plane *p);
+void plane_u8_free(plane_u8 *p);
+
+static inline double *plane_row(const plane *p, int y) {
+    return p->data + (size_t)y * p->stride;
+}
+
+static inline unsigned char *plane_u8_row(const plane_u8 *p, int y) {
+    return p->data + (size_t)y * p->stride;
+}
+
+// Copy the 8x8 block with top-left sample (x, y) out of / into the plane;
+// each block row is 8 contiguous doubles, one cache line when x is a
+// multiple of 8
+static inline void plane_get_block(const plane *p, int x, int y, double block[8][8]) {
+    const double *src = plane_row(p, y) + x;
+    for (int r = 0; r < 8; r++, src += p->stride) {
+        for (int c = 0; c < 8; c++) block[r][c] = src[c];
+    }
+}
+
+static inline void plane_put_block(plane *p, int x, int y, double block[8][8]) {
+    double *dst = plane_row(p, y) + x;
+    for (int r = 0; r < 8; r++, dst += p->stride) {
+        for (int c = 0; c < 8; c++) dst[c] = block[r][c];
+    }
+}
+
+#endif // PLANE_H
+
+#ifdef PLANE_IMPLEMENTATION
+#ifndef PLANE_IMPLEMENTATION_DONE
+#define PLANE_IMPLEMENTATION_DONE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Stride and allocated rows for elements of the given size; 0 on bad dimensions
+static int plane_layout(int width, int height, int block, size_t element, int *stride, int *padded_height) {
+    if (width < 1 || height < 1 || block < 1) return 0;
+    size_t line = PLANE_ALIGN / element;
+    size_t padded_width = ((size_t)width + block - 1) / block * block;
+    *stride = (int)((padded_width + line - 1) / line * line);
+    *padded_height = (height + block - 1) / block * block;
+    return 1;
+}
+
+// Zeroed, aligned to PLANE_ALIGN; *allocation is the pointer to free
+static void *plane_alloc(size_t bytes, void **allocation) {
+    unsigned char *raw = (unsigned char *)calloc(bytes + PLANE_ALIGN - 1, 1);
+    *allocation = raw;
+    if (raw == NULL) return NULL;
+    return raw + (PLANE_ALIGN - (uintptr_t)raw % PLANE_ALIGN) % PLANE_ALIGN;
+}
+
+int plane_create(plane *p, int width, int height, int block) {
+    memset(p, 0, sizeof(*p));
+    if (!plane_layout(width, height, block, sizeof(double), &p->stride, &p->padded_height)) return 0;
+    p->data = (double *)plane_alloc((size_t)p->stride * p->padded_height * sizeof(double), &p->allocation);
+    if (p->data == NULL) return 0;
+    p->width = width;
+    p->height = height;
+    return 1;
+}
+
+int plane_u8_create(plane_u8 *p, int width, int height, int block) {
+    memset(p, 0, sizeof(*p));
+    if (!plane_layout(width, height, block, 1, &p->stride, &p->padded_height)) return 0;
+    p->data = (unsigned char *)plane_alloc((size_t)p->stride * p->padded_height, &p->allocation);
+    if (p->data == NULL) return 0;
+    p->width = width;
+    p->height = height;
+    return 1;
+}
+
+void plane_free(plane *p) {
+    free(p->allocation);
+    memset(p, 0, sizeof(*p));
+}
+
+void plane_u8_free(plane_u8 *p) {
+    free(p->allocation);
+    memset(p, 0, sizeof(*p));
+}
+
+#endif // PLANE_IMPLEMENTATION_DONE
+#endif // PLANE_IMPLEMENTATION
@@ -0,0 +1,252 @@
+/* quantize.h - block-major quantization shared by the compressor programs
+
+   Do this:
+      #define QUANTIZE_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   Coefficients are block-major as produced by forward_dct_plane_n(): each
+   n x n block is n * n contiguous values, and the quantization table is
+   indexed by position inside the block, so the table stays n * n entries
+   no matter how large the image is.
+
+   quant_table_for_quality() scales the base table the way libjpeg does for
+   quality 1..100 (50 leaves it unchanged) and keeps the derived tables in
+   a small cache keyed by quality, so a batch encoding thousands of images
+   at a few settings derives each table once. Callers get their own copy,
+   so a later miss that recycles a cache slot never changes a table in use.
+*/
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stddef.h>
+
+#define QUANT_BASE_SIZE 8
+
+#define QUANT_CACHE_SIZE 8
+
+// The 8x8 table and its reciprocals, indexed by position inside the block
+// (u * 8 + v), small enough to stay in L1
+typedef struct {
+    int table[QUANT_BASE_SIZE * QUANT_BASE_SIZE];
+    double reciprocal[QUANT_BASE_SIZE * QUANT_BASE_SIZE];
+} quant_table;
+
+void quant_table_init(quant_table *q, const int base[QUANT_BASE_SIZE][QUANT_BASE_SIZE]);
+
+// base scaled for quality 1..100 (clamped), entries clamped to [1, 255],
+// copied into *out. The cache is not locked: call it from one thread.
+void quant_table_for_quality(const int base[QUANT_BASE_SIZE][QUANT_BASE_SIZE], int quality, quant_table *out);
+
+// Spread the 8x8 base table over an n x n block (n = 4, 8, 16, 32) by
+// frequency position: entry (u, v) takes base[u * 8 / n][v * 8 / n] * n / 8
+// (rounded, at least 1). The sized kernels are orthonormal, so coefficients
+// grow by n / 8 with the block size and the steps grow with them; n = 8
+// leaves the base table unchanged.
+void quant_table_for_size(const int base[QUANT_BASE_SIZE][QUANT_BASE_SIZE], int n, int *table);
+
+// Quantized coefficients are int16, rounded half away from zero and saturated
+void quantize_blocks(int n, const double *coefficients, size_t blocks, const int *table, short *result);
+void dequantize_blocks(int n, const short *quantized, size_t blocks, const int *table, double *result);
+
+// Deadzone quantization of row u (0..7) of an 8x8 block: result[v] is
+// round(coefficients[v] / table) or 0 when its magnitude is <= threshold[u * 8 + v].
+// Thresholds are >= 0 (0 is plain rounding). Returns the number of nonzero results.
+int quantize_deadzone_row(const double *coefficients, const quant_table *q, const int *threshold, int u, short *result);
+
+// Block-major 8x8 blocks; nonzero[b] (may be NULL) gets block b's nonzero count
+void quantize_deadzone_blocks(const double *coefficients, size_t blocks, const quant_table *q, const int *threshold, short *result, unsigned char *nonzero);
+
+#endif // QUANTIZE_H
+
+#ifdef QUANTIZE_IMPLEMENTATION
+#ifndef QUANTIZE_IMPLEMENTATION_DONE
+#define QUANTIZE_IMPLEMENTATION_DONE
+
+#include <math.h>
+
+#if !defined(QUANT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define QUANT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Fill the reciprocals from q->table
+static void quant_table_derive(quant_table *q) {
+    for (int k = 0; k < QUANT_BASE_SIZE * QUANT_BASE_SIZE; k++) {
+        q->reciprocal[k] = 1.0 / q->table[k];
+    }
+}
+
+void quant_table_init(quant_table *q, const int base[QUANT_BASE_SIZE][QUANT_BASE_SIZE]) {
+    for (int u = 0; u < QUANT_BASE_SIZE; u++) {
+        for (int v = 0; v < QUANT_BASE_SIZE; v++) {
+            q->table[u * QUANT_BASE_SIZE + v] = base[u][v];
+        }
+    }
+    quant_table_derive(q);
+}
+
+static struct {
+    const int (*base)[QUANT_BASE_SIZE];
+    int quality;
+    quant_table table;
+} quant_cache[QUANT_CACHE_SIZE];
+static int quant_cache_used = 0;
+static int quant_cache_next = 0;
+
+void quant_table_for_quality(const int base[QUANT_BASE_SIZE][QUANT_BASE_SIZE], int quality, quant_table *out) {
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+
+    for (int i = 0; i < quant_cache_used; i++) {
+        if (quant_cache[i].base == base && quant_cache[i].quality == quality) {
+            *out = quant_cache[i].table;
+            return;
+        }
+    }
+
+    // Miss: derive into the oldest slot
+    int slot = quant_cache_next;
+    quant_cache_next = (quant_cache_next + 1) % QUANT_CACHE_SIZE;
+    if (quant_cache_used < QUANT_CACHE_SIZE) quant_cache_used++;
+
+    // libjpeg's curve: 5000 / quality below 50, 200 - 2 * quality above
+    int scale = (quality < 50) ? 5000 / quality : 200 - quality * 2;
+    quant_table *q = &quant_cache[slot].table;
+    for (int u = 0; u < QUANT_BASE_SIZE; u++) {
+        for (int v = 0; v < QUANT_BASE_SIZE; v++) {
+            int value = (base[u][v] * scale + 50) / 100;
+            if (value < 1) value = 1;
+            if (value > 255) value = 255;
+            q->table[u * QUANT_BASE_SIZE + v] = value;
+        }
+    }
+    quant_table_derive(q);
+    quant_cache[slot].base = base;
+    quant_cache[slot].quality = quality;
+    *out = *q;
+}
+
+void quant_table_for_size(const int base[QUANT_BASE_SIZE][QUANT_BASE_SIZE], int n, int *table) {
+    for (int u = 0; u < n; u++) {
+        for (int v = 0; v < n; v++) {
+            int value = (base[u * QUANT_BASE_SIZE / n][v * QUANT_BASE_SIZE / n] * n + QUANT_BASE_SIZE / 2) / QUANT_BASE_SIZE;
+            table[u * n + v] = value < 1 ? 1 : value;
+        }
+    }
+}
+
+static short quant_saturate(double q) {
+    if (q > 32767.0) return 32767;
+    if (q < -32768.0) return -32768;
+    return (short)q;
+}
+
+// One copy per block size so the inner loop has a constant trip count.
+// The divides become multiplies by reciprocals computed once per call.
+#define QUANT_DEFINE_SIZED(N)                                                    \
+static void quantize_blocks_##N(const double *coefficients, size_t blocks, const int *table, short *result) { \
+    double recip[N * N];                                                        \
+    for (int k = 0; k < N * N; k++) recip[k] = 1.0 / table[k];                  \
+    for (size_t b = 0; b < blocks; b++) {                                       \
+        const double *in = coefficients + b * (N * N);                          \
+        short *out = result + b * (N * N);                                      \
+        for (int k = 0; k < N * N; k++) {                                       \
+            out[k] = quant_saturate(round(in[k] * recip[k]));                   \
+        }                                                                       \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static void dequantize_blocks_##N(const short *quantized, size_t blocks, const int *table, double *result) { \
+    for (size_t b = 0; b < blocks; b++) {                                       \
+        const short *in = quantized + b * (N * N);                              \
+        double *out = result + b * (N * N);                                     \
+        for (int k = 0; k < N * N; k++) {                                       \
+            out[k] = in[k] * table[k];                                          \
+        }                                                                       \
+    }                                                                           \
+}
+
+QUANT_DEFINE_SIZED(4)
+QUANT_DEFINE_SIZED(8)
+QUANT_DEFINE_SIZED(16)
+QUANT_DEFINE_SIZED(32)
+
+void quantize_blocks(int n, const double *coefficients, size_t blocks, const int *table, short *result) {
+    switch (n) {
+    case 4: quantize_blocks_4(coefficients, blocks, table, result); break;
+    case 8: quantize_blocks_8(coefficients, blocks, table, result); break;
+    case 16: quantize_blocks_16(coefficients, blocks, table, result); break;
+    case 32: quantize_blocks_32(coefficients, blocks, table, result); break;
+    }
+}
+
+void dequantize_blocks(int n, const short *quantized, size_t blocks, const int *table, double *result) {
+    switch (n) {
+    case 4: dequantize_blocks_4(quantized, blocks, table, result); break;
+    case 8: dequantize_blocks_8(quantized, blocks, table, result); break;
+    case 16: dequantize_blocks_16(quantized, blocks, table, result); break;
+    case 32: dequantize_blocks_32(quantized, blocks, table, result); break;
+    }
+}
+
+#ifdef QUANT_SSE2
+// Two 4-lane halves: round half away from zero by adding sign(x) * 0.5 and
+// truncating, then keep a lane only where q > t or q < -t. The kept-lane
+// masks are -1, so their sum is minus the nonzero count.
+int quantize_deadzone_row(const double *coefficients, const quant_table *q, const int *threshold, int u, short *result) {
+    const double *recip = q->reciprocal + u * QUANT_BASE_SIZE;
+    const int *limit = threshold + u * QUANT_BASE_SIZE;
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d half = _mm_set1_pd(0.5);
+    __m128i value[2];
+    __m128i kept = _mm_setzero_si128();
+
+    for (int h = 0; h < 2; h++) {
+        __m128d a = _mm_mul_pd(_mm_loadu_pd(coefficients + h * 4), _mm_loadu_pd(recip + h * 4));
+        __m128d b = _mm_mul_pd(_mm_loadu_pd(coefficients + h * 4 + 2), _mm_loadu_pd(recip + h * 4 + 2));
+        a = _mm_add_pd(a, _mm_or_pd(_mm_and_pd(a, sign), half));
+        b = _mm_add_pd(b, _mm_or_pd(_mm_and_pd(b, sign), half));
+        __m128i v = _mm_unpacklo_epi64(_mm_cvttpd_epi32(a), _mm_cvttpd_epi32(b));
+
+        __m128i t = _mm_loadu_si128((const __m128i *)(limit + h * 4));
+        __m128i keep = _mm_or_si128(_mm_cmpgt_epi32(v, t),
+                                    _mm_cmplt_epi32(v, _mm_sub_epi32(_mm_setzero_si128(), t)));
+        value[h] = _mm_and_si128(v, keep);
+        kept = _mm_add_epi32(kept, keep);
+    }
+    _mm_storeu_si128((__m128i *)result, _mm_packs_epi32(value[0], value[1]));
+
+    kept = _mm_add_epi32(kept, _mm_shuffle_epi32(kept, _MM_SHUFFLE(1, 0, 3, 2)));
+    kept = _mm_add_epi32(kept, _mm_shuffle_epi32(kept, _MM_SHUFFLE(2, 3, 0, 1)));
+    return -_mm_cvtsi128_si32(kept);
+}
+#else
+int quantize_deadzone_row(const double *coefficients, const quant_table *q, const int *threshold, int u, short *result) {
+    const double *recip = q->reciprocal + u * QUANT_BASE_SIZE;
+    const int *limit = threshold + u * QUANT_BASE_SIZE;
+    int count = 0;
+    for (int v = 0; v < QUANT_BASE_SIZE; v++) {
+        double x = coefficients[v] * recip[v];
+        int value = (int)(x + (x < 0 ? -0.5 : 0.5));
+        int keep = (value > limit[v]) | (value < -limit[v]);
+        result[v] = quant_saturate(value & -keep);
+        count += keep;
+    }
+    return count;
+}
+#endif
+
+void quantize_deadzone_blocks(const double *coefficients, size_t blocks, const quant_table *q, const int *threshold, short *result, unsigned char *nonzero) {
+    const int block = QUANT_BASE_SIZE * QUANT_BASE_SIZE;
+    for (size_t b = 0; b < blocks; b++) {
+        int count = 0;
+        for (int u = 0; u < QUANT_BASE_SIZE; u++) {
+            count += quantize_deadzone_row(coefficients + b * block + u * QUANT_BASE_SIZE, q, threshold, u,
+                                           result + b * block + u * QUANT_BASE_SIZE);
+        }
+        if (nonzero) nonzero[b] = (unsigned char)count;
+    }
+}
+
+#endif // QUANTIZE_IMPLEMENTATION_DONE
+#endif // QUANTIZE_IMPLEMENTATION
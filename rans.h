@@ -0,0 +1,512 @@
+/* rans.h - interleaved rANS coding of quantized 8x8 blocks
+
+   Do this:
+      #define RANS_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+   Needs rle.h and huffman.h (for bit_writer) with their implementations in
+   the same program.
+
+   A channel becomes two token streams with the same symbols as the Huffman
+   coder, DC size categories (one per block) and AC run/size symbols with
+   ZRL and EOB, plus a plain bit stream for the extra bits. Each token
+   stream is coded with its own static model: frequencies normalized to
+   RANS_PROB_SCALE, stored by the caller (coeff_file.h puts them in the
+   header). DC is coded as it is in block[0]: run dc_predict.h first so
+   that it holds the prediction residual.
+
+   Token i goes to state i % lanes, 4 to 32 states. States are 32 bits in
+   [2^16, 2^32) and renormalize 16 bits at a time, so each token reads at
+   most one word. The encoder writes backwards so the decoder reads every
+   step's words front to back in lane order. With AVX2 and a multiple of 8
+   lanes the decoder runs 8 states per vector: one gather from the 4096
+   entry slot table, then the lanes needing a word pick theirs from one
+   unaligned 16-byte load through a permutation chosen by the
+   renormalization mask.
+
+   Scan layout (little-endian): AC token count, DC rANS byte count and AC
+   rANS byte count (4 bytes each), the DC then the AC rANS bytes (lane
+   states, then 16-bit words), then the extra bits. The DC token count is
+   the block count.
+*/
+#ifndef RANS_H
+#define RANS_H
+
+#include <stddef.h>
+
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE (1 << RANS_PROB_BITS)
+#define RANS_MIN_LANES 4
+#define RANS_MAX_LANES 32
+
+// Most AC tokens one block produces: 63 AC, 3 ZRL and EOB
+#define RANS_MAX_AC_TOKENS (RLE_BLOCK + 3)
+
+// Tokens of a block-major channel of 8x8 blocks: one DC token per block in
+// dc_tokens, AC tokens in ac_tokens (room for blocks * RANS_MAX_AC_TOKENS),
+// extra bits to extra (a raw bit_writer). Returns the number of AC tokens.
+size_t rans_tokenize_blocks(const short *coefficients, size_t blocks, unsigned char *dc_tokens,
+                            unsigned char *ac_tokens, bit_writer *extra);
+
+// Token counts normalized to RANS_PROB_SCALE, every token that occurs >= 1
+void rans_build_model(const unsigned char *tokens, size_t count, unsigned short *freq);
+
+// Whole channel to a scan (allocated, caller frees) with lanes 4..32 states;
+// dc_freq and ac_freq receive the channel's models (256 entries each).
+// Returns the scan size, 0 on failure.
+size_t rans_encode_blocks(const short *coefficients, size_t blocks, int lanes, unsigned short *dc_freq,
+                          unsigned short *ac_freq, unsigned char **scan);
+
+// Scan back to blocks; 1 on success, 0 on a corrupt scan
+int rans_decode_blocks(const unsigned char *scan, size_t size, const unsigned short *dc_freq, const unsigned short *ac_freq,
+                       int lanes, size_t blocks, short *coefficients);
+
+// The two stages separately: tokens to rANS bytes (allocated, caller
+// frees) and back. rans_decode() returns 1 on success.
+size_t rans_encode(const unsigned char *tokens, size_t count, const unsigned short *freq, int lanes, unsigned char **out);
+int rans_decode(const unsigned char *data, size_t size, const unsigned short *freq, int lanes, unsigned char *tokens, size_t count);
+
+#endif // RANS_H
+
+#ifdef RANS_IMPLEMENTATION
+#ifndef RANS_IMPLEMENTATION_DONE
+#define RANS_IMPLEMENTATION_DONE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lower bound of the normalized state interval
+#define RANS_L (1u << 16)
+
+static int rans_magnitude_bits(int v) {
+    unsigned int magnitude = (unsigned int)(v < 0 ? -v : v);
+    int bits = 0;
+    while (magnitude) {
+        magnitude >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+size_t rans_tokenize_blocks(const short *coefficients, size_t blocks, unsigned char *dc_tokens,
+                            unsigned char *ac_tokens, bit_writer *extra) {
+    rle_pair pairs[RLE_MAX_PAIRS];
+    size_t count = 0;
+    for (size_t b = 0; b < blocks; b++) {
+        const short *block = coefficients + b * RLE_BLOCK;
+
+        int diff = block[0];
+        int size = rans_magnitude_bits(diff);
+        dc_tokens[b] = (unsigned char)size;
+        bit_writer_put(extra, (unsigned int)(diff - (diff < 0)), size);
+
+        int pair_count = rle_encode_block(block, pairs);
+        for (int i = 0; i < pair_count; i++) {
+            if (RLE_IS_EOB(pairs[i])) {
+                ac_tokens[count++] = 0x00;
+                break;
+            }
+            int run = pairs[i].run;
+            while (run > 15) {
+                ac_tokens[count++] = 0xF0;
+                run -= 16;
+            }
+            // Keep the size in the low nibble
+            int level = pairs[i].level < -32767 ? -32767 : pairs[i].level;
+            size = rans_magnitude_bits(level);
+            ac_tokens[count++] = (unsigned char)((run << 4) | size);
+            bit_writer_put(extra, (unsigned int)(level - (level < 0)), size);
+        }
+    }
+    return count;
+}
+
+void rans_build_model(const unsigned char *tokens, size_t count, unsigned short *freq) {
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < count; i++) counts[tokens[i]]++;
+
+    int total = 0, largest = 0;
+    for (int s = 0; s < 256; s++) {
+        int f = 0;
+        if (counts[s]) {
+            f = (int)((double)counts[s] * RANS_PROB_SCALE / (double)count);
+            if (f < 1) f = 1;
+        }
+        freq[s] = (unsigned short)f;
+        total += f;
+        if (f > freq[largest]) largest = s;
+    }
+    if (total == 0) {
+        // Empty stream: any valid model will do
+        freq[0] = RANS_PROB_SCALE;
+        return;
+    }
+
+    // Rounding leftovers go to (or come from) the most frequent tokens
+    while (total != RANS_PROB_SCALE) {
+        if (total < RANS_PROB_SCALE) {
+            freq[largest] += (unsigned short)(RANS_PROB_SCALE - total);
+            total = RANS_PROB_SCALE;
+        } else {
+            int step = total - RANS_PROB_SCALE;
+            if (step > freq[largest] - 1) step = freq[largest] - 1;
+            freq[largest] -= (unsigned short)step;
+            total -= step;
+            for (int s = 0; s < 256; s++) {
+                if (freq[s] > freq[largest]) largest = s;
+            }
+        }
+    }
+}
+
+static void rans_cumulative(const unsigned short *freq, unsigned int *cum) {
+    unsigned int sum = 0;
+    for (int s = 0; s < 256; s++) {
+        cum[s] = sum;
+        sum += freq[s];
+    }
+}
+
+static int rans_model_valid(const unsigned short *freq) {
+    unsigned int sum = 0;
+    for (int s = 0; s < 256; s++) sum += freq[s];
+    return sum == RANS_PROB_SCALE;
+}
+
+size_t rans_encode(const unsigned char *tokens, size_t count, const unsigned short *freq, int lanes, unsigned char **out) {
+    unsigned int cum[256];
+    unsigned int state[RANS_MAX_LANES];
+    if (lanes < RANS_MIN_LANES || lanes > RANS_MAX_LANES || !rans_model_valid(freq)) return 0;
+    rans_cumulative(freq, cum);
+
+    // At most one word per token, plus the lane states
+    size_t capacity = 2 * count + 4 * (size_t)lanes;
+    unsigned char *buffer = (unsigned char *)malloc(capacity);
+    if (buffer == NULL) return 0;
+    unsigned char *p = buffer + capacity;
+
+    for (int lane = 0; lane < lanes; lane++) state[lane] = RANS_L;
+    for (size_t i = count; i-- > 0; ) {
+        unsigned int *x = &state[i % lanes];
+        unsigned int f = freq[tokens[i]];
+        if (f == 0) {
+            free(buffer);
+            return 0;   // token the model cannot code
+        }
+        if ((unsigned long long)*x >= ((unsigned long long)f << (32 - RANS_PROB_BITS))) {
+            p -= 2;
+            p[0] = (unsigned char)*x;
+            p[1] = (unsigned char)(*x >> 8);
+            *x >>= 16;
+        }
+        *x = ((*x / f) << RANS_PROB_BITS) + (*x % f) + cum[tokens[i]];
+    }
+    for (int lane = lanes; lane-- > 0; ) {
+        p -= 4;
+        p[0] = (unsigned char)state[lane];
+        p[1] = (unsigned char)(state[lane] >> 8);
+        p[2] = (unsigned char)(state[lane] >> 16);
+        p[3] = (unsigned char)(state[lane] >> 24);
+    }
+
+    size_t size = (size_t)(buffer + capacity - p);
+    memmove(buffer, p, size);
+    *out = buffer;
+    return size;
+}
+
+// Slot table entry: token | (freq - 1) << 8 | cum << 20
+static void rans_build_slots(const unsigned short *freq, unsigned int *slots) {
+    unsigned int cum = 0;
+    for (int s = 0; s < 256; s++) {
+        for (unsigned int k = 0; k < freq[s]; k++) {
+            slots[cum + k] = (unsigned int)s | ((unsigned int)(freq[s] - 1) << 8) | (cum << 20);
+        }
+        cum += freq[s];
+    }
+}
+
+#if !defined(RANS_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define RANS_X86_SIMD
+#endif
+
+#ifdef RANS_X86_SIMD
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RANS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RANS_TARGET(isa)
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h> // __cpuid
+static int rans_detect_avx2(void) {
+    int info[4];
+    __cpuid(info, 1);
+    if (!((info[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6) return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+}
+#else
+static int rans_detect_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
+
+static int rans_has_avx2(void) {
+    static int avx2 = -1;
+    if (avx2 < 0) avx2 = rans_detect_avx2();
+    return avx2;
+}
+
+// rans_lane_words[m][lane]: which of the loaded words lane takes when the
+// lanes set in mask m renormalize (the number of set lanes below it)
+static unsigned char rans_lane_words[256][8];
+static int rans_lane_words_ready = 0;
+
+static void rans_init_lane_words(void) {
+    if (rans_lane_words_ready) return;
+    for (int m = 0; m < 256; m++) {
+        int next = 0;
+        for (int lane = 0; lane < 8; lane++) {
+            rans_lane_words[m][lane] = (unsigned char)((m >> lane) & 1 ? next++ : 0);
+        }
+    }
+    rans_lane_words_ready = 1;
+}
+
+// Whole steps while the stream has room for an unchecked 16-byte load per
+// group; returns the number of steps decoded
+RANS_TARGET("avx2,popcnt") static size_t rans_decode_avx2(unsigned int *state, int lanes, const unsigned int *slots,
+                                                   const unsigned char **stream, const unsigned char *end,
+                                                   unsigned char *tokens, size_t steps) {
+    const __m256i slot_mask = _mm256_set1_epi32(RANS_PROB_SCALE - 1);
+    const __m256i freq_mask = _mm256_set1_epi32(0xFFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i sign = _mm256_set1_epi32((int)0x80000000u);
+    const __m256i lower = _mm256_set1_epi32((int)(RANS_L ^ 0x80000000u));
+    // Low byte of every 32-bit lane into the first 4 bytes of each 128-bit half
+    const __m256i token_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i token_halves = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+    const unsigned char *p = *stream;
+    size_t step = 0;
+
+    for (; step < steps; step++) {
+        if ((size_t)(end - p) < 2 * (size_t)lanes + 16) break;
+        for (int g = 0; g < lanes; g += 8) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(state + g));
+            __m256i slot = _mm256_and_si256(x, slot_mask);
+            __m256i entry = _mm256_i32gather_epi32((const int *)slots, slot, 4);
+            __m256i freq = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(entry, 8), freq_mask), one);
+            __m256i cum = _mm256_srli_epi32(entry, 20);
+            x = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(x, RANS_PROB_BITS)),
+                                 _mm256_sub_epi32(slot, cum));
+
+            __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(entry, token_bytes), token_halves);
+            _mm_storel_epi64((__m128i *)(tokens + step * lanes + g), _mm256_castsi256_si128(packed));
+
+            // Unsigned x < RANS_L through a signed compare on sign-flipped values
+            __m256i renorm = _mm256_cmpgt_epi32(lower, _mm256_xor_si256(x, sign));
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(renorm));
+            __m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+            __m256i pick = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)rans_lane_words[mask]));
+            words = _mm256_permutevar8x32_epi32(words, pick);
+            x = _mm256_blendv_epi8(x, _mm256_or_si256(_mm256_slli_epi32(x, 16), words), renorm);
+            p += 2 * _mm_popcnt_u32((unsigned int)mask);
+
+            _mm256_storeu_si256((__m256i *)(state + g), x);
+        }
+    }
+    *stream = p;
+    return step;
+}
+#endif
+
+int rans_decode(const unsigned char *data, size_t size, const unsigned short *freq, int lanes, unsigned char *tokens, size_t count) {
+    unsigned int state[RANS_MAX_LANES];
+    if (lanes < RANS_MIN_LANES || lanes > RANS_MAX_LANES || !rans_model_valid(freq)) return 0;
+    if (size < 4 * (size_t)lanes) return 0;
+    // Per call, not static: coeff_decoder.h may run several decoders at once
+    unsigned int *slots = (unsigned int *)malloc(RANS_PROB_SCALE * sizeof(unsigned int));
+    if (slots == NULL) return 0;
+    rans_build_slots(freq, slots);
+
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+    for (int lane = 0; lane < lanes; lane++, p += 4) {
+        state[lane] = p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+    }
+
+    size_t i = 0;
+#ifdef RANS_X86_SIMD
+    if (lanes % 8 == 0 && rans_has_avx2()) {
+        rans_init_lane_words();
+        i = rans_decode_avx2(state, lanes, slots, &p, end, tokens, count / lanes) * lanes;
+    }
+#endif
+    for (; i < count; i++) {
+        unsigned int *x = &state[i % lanes];
+        unsigned int slot = *x & (RANS_PROB_SCALE - 1);
+        unsigned int entry = slots[slot];
+        tokens[i] = (unsigned char)entry;
+        *x = (((entry >> 8) & 0xFFF) + 1) * (*x >> RANS_PROB_BITS) + slot - (entry >> 20);
+        if (*x < RANS_L) {
+            if (end - p < 2) {
+                free(slots);
+                return 0;
+            }
+            *x = (*x << 16) | p[0] | ((unsigned int)p[1] << 8);
+            p += 2;
+        }
+    }
+    free(slots);
+    return 1;
+}
+
+static void rans_put32(unsigned char *p, size_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static size_t rans_get32(const unsigned char *p) {
+    return p[0] | ((size_t)p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+}
+
+size_t rans_encode_blocks(const short *coefficients, size_t blocks, int lanes, unsigned short *dc_freq,
+                          unsigned short *ac_freq, unsigned char **scan) {
+    unsigned char *dc_tokens = (unsigned char *)malloc(blocks ? blocks : 1);
+    unsigned char *ac_tokens = (unsigned char *)malloc(blocks * RANS_MAX_AC_TOKENS + 1);
+    *scan = NULL;
+    if (dc_tokens == NULL || ac_tokens == NULL) {
+        free(dc_tokens);
+        free(ac_tokens);
+        return 0;
+    }
+    bit_writer extra;
+    bit_writer_init_raw(&extra);
+    size_t count = rans_tokenize_blocks(coefficients, blocks, dc_tokens, ac_tokens, &extra);
+    bit_writer_finish(&extra);
+    rans_build_model(dc_tokens, blocks, dc_freq);
+    rans_build_model(ac_tokens, count, ac_freq);
+
+    unsigned char *dc_coded = NULL, *ac_coded = NULL;
+    size_t dc_size = rans_encode(dc_tokens, blocks, dc_freq, lanes, &dc_coded);
+    size_t ac_size = rans_encode(ac_tokens, count, ac_freq, lanes, &ac_coded);
+    free(dc_tokens);
+    free(ac_tokens);
+
+    size_t size = 12 + dc_size + ac_size + extra.size;
+    if (dc_size && ac_size && count <= 0xffffffffUL && dc_size <= 0xffffffffUL && ac_size <= 0xffffffffUL) {
+        *scan = (unsigned char *)malloc(size);
+    }
+    if (*scan != NULL) {
+        rans_put32(*scan, count);
+        rans_put32(*scan + 4, dc_size);
+        rans_put32(*scan + 8, ac_size);
+        memcpy(*scan + 12, dc_coded, dc_size);
+        memcpy(*scan + 12 + dc_size, ac_coded, ac_size);
+        memcpy(*scan + 12 + dc_size + ac_size, extra.buffer, extra.size);
+    }
+    free(dc_coded);
+    free(ac_coded);
+    bit_writer_free(&extra);
+    return *scan != NULL ? size : 0;
+}
+
+// Extra bits, MSB first, no stuffing; reads past the end as 1 bits like the padding
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    unsigned long long buffer;
+    int bits;
+    int overrun;   // 0xFF bytes fed past the end
+} rans_bit_reader;
+
+// count <= 16
+static int rans_get_bits(rans_bit_reader *r, int count) {
+    while (r->bits < count) {
+        if (r->p < r->end) {
+            r->buffer = (r->buffer << 8) | *r->p++;
+        } else {
+            r->buffer = (r->buffer << 8) | 0xFF;
+            r->overrun++;
+        }
+        r->bits += 8;
+    }
+    r->bits -= count;
+    return (int)((r->buffer >> r->bits) & ((1u << count) - 1));
+}
+
+// 1 if the extra bits ended with the scan: no bits taken from the fed
+// padding bytes and only bit_writer_finish()'s 1-bit padding left over
+static int rans_bits_finished(const rans_bit_reader *r) {
+    int left = r->bits - r->overrun * 8;   // unread bits of the scan itself
+    if (r->p != r->end || left < 0 || left >= 8) return 0;
+    unsigned int padding = (1u << left) - 1;
+    return ((unsigned int)(r->buffer >> (r->overrun * 8)) & padding) == padding;
+}
+
+// Extra bits of a size category back to the signed value
+static int rans_extend(int bits, int size) {
+    return size && bits < (1 << (size - 1)) ? bits - (1 << size) + 1 : bits;
+}
+
+int rans_decode_blocks(const unsigned char *scan, size_t size, const unsigned short *dc_freq, const unsigned short *ac_freq,
+                       int lanes, size_t blocks, short *coefficients) {
+    if (size < 12) return 0;
+    size_t count = rans_get32(scan);
+    size_t dc_size = rans_get32(scan + 4);
+    size_t ac_size = rans_get32(scan + 8);
+    if (dc_size > size - 12 || ac_size > size - 12 - dc_size || count > blocks * RANS_MAX_AC_TOKENS) return 0;
+
+    unsigned char *dc_tokens = (unsigned char *)malloc(blocks ? blocks : 1);
+    unsigned char *ac_tokens = (unsigned char *)malloc(count ? count : 1);
+    if (dc_tokens == NULL || ac_tokens == NULL ||
+        !rans_decode(scan + 12, dc_size, dc_freq, lanes, dc_tokens, blocks) ||
+        !rans_decode(scan + 12 + dc_size, ac_size, ac_freq, lanes, ac_tokens, count)) {
+        free(dc_tokens);
+        free(ac_tokens);
+        return 0;
+    }
+
+    rans_bit_reader extra = {scan + 12 + dc_size + ac_size, scan + size, 0, 0, 0};
+    size_t t = 0;
+    int ok = 1;
+    for (size_t b = 0; ok && b < blocks; b++) {
+        short *block = coefficients + b * RLE_BLOCK;
+        memset(block, 0, RLE_BLOCK * sizeof(short));
+
+        // The model may hold any of the 256 tokens; DC categories stop at 16
+        int dc_category = dc_tokens[b];
+        if (dc_category > 16) {
+            ok = 0;
+            break;
+        }
+        block[0] = (short)rans_extend(rans_get_bits(&extra, dc_category), dc_category);
+
+        for (int k = 1; k < RLE_BLOCK && t < count; ) {
+            int token = ac_tokens[t++];
+            if (token == 0x00) break;
+            k += token == 0xF0 ? 16 : token >> 4;
+            if (k > RLE_BLOCK || (k == RLE_BLOCK && token != 0xF0)) {
+                ok = 0;   // a run past coefficient 63
+                break;
+            }
+            if (token == 0xF0) continue;
+            int level_size = token & 15;
+            block[rle_zigzag[k]] = (short)rans_extend(rans_get_bits(&extra, level_size), level_size);
+            k++;
+        }
+    }
+    free(dc_tokens);
+    free(ac_tokens);
+    return ok && t == count && rans_bits_finished(&extra);
+}
+
+#endif // RANS_IMPLEMENTATION_DONE
+#endif // RANS_IMPLEMENTATION
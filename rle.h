@@ -0,0 +1,182 @@
+/* rle.h - zigzag scan and (run, level) coding of quantized 8x8 blocks
+
+   Do this:
+      #define RLE_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   Blocks are 64 int16 in raster order, as quantize_blocks() and
+   forward_dct_quantize_plane() write them. Only the 63 AC coefficients are
+   run-length coded, in zigzag order: each pair is the number of zeros
+   skipped and the nonzero value that ends the run. When the block ends in
+   zeros a final EOB pair (run 0, level 0, see RLE_IS_EOB) replaces them, so a decoder
+   knows the block is done either at EOB or after coefficient 63, the same
+   rule as JPEG. DC (block[0]) is left to the caller.
+
+   The encoder first folds the block into a 64-bit mask of nonzero
+   positions in zigzag order and then walks only the set bits, so runs and
+   trailing zeros cost nothing beyond building the mask. Blocks with no AC
+   at all are caught first with an SSE2 OR over the block and go straight
+   to EOB.
+*/
+#ifndef RLE_H
+#define RLE_H
+
+#include <stddef.h>
+
+#define RLE_BLOCK 64
+
+// Most pairs one block can produce: 63 nonzero AC values, or up to 62 and an EOB
+#define RLE_MAX_PAIRS 63
+
+typedef struct {
+    unsigned char run;   // zeros before level, 0..62
+    short level;         // nonzero value, 0 only for RLE_EOB
+} rle_pair;
+
+#define RLE_IS_EOB(p) ((p).run == 0 && (p).level == 0)
+
+// rle_zigzag[k] is the raster position (u * 8 + v) of the k-th coefficient in
+// zigzag order; rle_unzigzag is its inverse
+extern const unsigned char rle_zigzag[RLE_BLOCK];
+extern const unsigned char rle_unzigzag[RLE_BLOCK];
+
+// AC coefficients of one block to pairs; returns the number of pairs written
+int rle_encode_block(const short *block, rle_pair *pairs);
+
+// Pairs back into block[1..63] (block[0] untouched); returns the number of pairs used
+int rle_decode_block(const rle_pair *pairs, short *block);
+
+// Every block of a block-major channel; pairs needs room for blocks * RLE_MAX_PAIRS.
+// Returns the total number of pairs.
+size_t rle_encode_blocks(const short *coefficients, size_t blocks, rle_pair *pairs);
+
+#endif // RLE_H
+
+#ifdef RLE_IMPLEMENTATION
+#ifndef RLE_IMPLEMENTATION_DONE
+#define RLE_IMPLEMENTATION_DONE
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#if !defined(RLE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RLE_SSE2
+#include <emmintrin.h>
+#endif
+
+const unsigned char rle_zigzag[RLE_BLOCK] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+const unsigned char rle_unzigzag[RLE_BLOCK] = {
+     0,  1,  5,  6, 14, 15, 27, 28,
+     2,  4,  7, 13, 16, 26, 29, 42,
+     3,  8, 12, 17, 25, 30, 41, 43,
+     9, 11, 18, 24, 31, 40, 44, 53,
+    10, 19, 23, 32, 39, 45, 52, 54,
+    20, 22, 33, 38, 46, 51, 55, 60,
+    21, 34, 37, 47, 50, 56, 59, 61,
+    35, 36, 48, 49, 57, 58, 62, 63
+};
+
+// Index of the lowest set bit, mask != 0
+static int rle_lowest_bit(unsigned long long mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index;
+#else
+    int index = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// Nonzero when any AC coefficient is nonzero; most blocks at normal
+// qualities fail this and go straight to EOB
+static int rle_has_ac(const short *block) {
+#ifdef RLE_SSE2
+    __m128i any = _mm_insert_epi16(_mm_loadu_si128((const __m128i *)block), 0, 0);
+    for (int i = 8; i < RLE_BLOCK; i += 8) {
+        any = _mm_or_si128(any, _mm_loadu_si128((const __m128i *)(block + i)));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF;
+#else
+    for (int k = 1; k < RLE_BLOCK; k++) {
+        if (block[k]) return 1;
+    }
+    return 0;
+#endif
+}
+
+int rle_encode_block(const short *block, rle_pair *pairs) {
+    if (!rle_has_ac(block)) {
+        pairs[0].run = 0;
+        pairs[0].level = 0;
+        return 1;
+    }
+
+    // Bit k set when the k-th zigzag coefficient is nonzero; no branches on the data
+    unsigned long long mask = 0;
+    for (int k = 1; k < RLE_BLOCK; k++) {
+        mask |= (unsigned long long)(block[rle_zigzag[k]] != 0) << k;
+    }
+
+    int count = 0;
+    int next = 1;   // zigzag position after the previous nonzero
+    while (mask) {
+        int k = rle_lowest_bit(mask);
+        pairs[count].run = (unsigned char)(k - next);
+        pairs[count].level = block[rle_zigzag[k]];
+        count++;
+        next = k + 1;
+        mask &= mask - 1;
+    }
+    if (next < RLE_BLOCK) {
+        pairs[count].run = 0;
+        pairs[count].level = 0;
+        count++;
+    }
+    return count;
+}
+
+int rle_decode_block(const rle_pair *pairs, short *block) {
+    for (int k = 1; k < RLE_BLOCK; k++) {
+        block[rle_zigzag[k]] = 0;
+    }
+    int used = 0;
+    int k = 1;
+    while (k < RLE_BLOCK) {
+        rle_pair p = pairs[used++];
+        if (RLE_IS_EOB(p)) break;
+        k += p.run;
+        if (k >= RLE_BLOCK) break;   // corrupt run, stop at the block edge
+        block[rle_zigzag[k]] = p.level;
+        k++;
+    }
+    return used;
+}
+
+size_t rle_encode_blocks(const short *coefficients, size_t blocks, rle_pair *pairs) {
+    size_t total = 0;
+    for (size_t b = 0; b < blocks; b++) {
+        total += (size_t)rle_encode_block(coefficients + b * RLE_BLOCK, pairs + total);
+    }
+    return total;
+}
+
+#endif // RLE_IMPLEMENTATION_DONE
+#endif // RLE_IMPLEMENTATION
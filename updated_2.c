@@ -1,10 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#define DCT_TRANSFORM_IMPLEMENTATION
+#include "dct_transform.h"
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+#define PLANE_IMPLEMENTATION
+#include "plane.h"
 
 #define ROWS 1920
 #define COLS 1080
 #define BLOCK_SIZE 8
+#define DEADZONE 5
 #define m_pi   3.14159265358979323846264338327950288
 
 // 8x8 Quantization Matrix (standard JPEG-like)
@@ -19,92 +27,67 @@ int base_quantization_matrix[BLOCK_SIZE][BLOCK_SIZE] = {
     {72, 92, 95, 98, 112, 100, 103, 99}
 };
 
-// Function to compute the DCT of an 8x8 block
-void dct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int u = 0; u < BLOCK_SIZE; u++) {
-        for (int v = 0; v < BLOCK_SIZE; v++) {
-            double sum = 0.0;
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    sum += input[x][y] * cos(((2 * x + 1) * u * m_pi) / (2.0 * BLOCK_SIZE)) *
-                                               cos(((2 * y + 1) * v * m_pi) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            output[u][v] = 0.25 * cu * cv * sum;
-        }
-    }
-}
-
-// Function to compute the IDCT of an 8x8 block
-void idct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int x = 0; x < BLOCK_SIZE; x++) {
-        for (int y = 0; y < BLOCK_SIZE; y++) {
-            double sum = 0.0;
-            for (int u = 0; u < BLOCK_SIZE; u++) {
-                for (int v = 0; v < BLOCK_SIZE; v++) {
-                    double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-                    double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-                    sum += cu * cv * input[u][v] * cos(((2 * x + 1) * u * m_pi) / (2.0 * BLOCK_SIZE)) *
-                                                         cos(((2 * y + 1) * v * m_pi) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            output[x][y] = 0.25 * sum;
-        }
-    }
-}
-
-// Dynamically generate the 1920x1080 quantization matrix
-void generate_quantization_matrix(int **quantization_matrix) {
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            // Tile the 8x8 matrix across 1920x1080
-            quantization_matrix[i][j] = base_quantization_matrix[i % BLOCK_SIZE][j % BLOCK_SIZE];
-        }
-    }
-}
-
 // Generate a random matrix of size 1920x1080
-void generate_random_matrix(double **matrix) {
+void generate_random_matrix(plane *matrix) {
     for (int i = 0; i < ROWS; i++) {
+        double *row = plane_row(matrix, i);
         for (int j = 0; j < COLS; j++) {
             // Random integers between 0 and 255 (for image pixel-like values)
-            matrix[i][j] = rand() % 256;
+            row[j] = rand() % 256;
         }
     }
 }
 
-// Quantize using the generated 1920x1080 quantization matrix
-void quantize(double **dct_matrix, int **quantization_matrix, double **result) {
-    int list[11] = {-5,-4,-3,-2,-1,0,1,2,3,4,5};
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            if(round(dct_matrix[i][j] / quantization_matrix[i][j])==list[0] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[2] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[3] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[4] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[5] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[6] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[7] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[8] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[9] ||round(dct_matrix[i][j] / quantization_matrix[i][j])==list[10] || round(dct_matrix[i][j] / quantization_matrix[i][j])==list[1]  ){
-                result[i][j] = 0;
-            }
-            else{
-            result[i][j] = round(dct_matrix[i][j] / quantization_matrix[i][j]);
+// Quantize against the 8x8 table, zeroing every coefficient that rounds to
+// |q| <= deadzone[k] (k = position inside the block). Each block row is
+// gathered block-major for quantize_deadzone_blocks(), which also gives
+// block_nonzero the nonzero count of each block, blocks in raster order.
+void quantize(const plane *dct_matrix, const quant_table *quant, const int *deadzone, plane *result, unsigned char *block_nonzero) {
+    int blocks_per_row = COLS / BLOCK_SIZE;
+    double *coefficients = (double *)malloc((size_t)blocks_per_row * BLOCK_SIZE * BLOCK_SIZE * sizeof(double));
+    short *levels = (short *)malloc((size_t)blocks_per_row * BLOCK_SIZE * BLOCK_SIZE * sizeof(short));
+    if (coefficients == NULL || levels == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
+        for (int b = 0; b < blocks_per_row; b++) {
+            double (*block)[BLOCK_SIZE] = (double (*)[BLOCK_SIZE])(coefficients + b * BLOCK_SIZE * BLOCK_SIZE);
+            plane_get_block(dct_matrix, b * BLOCK_SIZE, i, block);
+        }
+        quantize_deadzone_blocks(coefficients, (size_t)blocks_per_row, quant, deadzone, levels,
+                                 block_nonzero + (i / BLOCK_SIZE) * blocks_per_row);
+        for (int x = 0; x < BLOCK_SIZE; x++) {
+            double *out = plane_row(result, i + x);
+            for (int j = 0; j < COLS; j++) {
+                out[j] = levels[(j / BLOCK_SIZE) * BLOCK_SIZE * BLOCK_SIZE + x * BLOCK_SIZE + j % BLOCK_SIZE];
             }
         }
     }
+    free(coefficients);
+    free(levels);
 }
 
 // Dequantize the matrix
-void dequantize(double **quantized_matrix, int **quantization_matrix, double **result) {
+void dequantize(const plane *quantized_matrix, const quant_table *quant, plane *result) {
     for (int i = 0; i < ROWS; i++) {
+        const int *table = quant->table + (i % BLOCK_SIZE) * BLOCK_SIZE;
+        const double *in = plane_row(quantized_matrix, i);
+        double *out = plane_row(result, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = quantized_matrix[i][j] * quantization_matrix[i][j];
+            out[j] = in[j] * table[j % BLOCK_SIZE];
         }
     }
 }
 
-void verify(double **original_matrix, double **dequantized_matrix) {
+void verify(const plane *original_matrix, const plane *dequantized_matrix) {
     int differences = 0;
     double error_margin = 10.0;  // Set an acceptable error margin due to rounding
     for (int i = 0; i < ROWS; i++) {
+        const double *original = plane_row(original_matrix, i);
+        const double *dequantized = plane_row(dequantized_matrix, i);
         for (int j = 0; j < COLS; j++) {
-            if (fabs(original_matrix[i][j] - dequantized_matrix[i][j]) > error_margin) {
+            if (fabs(original[j] - dequantized[j]) > error_margin) {
                 differences++;
             }
         }
@@ -136,21 +119,31 @@ int verify_dct_idct(double original[BLOCK_SIZE][BLOCK_SIZE], double reconstructe
         return 0; 
     }
 }
-void print_matrix(FILE *file,double **matrix, int rows, int cols) {
+void print_matrix(FILE *file,const plane *matrix, int rows, int cols) {
     
     for (int i = 0; i < rows; i++) {
+        const double *row = plane_row(matrix, i);
         for (int j = 0; j < cols; j++) {
-            fprintf(file,"%5.1f \t", matrix[i][j]);
+            fprintf(file,"%5.1f \t", row[j]);
         }
         fprintf(file,"\n");
     }
 }
 
-int main() {
-    int **quantization_matrix = (int **)malloc(ROWS * sizeof(int *));
-    double **dct_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **quantized_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **dequantized_matrix = (double **)malloc(ROWS * sizeof(double *));
+int main(int argc, char **argv) {
+    // Optional "-z n" sets the deadzone: quantized values in [-n, n] become 0
+    int deadzone_width = DEADZONE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+            deadzone_width = atoi(argv[++i]);
+        }
+    }
+    if (deadzone_width < 0) {
+        printf("Deadzone must be >= 0\n");
+        return 1;
+    }
+
+    plane dct_matrix, quantized_matrix, dequantized_matrix;
     double checker = 0;
     FILE *file1,*file2,*file3;
     file1 = fopen("quantized.txt", "w");
@@ -172,75 +165,65 @@ int main() {
     }
 
 
-    for (int i = 0; i < ROWS; i++) {
-        quantization_matrix[i] = (int *)malloc(COLS * sizeof(int));
-        dct_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        quantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        dequantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
+    if (!plane_create(&dct_matrix, COLS, ROWS, BLOCK_SIZE) || !plane_create(&quantized_matrix, COLS, ROWS, BLOCK_SIZE) ||
+        !plane_create(&dequantized_matrix, COLS, ROWS, BLOCK_SIZE)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
 
-    generate_quantization_matrix(quantization_matrix);
+    quant_table quant;
+    quant_table_init(&quant, base_quantization_matrix);
+    int deadzone[BLOCK_SIZE * BLOCK_SIZE];
+    for (int k = 0; k < BLOCK_SIZE * BLOCK_SIZE; k++) deadzone[k] = deadzone_width;
+    unsigned char *block_nonzero = (unsigned char *)malloc((ROWS / BLOCK_SIZE) * (COLS / BLOCK_SIZE));
+    if (block_nonzero == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
 
-    generate_random_matrix(dct_matrix);
-    print_matrix(file2,dct_matrix,ROWS,COLS);
+    generate_random_matrix(&dct_matrix);
+    print_matrix(file2,&dct_matrix,ROWS,COLS);
 
     double dct_block[BLOCK_SIZE][BLOCK_SIZE];
     for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
         for (int j = 0; j < COLS; j += BLOCK_SIZE) {
             // Extract the 8x8 block
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_block[x][y] = dct_matrix[i + x][j + y];
-                }
-            }
+            plane_get_block(&dct_matrix, j, i, dct_block);
 
             double dct_output[BLOCK_SIZE][BLOCK_SIZE];
             dct(dct_block, dct_output);
 
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_matrix[i + x][j + y] = dct_output[x][y];
-                }
-            }
+            plane_put_block(&dct_matrix, j, i, dct_output);
         }
     }
     
 
-    quantize(dct_matrix, quantization_matrix, quantized_matrix);
-    print_matrix(file1,quantized_matrix,ROWS,COLS);
+    quantize(&dct_matrix, &quant, deadzone, &quantized_matrix, block_nonzero);
+    int empty_blocks = 0;
+    for (int b = 0; b < (ROWS / BLOCK_SIZE) * (COLS / BLOCK_SIZE); b++) {
+        if (block_nonzero[b] == 0) empty_blocks++;
+    }
+    printf("%d of %d blocks quantized to zero\n", empty_blocks, (ROWS / BLOCK_SIZE) * (COLS / BLOCK_SIZE));
+    print_matrix(file1,&quantized_matrix,ROWS,COLS);
 
-    dequantize(quantized_matrix, quantization_matrix, dequantized_matrix);
+    dequantize(&quantized_matrix, &quant, &dequantized_matrix);
 
     double idct_block[BLOCK_SIZE][BLOCK_SIZE];
     for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
         for (int j = 0; j < COLS; j += BLOCK_SIZE) {
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    idct_block[x][y] = dequantized_matrix[i + x][j + y];
-                }
-            }
+            plane_get_block(&dequantized_matrix, j, i, idct_block);
             double idct_output[BLOCK_SIZE][BLOCK_SIZE];
-            idct(idct_block, idct_output);
+            idct_sparse(idct_block, idct_output);
 
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_matrix[i + x][j + y] = idct_output[x][y];
-                }
-            }
+            plane_put_block(&dct_matrix, j, i, idct_output);
         }
     }
-    print_matrix(file3,dct_matrix,ROWS,COLS);
+    print_matrix(file3,&dct_matrix,ROWS,COLS);
 
-    for (int i = 0; i < ROWS; i++) {
-        free(quantization_matrix[i]);
-        free(dct_matrix[i]);
-        free(quantized_matrix[i]);
-        free(dequantized_matrix[i]);
-    }
-    free(quantization_matrix);
-    free(dct_matrix);
-    free(quantized_matrix);
-    free(dequantized_matrix);
+    plane_free(&dct_matrix);
+    plane_free(&quantized_matrix);
+    plane_free(&dequantized_matrix);
+    free(block_nonzero);
 
     return 0;
 }
@@ -1,6 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#define DCT_TRANSFORM_IMPLEMENTATION
+#include "dct_transform.h"
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+#define COEFF_FILE_IMPLEMENTATION
+#include "coeff_file.h"
+#define IMAGE_WRITER_IMPLEMENTATION
+#include "image_writer.h"
+#define PLANE_IMPLEMENTATION
+#include "plane.h"
 
 #define ROWS 1920
 #define COLS 1080
@@ -19,86 +30,49 @@ int base_quantization_matrix[BLOCK_SIZE][BLOCK_SIZE] = {
     {72, 92, 95, 98, 112, 100, 103, 99}
 };
 
-// Function to compute the DCT of an 8x8 block
-void dct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int u = 0; u < BLOCK_SIZE; u++) {
-        for (int v = 0; v < BLOCK_SIZE; v++) {
-            double sum = 0.0;
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    sum += input[x][y] * cos(((2 * x + 1) * u * m_pi) / (2.0 * BLOCK_SIZE)) *
-                                               cos(((2 * y + 1) * v * m_pi) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-            output[u][v] = 0.25 * cu * cv * sum;
-        }
-    }
-}
-
-// Function to compute the IDCT of an 8x8 block
-void idct(double input[BLOCK_SIZE][BLOCK_SIZE], double output[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (int x = 0; x < BLOCK_SIZE; x++) {
-        for (int y = 0; y < BLOCK_SIZE; y++) {
-            double sum = 0.0;
-            for (int u = 0; u < BLOCK_SIZE; u++) {
-                for (int v = 0; v < BLOCK_SIZE; v++) {
-                    double cu = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
-                    double cv = (v == 0) ? 1.0 / sqrt(2.0) : 1.0;
-                    sum += cu * cv * input[u][v] * cos(((2 * x + 1) * u * m_pi) / (2.0 * BLOCK_SIZE)) *
-                                                         cos(((2 * y + 1) * v * m_pi) / (2.0 * BLOCK_SIZE));
-                }
-            }
-            output[x][y] = 0.25 * sum;
-        }
-    }
-}
-
-// Dynamically generate the 1920x1080 quantization matrix
-void generate_quantization_matrix(int **quantization_matrix) {
-    for (int i = 0; i < ROWS; i++) {
-        for (int j = 0; j < COLS; j++) {
-            // Tile the 8x8 matrix across 1920x1080
-            quantization_matrix[i][j] = base_quantization_matrix[i % BLOCK_SIZE][j % BLOCK_SIZE];
-        }
-    }
-}
-
 // Generate a random matrix of size 1920x1080
-void generate_random_matrix(double **matrix) {
+void generate_random_matrix(plane *matrix) {
     for (int i = 0; i < ROWS; i++) {
+        double *row = plane_row(matrix, i);
         for (int j = 0; j < COLS; j++) {
             // Random integers between 0 and 255 (for image pixel-like values)
-            matrix[i][j] = rand() % 256;
+            row[j] = rand() % 256;
         }
     }
 }
 
-// Quantize using the generated 1920x1080 quantization matrix
-void quantize(double **dct_matrix, int **quantization_matrix, double **result) {
+// Quantize against the 8x8 table, indexed by position inside the block
+void quantize(const plane *dct_matrix, const quant_table *quant, plane *result) {
     for (int i = 0; i < ROWS; i++) {
+        const double *recip = quant->reciprocal + (i % BLOCK_SIZE) * BLOCK_SIZE;
+        const double *in = plane_row(dct_matrix, i);
+        double *out = plane_row(result, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = round(dct_matrix[i][j] / quantization_matrix[i][j]);
+            out[j] = round(in[j] * recip[j % BLOCK_SIZE]);
         }
     }
 }
 
 // Dequantize the matrix
-void dequantize(double **quantized_matrix, int **quantization_matrix, double **result) {
+void dequantize(const plane *quantized_matrix, const quant_table *quant, plane *result) {
     for (int i = 0; i < ROWS; i++) {
+        const int *table = quant->table + (i % BLOCK_SIZE) * BLOCK_SIZE;
+        const double *in = plane_row(quantized_matrix, i);
+        double *out = plane_row(result, i);
         for (int j = 0; j < COLS; j++) {
-            result[i][j] = quantized_matrix[i][j] * quantization_matrix[i][j];
+            out[j] = in[j] * table[j % BLOCK_SIZE];
         }
     }
 }
 
-void verify(double **original_matrix, double **dequantized_matrix) {
+void verify(const plane *original_matrix, const plane *dequantized_matrix) {
     int differences = 0;
     double error_margin = 10.0;  // Set an acceptable error margin due to rounding
     for (int i = 0; i < ROWS; i++) {
+        const double *original = plane_row(original_matrix, i);
+        const double *dequantized = plane_row(dequantized_matrix, i);
         for (int j = 0; j < COLS; j++) {
-            if (fabs(original_matrix[i][j] - dequantized_matrix[i][j]) > error_margin) {
+            if (fabs(original[j] - dequantized[j]) > error_margin) {
                 differences++;
             }
         }
@@ -130,111 +104,184 @@ int verify_dct_idct(double original[BLOCK_SIZE][BLOCK_SIZE], double reconstructe
         return 0; 
     }
 }
-void print_matrix(FILE *file,double **matrix, int rows, int cols) {
+void print_matrix(FILE *file,const plane *matrix, int rows, int cols) {
     
     for (int i = 0; i < rows; i++) {
+        const double *row = plane_row(matrix, i);
         for (int j = 0; j < cols; j++) {
-            fprintf(file,"%5.1f \t", matrix[i][j]);
+            fprintf(file,"%5.1f \t", row[j]);
         }
         fprintf(file,"\n");
     }
 }
 
-int main() {
-    int **quantization_matrix = (int **)malloc(ROWS * sizeof(int *));
-    double **dct_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **quantized_matrix = (double **)malloc(ROWS * sizeof(double *));
-    double **dequantized_matrix = (double **)malloc(ROWS * sizeof(double *));
+// Store the quantized matrix as a one-channel coefficient file (block-major int16)
+int write_coefficients(const char *filename, const plane *quantized_matrix, const quant_table *quant) {
+    coeff_header header;
+    header.width = COLS;
+    header.height = ROWS;
+    header.channels = 1;
+    header.block_size = BLOCK_SIZE;
+    header.coding = COEFF_CODING_RAW;
+    header.index_interval = 0;
+    memcpy(header.table, quant->table, sizeof(quant->table));
+
+    short *coefficients = (short *)malloc(coeff_channel_size(&header) * sizeof(short));
+    short *block = coefficients;
+    for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
+        for (int j = 0; j < COLS; j += BLOCK_SIZE) {
+            for (int x = 0; x < BLOCK_SIZE; x++) {
+                const double *row = plane_row(quantized_matrix, i + x) + j;
+                for (int y = 0; y < BLOCK_SIZE; y++) {
+                    *block++ = (short)row[y];
+                }
+            }
+        }
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Error opening file %s!\n", filename);
+        free(coefficients);
+        return 0;
+    }
+    int written = coeff_write_header(file, &header) && coeff_write_channel(file, &header, coefficients);
+    fclose(file);
+    free(coefficients);
+    return written;
+}
+
+// Reconstruction as a greyscale image (.pgm, .bmp or .png), one rounded and
+// clamped row at a time
+int write_image(const char *filename, const plane *matrix) {
+    int format = image_writer_format(filename);
+    if (format < 0) {
+        printf("Unknown image format for %s (use .pgm, .bmp or .png)\n", filename);
+        return 0;
+    }
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Error opening file %s!\n", filename);
+        return 0;
+    }
+    image_writer writer;
+    unsigned char row[COLS];
+    int written = image_writer_open(&writer, file, format, COLS, ROWS, 1, IMAGE_PNG_RLE);
+    for (int i = 0; written && i < ROWS; i++) {
+        const double *samples = plane_row(matrix, i);
+        for (int j = 0; j < COLS; j++) {
+            double value = round(samples[j]);
+            row[j] = (unsigned char)(value < 0.0 ? 0 : value > 255.0 ? 255 : value);
+        }
+        written = image_writer_put_rows(&writer, row, COLS, 1);
+    }
+    written = image_writer_close(&writer) && written;
+    fclose(file);
+    if (!written) printf("Error writing %s\n", filename);
+    return written;
+}
+
+int main(int argc, char **argv) {
+    // Optional "-e table|aan|fixed|simd" selects the DCT engine, "-q 1..100" the quality,
+    // "-t" also writes quantized.txt, "-i file.pgm|.bmp|.png" the reconstruction as an image
+    int quality = 50;
+    int text_output = 0;
+    const char *image_name = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            if (!dct_select_engine(argv[++i])) {
+                printf("Unknown DCT engine %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            quality = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            text_output = 1;
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            image_name = argv[++i];
+        }
+    }
+
+    plane dct_matrix, quantized_matrix, dequantized_matrix;
     double checker = 0;
-    FILE *file1,*file2,*file3;
-    file1 = fopen("quantized.txt", "w");
+    FILE *file1 = NULL,*file2,*file3;
+    if (text_output) {
+        file1 = fopen("quantized.txt", "w");
+        if (file1 == NULL) {
+            printf("Error opening file!\n");
+            return 1; 
+        }
+    }
     file2 = fopen("raw.txt","w");
     
-    if (file1 == NULL) {
-        printf("Error opening file!\n");
-        return 1; 
-    }
     if (file2 == NULL) {
         printf("Error opening file!\n");
         return 1; 
     }
     file3 = fopen("generated.txt","w");
     
-    if (file1 == NULL) {
+    if (file3 == NULL) {
         printf("Error opening file!\n");
         return 1; 
     }
 
 
-    for (int i = 0; i < ROWS; i++) {
-        quantization_matrix[i] = (int *)malloc(COLS * sizeof(int));
-        dct_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        quantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
-        dequantized_matrix[i] = (double *)malloc(COLS * sizeof(double));
+    if (!plane_create(&dct_matrix, COLS, ROWS, BLOCK_SIZE) || !plane_create(&quantized_matrix, COLS, ROWS, BLOCK_SIZE) ||
+        !plane_create(&dequantized_matrix, COLS, ROWS, BLOCK_SIZE)) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
 
-    generate_quantization_matrix(quantization_matrix);
+    quant_table quant;
+    quant_table_for_quality(base_quantization_matrix, quality, &quant);
 
-    generate_random_matrix(dct_matrix);
-    print_matrix(file2,dct_matrix,ROWS,COLS);
+    generate_random_matrix(&dct_matrix);
+    print_matrix(file2,&dct_matrix,ROWS,COLS);
 
     double dct_block[BLOCK_SIZE][BLOCK_SIZE];
     for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
         for (int j = 0; j < COLS; j += BLOCK_SIZE) {
             // Extract the 8x8 block
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_block[x][y] = dct_matrix[i + x][j + y];
-                }
-            }
+            plane_get_block(&dct_matrix, j, i, dct_block);
 
             double dct_output[BLOCK_SIZE][BLOCK_SIZE];
-            dct(dct_block, dct_output);
+            dct_forward(dct_block, dct_output);
 
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_matrix[i + x][j + y] = dct_output[x][y];
-                }
-            }
+            plane_put_block(&dct_matrix, j, i, dct_output);
         }
     }
     
 
-    quantize(dct_matrix, quantization_matrix, quantized_matrix);
-    print_matrix(file1,quantized_matrix,ROWS,COLS);
+    quantize(&dct_matrix, &quant, &quantized_matrix);
+    if (!write_coefficients("quantized.dctc", &quantized_matrix, &quant)) {
+        printf("Error writing quantized.dctc\n");
+        return 1;
+    }
+    if (text_output) {
+        print_matrix(file1,&quantized_matrix,ROWS,COLS);
+        fclose(file1);
+    }
 
-    dequantize(quantized_matrix, quantization_matrix, dequantized_matrix);
+    dequantize(&quantized_matrix, &quant, &dequantized_matrix);
 
     double idct_block[BLOCK_SIZE][BLOCK_SIZE];
     for (int i = 0; i < ROWS; i += BLOCK_SIZE) {
         for (int j = 0; j < COLS; j += BLOCK_SIZE) {
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    idct_block[x][y] = dequantized_matrix[i + x][j + y];
-                }
-            }
+            plane_get_block(&dequantized_matrix, j, i, idct_block);
             double idct_output[BLOCK_SIZE][BLOCK_SIZE];
-            idct(idct_block, idct_output);
+            idct_sparse(idct_block, idct_output);
 
-            for (int x = 0; x < BLOCK_SIZE; x++) {
-                for (int y = 0; y < BLOCK_SIZE; y++) {
-                    dct_matrix[i + x][j + y] = idct_output[x][y];
-                }
-            }
+            plane_put_block(&dct_matrix, j, i, idct_output);
         }
     }
-    print_matrix(file3,dct_matrix,ROWS,COLS);
+    print_matrix(file3,&dct_matrix,ROWS,COLS);
+    fclose(file2);
+    fclose(file3);
+    if (image_name != NULL && !write_image(image_name, &dct_matrix)) return 1;
 
-    for (int i = 0; i < ROWS; i++) {
-        free(quantization_matrix[i]);
-        free(dct_matrix[i]);
-        free(quantized_matrix[i]);
-        free(dequantized_matrix[i]);
-    }
-    free(quantization_matrix);
-    free(dct_matrix);
-    free(quantized_matrix);
-    free(dequantized_matrix);
+    plane_free(&dct_matrix);
+    plane_free(&quantized_matrix);
+    plane_free(&dequantized_matrix);
 
     return 0;
 }